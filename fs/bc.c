@@ -1,18 +1,287 @@
 #include "fs.h"
 #include "nvme.h"
 
+/* Cached blocks form a CLOCK ring.  Superblock and bitmap blocks
+ * are touched by almost every request and are kept out of it,
+ * all other blocks count against bc_budget. */
+struct BcSlot {
+    blockno_t bs_blockno;
+    bool bs_chance;     /* Dirty block already got its second chance */
+    bool bs_readahead;  /* Read ahead and not seen accessed yet */
+};
+
+static struct BcSlot bc_clock[BC_MAX_BUDGET];
+static size_t bc_nclock, bc_hand;
+/* Blocks that have a slot in the ring.  A block unmapped from
+ * outside keeps its slot until the hand finds it, and reuses the
+ * slot if it faults back in before that. */
+static uint32_t bc_slotted[DISKSIZE / BLKSIZE / 32];
+static size_t bc_budget = BC_DEFAULT_BUDGET;
+
+/* Sequential read streams.  Fault at or just after bs_next continues
+ * a stream and doubles its read-ahead window, any other fault
+ * starts a new stream in place of the oldest one.
+ * Windows are limited by bc_ra_max, which shrinks when read ahead
+ * blocks are evicted unused and grows back when full windows
+ * keep getting consumed. */
+#define BC_NSTREAMS 8
+
+struct BcStream {
+    blockno_t bs_next;   /* First block after the last read */
+    uint32_t bs_window;  /* Blocks to read on the next fault */
+};
+
+static struct BcStream bc_streams[BC_NSTREAMS];
+static size_t bc_stream_next;
+static uint32_t bc_ra_max = BC_RA_MAX;
+
+struct BcStats bc_stats;
+
+static void *
+blockaddr(blockno_t blockno) {
+    return (void *)(uintptr_t)(DISKMAP + blockno * BLKSIZE);
+}
+
+/* Blocks that are never evicted */
+static bool
+bc_pinned(blockno_t blockno) {
+    if (blockno < 2) return 1;
+    return super && blockno < 2 + (super->s_nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
+}
+
 /* Return the virtual address of this disk block. */
 void *
 diskaddr(blockno_t blockno) {
-    if (blockno == 0 || (super && blockno >= super->s_nblocks))
+    return diskaddr_range(blockno, 1);
+}
+
+/* Return the virtual address of n consecutive disk blocks
+ * starting at blockno; they are mapped contiguously. */
+void *
+diskaddr_range(blockno_t blockno, size_t n) {
+    if (blockno == 0 || (super && (blockno >= super->s_nblocks || n > super->s_nblocks - blockno)))
         panic("bad block number %08x in diskaddr", blockno);
-    void *r = (void *)(uintptr_t)(DISKMAP + blockno * BLKSIZE);
+    void *r = blockaddr(blockno);
+    for (size_t i = 0; i < n; i++)
+        if (is_page_present(r + i * BLKSIZE)) bc_stats.bs_hits++;
 #ifdef SANITIZE_USER_SHADOW_BASE
-    platform_asan_unpoison(r, BLKSIZE);
+    platform_asan_unpoison(r, n * BLKSIZE);
 #endif
     return r;
 }
 
+/* Advance the CLOCK hand until it points to a block
+ * that is not referenced, write it back if it is dirty and unmap it.
+ * Clean referenced blocks get their accessed bit cleared
+ * (by remapping, one batch per turn of the hand), dirty ones can't
+ * be remapped without losing the dirty bit and get a single
+ * second chance instead.  Blocks of the running log transaction
+ * are skipped.  Ends after at most three turns.
+ * Returns 0 if there was no block to evict. */
+static bool
+bc_evict(void) {
+    struct MapVecBatch clear;
+    bool evicted = 0;
+    int res;
+
+    mapvec_init(&clear, CURENVID, CURENVID, 0);
+    for (size_t scanned = 1; scanned <= 3 * bc_nclock; scanned++, bc_hand = (bc_hand + 1) % bc_nclock) {
+        struct BcSlot *slot = &bc_clock[bc_hand];
+        void *addr = blockaddr(slot->bs_blockno);
+        pte_t pte = get_uvpt_entry(addr);
+
+        /* Unmapped from outside, e.g. by the tests */
+        if (!(pte & PTE_P)) {
+            CLRBIT(bc_slotted, slot->bs_blockno);
+            evicted = 1;
+            break;
+        }
+
+        if (pte & PTE_A) slot->bs_readahead = 0;
+
+        if (fs_log_pending(addr)) {
+            /* Can't go home before the commit */
+        } else if ((pte & PTE_A) && !(pte & PTE_D)) {
+            if ((res = mapvec_add(&clear, addr, addr, BLKSIZE, PROT_RW)) < 0)
+                panic("bc_evict: %i", res);
+            slot->bs_chance = 0;
+        } else if ((pte & PTE_A) && !slot->bs_chance) {
+            slot->bs_chance = 1;
+        } else {
+            if (pte & PTE_D) {
+                flush_block(addr);
+                bc_stats.bs_writebacks++;
+            }
+            if ((res = sys_unmap_region(CURENVID, addr, BLKSIZE)) < 0)
+                panic("bc_evict: %i", res);
+            bc_stats.bs_evictions++;
+            if (slot->bs_readahead) {
+                bc_stats.bs_ra_wasted++;
+                if (bc_ra_max > 1) bc_ra_max--;
+            }
+            CLRBIT(bc_slotted, slot->bs_blockno);
+            evicted = 1;
+            break;
+        }
+
+        /* Accessed bits have to be cleared before the next turn */
+        if (!(scanned % bc_nclock) && (res = mapvec_flush(&clear)) < 0)
+            panic("bc_evict: %i", res);
+    }
+
+    if ((res = mapvec_flush(&clear)) < 0)
+        panic("bc_evict: %i", res);
+    return evicted;
+}
+
+/* Track newly cached block, evicting another one if
+ * the cache is full.  The new block takes the victim's slot. */
+static void
+bc_insert(blockno_t blockno, bool readahead) {
+    if (bc_pinned(blockno) || TSTBIT(bc_slotted, blockno)) return;
+    SETBIT(bc_slotted, blockno);
+
+    if (bc_nclock < bc_budget) {
+        bc_clock[bc_nclock++] = (struct BcSlot){blockno, 0, readahead};
+        bc_stats.bs_resident = bc_nclock;
+        return;
+    }
+
+    /* Cache goes over the budget while the log pins
+     * all its blocks, it is trimmed after the commit */
+    if (!bc_evict()) {
+        if (bc_nclock == BC_MAX_BUDGET) panic("bc_insert: all blocks are pinned");
+        bc_clock[bc_nclock++] = (struct BcSlot){blockno, 0, readahead};
+        bc_stats.bs_resident = bc_nclock;
+        return;
+    }
+    bc_clock[bc_hand] = (struct BcSlot){blockno, 0, readahead};
+    bc_hand = (bc_hand + 1) % bc_nclock;
+}
+
+/* Change cache budget (in blocks), evicting blocks above it.
+ * Returns the budget in effect. */
+size_t
+bc_set_budget(size_t budget) {
+    if (budget) bc_budget = MIN(MAX(budget, BC_MIN_BUDGET), BC_MAX_BUDGET);
+
+    while (bc_nclock > bc_budget && bc_evict()) {
+        bc_clock[bc_hand] = bc_clock[--bc_nclock];
+        if (bc_hand >= bc_nclock) bc_hand = 0;
+    }
+
+    bc_stats.bs_resident = bc_nclock;
+    return bc_budget;
+}
+
+/* Number of blocks to read starting with faulted blockno.
+ * Read stops before the first cached block. */
+static size_t
+bc_readahead(blockno_t blockno) {
+    struct BcStream *stream = NULL;
+    for (size_t i = 0; i < BC_NSTREAMS; i++) {
+        struct BcStream *st = &bc_streams[i];
+        if (st->bs_window && blockno >= st->bs_next && blockno <= st->bs_next + st->bs_window) {
+            stream = st;
+            break;
+        }
+    }
+
+    if (!stream) {
+        stream = &bc_streams[bc_stream_next++ % BC_NSTREAMS];
+        stream->bs_window = 1;
+    } else {
+        if (stream->bs_window >= bc_ra_max && bc_ra_max < BC_RA_MAX) bc_ra_max++;
+        stream->bs_window = MIN(stream->bs_window * 2, bc_ra_max);
+    }
+
+    size_t max = MIN(stream->bs_window, nvme_max_sectors() / BLKSECTS);
+    max = MIN(max, bc_budget / 4);
+    if (super) max = MIN(max, super->s_nblocks - blockno);
+
+    size_t n = 1;
+    while (n < max && !is_page_present(blockaddr(blockno + n))) n++;
+
+    stream->bs_next = blockno + n;
+    return n;
+}
+
+/* Dirty blocks are found by their PTE_D bits.  A dirty block is
+ * written before it is evicted or reclaimed, so all of them are
+ * either pinned or have a slot in the CLOCK ring, and write-back
+ * only has to look at these. */
+#define BC_MAX_PINNED (2 + DISKSIZE / BLKSIZE / BLKBITSIZE)
+
+static blockno_t bc_dirty[BC_MAX_PINNED + BC_MAX_BUDGET];
+
+static bool
+bc_is_dirty(blockno_t blockno) {
+    pte_t pte = get_uvpt_entry(blockaddr(blockno));
+    return (pte & PTE_P) && (pte & PTE_D);
+}
+
+static void
+sort_blocks(blockno_t *blocks, size_t n) {
+    /* Shell sort with gaps 3k+1 */
+    size_t gap = 1;
+    while (gap < n / 3) gap = 3 * gap + 1;
+
+    for (; gap; gap /= 3) {
+        for (size_t i = gap; i < n; i++) {
+            blockno_t b = blocks[i];
+            size_t j = i;
+            for (; j >= gap && blocks[j - gap] > b; j -= gap)
+                blocks[j] = blocks[j - gap];
+            blocks[j] = b;
+        }
+    }
+}
+
+/* Write all dirty blocks out, merging runs of consecutive blocks
+ * into single NVMe commands, and clear their dirty bits.
+ * Returns number of blocks written. */
+size_t
+bc_writeback(void) {
+    struct MapVecBatch clean;
+    size_t maxrun = nvme_max_sectors() / BLKSECTS;
+    size_t n = 0, written = 0;
+    int res;
+
+    /* Pinned blocks come first and in order,
+     * only blocks from the ring need sorting.  Logged metadata
+     * can go home only after its log record, so blocks of the
+     * running transaction wait for the commit */
+    for (blockno_t b = 1; bc_pinned(b); b++)
+        if (bc_is_dirty(b) && !fs_log_pending(blockaddr(b))) bc_dirty[n++] = b;
+    size_t npinned = n;
+    for (size_t i = 0; i < bc_nclock; i++) {
+        blockno_t b = bc_clock[i].bs_blockno;
+        if (bc_is_dirty(b) && !fs_log_pending(blockaddr(b))) bc_dirty[n++] = b;
+    }
+    sort_blocks(bc_dirty + npinned, n - npinned);
+
+    mapvec_init(&clean, CURENVID, CURENVID, 0);
+    for (size_t i = 0; i < n;) {
+        size_t run = 1;
+        while (i + run < n && run < maxrun && bc_dirty[i + run] == bc_dirty[i] + run) run++;
+
+        void *addr = blockaddr(bc_dirty[i]);
+        if ((res = nvme_write(bc_dirty[i] * BLKSECTS, addr, run * BLKSECTS)))
+            panic("bc_writeback: nvme write error - %i\n", res);
+        if ((res = mapvec_add(&clean, addr, addr, run * BLKSIZE, PROT_RW)) < 0)
+            panic("bc_writeback: %i", res);
+
+        bc_stats.bs_wb_ios++;
+        written += run;
+        i += run;
+    }
+
+    if ((res = mapvec_flush(&clean)) < 0)
+        panic("bc_writeback: %i", res);
+    bc_stats.bs_wb_blocks += written;
+    return written;
+}
+
 /* Fault any disk block that is read in to memory by
  * loading it from disk. */
 static bool
@@ -34,17 +303,145 @@ bc_pgfault(struct UTrapframe *utf) {
     // LAB 10: Your code here
     int res;
     addr = ROUNDDOWN(addr, BLKSIZE);
-    if ((res = sys_alloc_region(CURENVID, addr, BLKSIZE, PROT_RW)))
+    if (is_page_present(addr)) return 0;
+
+    size_t n = super ? bc_readahead(blockno) : 1;
+    bc_stats.bs_misses++;
+    bc_stats.bs_readahead += n - 1;
+
+    if ((res = sys_alloc_region(CURENVID, addr, n * BLKSIZE, PROT_RW)))
         panic("bc_pgfault couldn't alloc region: %i", res);
 
-    *(char *)addr = 0;
+    /* Make pages backed by real memory before DMA */
+    for (size_t i = 0; i < n; i++)
+        ((volatile char *)addr)[i * BLKSIZE] = 0;
 
-    if ((res = nvme_read(blockno * BLKSECTS, addr, BLKSECTS)))
+    if ((res = nvme_read(blockno * BLKSECTS, addr, n * BLKSECTS)))
         panic("bc_pgfault couldn't read the block: %i", res);
 
+    /* Blocks just read are neither dirty nor referenced yet */
+    if ((res = sys_map_region(CURENVID, addr, CURENVID, addr, n * BLKSIZE, PROT_RW)))
+        panic("bc_pgfault couldn't clean the block: %i", res);
+
+    /* Tracked only when mapped, so that eviction doesn't take
+     * their slots as free ones */
+    for (size_t i = 0; i < n; i++)
+        bc_insert(blockno + i, i > 0);
+
     return 1;
 }
 
+/* Asynchronous fills.  bc_fetch() starts reading a missing block
+ * into its own page at BC_FILLMAP, so that requests which don't need
+ * it keep running on the cached blocks meanwhile.  The page is moved
+ * into the disk map by bc_fetch_wait().  A block faulted in by
+ * someone else in the meantime wins, and its fill is dropped. */
+struct BcFill {
+    blockno_t bf_blockno;
+    int bf_tag; /* nvme_submit_read() tag */
+};
+
+static_assert(BC_FILLMAP >= DISKMAP + DISKSIZE, "Fill pages overlap the disk map");
+static_assert(BC_FILLMAP + BC_MAX_FILLS * BLKSIZE <= FDTABLE ||
+                      BC_FILLMAP >= FDTABLE + 2 * MAXFD * PAGE_SIZE,
+              "Fill pages overlap the file descriptor table");
+
+static struct BcFill bc_fills[BC_MAX_FILLS];
+static size_t bc_nfills;
+
+static void *
+filladdr(size_t i) {
+    return (void *)(uintptr_t)(BC_FILLMAP + i * BLKSIZE);
+}
+
+/* Check whether a fill of blockno is in flight */
+bool
+bc_fetching(blockno_t blockno) {
+    for (size_t i = 0; i < bc_nfills; i++)
+        if (bc_fills[i].bf_blockno == blockno) return 1;
+    return 0;
+}
+
+/* Start reading blockno if it is not cached.  The read is only
+ * queued, nvme_kick() hands all queued reads to the device at once.
+ * Returns true if the block is being read, false if it is cached
+ * or can't be fetched (then it is faulted in on access as usual). */
+bool
+bc_fetch(blockno_t blockno) {
+    void *addr = blockaddr(blockno);
+    int res;
+
+    if (!blockno || (super && blockno >= super->s_nblocks)) return 0;
+    if (is_page_present(addr)) return 0;
+    if (bc_fetching(blockno)) return 1;
+    /* Fills must not evict each other before they are used */
+    if (bc_nfills == MIN(BC_MAX_FILLS, bc_budget / 4)) return 0;
+
+    void *fill = filladdr(bc_nfills);
+    if ((res = sys_alloc_region(CURENVID, fill, BLKSIZE, PROT_RW)))
+        panic("bc_fetch couldn't alloc region: %i", res);
+    /* Make page backed by real memory before DMA */
+    *(volatile char *)fill = 0;
+
+    if ((res = nvme_submit_read(blockno * BLKSECTS, fill, BLKSECTS)) < 0) {
+        sys_unmap_region(CURENVID, fill, BLKSIZE);
+        return 0;
+    }
+
+    bc_fills[bc_nfills++] = (struct BcFill){blockno, res};
+    return 1;
+}
+
+/* Move block of completed fill i into the cache.
+ * Returns true if it was not cached meanwhile. */
+static bool
+bc_fill_done(size_t i) {
+    struct BcFill *bf = &bc_fills[i];
+    void *fill = filladdr(i), *addr = blockaddr(bf->bf_blockno);
+    bool cached = 0;
+    int res;
+
+    /* Blocks just read are neither dirty nor referenced yet */
+    if (!is_page_present(addr)) {
+        if ((res = sys_map_region(CURENVID, fill, CURENVID, addr, BLKSIZE, PROT_RW)))
+            panic("bc_fetch_wait couldn't map the block: %i", res);
+        bc_insert(bf->bf_blockno, 0);
+        bc_stats.bs_misses++;
+        bc_stats.bs_fills++;
+        cached = 1;
+    }
+    sys_unmap_region(CURENVID, fill, BLKSIZE);
+    bf->bf_tag = -1;
+    return cached;
+}
+
+/* Wait for all fills in flight and move their blocks into the cache
+ * in order of completion.  Returns number of blocks cached. */
+size_t
+bc_fetch_wait(void) {
+    struct NvmeCompletion done[BC_MAX_FILLS];
+    size_t n = 0, left = bc_nfills;
+
+    if (bc_nfills) bc_stats.bs_fill_ios++;
+    while (left) {
+        size_t ndone = nvme_reap(done, left, 1);
+        if (!ndone) panic("bc_fetch_wait: fills timed out");
+
+        for (size_t j = 0; j < ndone; j++, left--) {
+            size_t i = 0;
+            while (i < bc_nfills && bc_fills[i].bf_tag != done[j].nc_tag) i++;
+            if (i == bc_nfills)
+                panic("bc_fetch_wait: unexpected tag %d", done[j].nc_tag);
+            if (done[j].nc_status)
+                panic("bc_fetch_wait couldn't read the block: %i", done[j].nc_status);
+            n += bc_fill_done(i);
+        }
+    }
+
+    bc_nfills = 0;
+    return n;
+}
+
 /* Flush the contents of the block containing VA out to disk if
  * necessary, then clear the PTE_D bit using sys_map_region().
  * If the block is not in the block cache or is not dirty, does
@@ -64,15 +461,47 @@ flush_block(void *addr) {
 
     // LAB 10: Your code here.
     addr = ROUNDDOWN(addr, BLKSIZE);
+    /* Running log transaction pins its blocks until the commit */
+    if (fs_log_pending(addr)) return;
     if (is_page_present(addr) && is_page_dirty(addr)) {
         if ((res = nvme_write(blockno * BLKSECTS, addr, BLKSECTS)))
             panic("flush_block: nvme write block error - %i\n", res);
-        if ((res = sys_map_region(CURENVID, addr, CURENVID, addr, BLKSIZE, PTE_SYSCALL & get_prot(addr))))
+        if ((res = sys_map_region(CURENVID, addr, CURENVID, addr, BLKSIZE, PROT_RW)))
             panic("flush_block: sys map region error - %i\n", res);
     }
     assert(!is_page_dirty(addr));
 }
 
+/* Drop up to WANT clean blocks from the block cache to give memory
+ * back to the kernel. Superblock and bitmap blocks are kept since
+ * they are touched by almost every request.
+ * Returns the number of blocks dropped. */
+size_t
+bc_reclaim(size_t want) {
+    size_t dropped = 0;
+    struct MapVecBatch batch;
+
+    /* Dropped slots are filled from the end of the ring */
+    mapvec_init(&batch, CURENVID, CURENVID, 1);
+    for (size_t i = 0; i < bc_nclock && dropped < want;) {
+        void *addr = blockaddr(bc_clock[i].bs_blockno);
+        if ((is_page_present(addr) && is_page_dirty(addr)) || fs_log_pending(addr)) {
+            i++;
+            continue;
+        }
+        if (is_page_present(addr) && mapvec_add(&batch, addr, addr, BLKSIZE, 0) < 0) break;
+        CLRBIT(bc_slotted, bc_clock[i].bs_blockno);
+        bc_clock[i] = bc_clock[--bc_nclock];
+        dropped++;
+    }
+    if (bc_hand >= bc_nclock) bc_hand = 0;
+    bc_stats.bs_resident = bc_nclock;
+
+    /* Only fails on bad arguments, which would be a bug here */
+    if (mapvec_flush(&batch) < 0) return 0;
+    return dropped;
+}
+
 /* Test that the block cache works, by smashing the superblock and
  * reading it back. */
 static void
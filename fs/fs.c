@@ -2,6 +2,7 @@
 #include <inc/partition.h>
 
 #include "fs.h"
+#include "nvme.h"
 
 /* Superblock */
 struct Super *super;
@@ -43,35 +44,91 @@ free_block(blockno_t blockno) {
     /* Blockno zero is the null pointer of block numbers. */
     if (blockno == 0) panic("attempt to free zero block");
     SETBIT(bitmap, blockno);
+    fs_log_block(&bitmap[blockno / 32]);
 }
 
-/* Search the bitmap for a free block and allocate it.  When you
- * allocate a block, immediately flush the changed bitmap block
- * to disk.
- *
- * Return block number allocated on success,
- * 0 if we are out of blocks.
- *
- * Hint: use free_block as an example for manipulating the bitmap. */
-blockno_t
-alloc_block(void) {
-    /* The bitmap consists of one or more blocks.  A single bitmap block
-     * contains the in-use bits for BLKBITSIZE blocks.  There are
-     * super->s_nblocks blocks in the disk altogether. */
+/* Next-fit cursor: searches without a hint start here */
+static blockno_t alloc_cursor;
 
-    // LAB 10: Your code here
-    for (blockno_t blockno = 1; blockno < super->s_nblocks; blockno++) {
-        if (block_is_free(blockno)) {
-            if (blockno == 0) panic("attempt to occupy zero block");
-            CLRBIT(bitmap, blockno);
-            flush_block(&bitmap[blockno / 32]);
-            return blockno;
+/* Find n contiguous free blocks within [from, to), testing
+ * 64 bitmap bits at a time.  Returns first block of the run or 0. */
+static blockno_t
+bitmap_find_run(blockno_t from, blockno_t to, size_t n) {
+    const uint64_t *words = (const uint64_t *)bitmap;
+    blockno_t start = 0;
+    size_t len = 0;
+
+    for (blockno_t b = from; b < to;) {
+        uint64_t w = words[b / 64] >> (b % 64);
+
+        /* No free blocks in the rest of the word */
+        if (!w) {
+            len = 0;
+            b = ROUNDDOWN(b, 64) + 64;
+            continue;
         }
+
+        /* Skip to the next free block */
+        if (!(w & 1)) {
+            len = 0;
+            b += __builtin_ctzll(w);
+            continue;
+        }
+
+        size_t nfree = ~w ? __builtin_ctzll(~w) : 64;
+        if (!len) start = b;
+        len += nfree;
+        if (len >= n) return start + n <= to ? start : 0;
+        b += nfree;
     }
 
     return 0;
 }
 
+/* Allocate n contiguous blocks, preferring ones starting at hint
+ * (e.g. the block after the previous block of the file)
+ * and then continuing from the last allocation.
+ * Changed bitmap blocks go to the metadata log.
+ *
+ * Return first block number of the run on success,
+ * 0 if there's no run of n free blocks. */
+blockno_t
+alloc_block_run(blockno_t hint, size_t n) {
+    blockno_t nblocks = super->s_nblocks;
+    blockno_t res = 0;
+
+    if (!n || n >= nblocks) return 0;
+    if (hint && hint < nblocks && block_is_free(hint))
+        res = bitmap_find_run(hint, MIN(hint + n, nblocks), n);
+
+    blockno_t from = alloc_cursor && alloc_cursor < nblocks ? alloc_cursor : 1;
+    if (!res) res = bitmap_find_run(from, nblocks, n);
+    if (!res) res = bitmap_find_run(1, MIN(from + n, nblocks), n);
+    if (!res) return 0;
+
+    for (blockno_t b = res; b < res + n; b++)
+        CLRBIT(bitmap, b);
+    fs_log_block(&bitmap[res / 32]);
+    fs_log_block(&bitmap[(res + n - 1) / 32]);
+    alloc_cursor = res + n;
+    return res;
+}
+
+/* Allocate one block, preferably hint */
+blockno_t
+alloc_block_near(blockno_t hint) {
+    return alloc_block_run(hint, 1);
+}
+
+/* Search the bitmap for a free block and allocate it.
+ *
+ * Return block number allocated on success,
+ * 0 if we are out of blocks. */
+blockno_t
+alloc_block(void) {
+    return alloc_block_run(0, 1);
+}
+
 /* Validate the file system bitmap.
  *
  * Check that all reserved blocks -- 0, 1, and the bitmap blocks themselves --
@@ -91,6 +148,356 @@ check_bitmap(void) {
     cprintf("bitmap is good\n");
 }
 
+/****************************************************************
+ *                         Metadata log
+ ****************************************************************/
+
+/* Metadata blocks are not written home right after a change.
+ * fs_log_block() adds the block to the running transaction,
+ * which collects changes of all requests since the last commit.
+ * fs_log_commit() writes images of all its blocks to the log
+ * with a single sequential write (group commit), and only after
+ * that the blocks may go home with the usual write-back.  Until
+ * then they are pinned in the cache: eviction and write-back skip
+ * them.  The server is single threaded and commits only between
+ * requests (fs_log_request_done()), so a transaction never holds
+ * a half-done operation.  It can grow up to log_txn_max blocks:
+ * requests log at most LOG_OP_BLOCKS blocks, ones that may log
+ * more check that they fit with fs_log_reserve() first.
+ * Log space is reclaimed by a checkpoint once all logged blocks
+ * are home, which is done right after a commit that leaves no
+ * room for another full transaction. */
+
+struct LogStats log_stats;
+
+/* Log is used only if the superblock has FS_FEATURE_LOG */
+static bool log_enabled;
+static uint32_t log_nblocks; /* Usable log size */
+static uint32_t log_txn_max; /* Maximal blocks in a transaction */
+static uint32_t log_tail;    /* Next free block in the log */
+static uint32_t log_seq;     /* Sequence number of the next record */
+
+/* Blocks of the running transaction, as a list and a bitmap */
+static blockno_t log_pending[LOG_MAX_BLOCKS / 2];
+static size_t log_npending;
+static uint32_t log_pending_map[DISKSIZE / BLKSIZE / 32];
+
+/* Blocks in committed records, maybe not home yet */
+static blockno_t log_committed[LOG_MAX_BLOCKS];
+static size_t log_ncommitted;
+
+/* Record being written or replayed */
+static uint8_t log_buf[(LOG_MAX_TXN + 1) * BLKSIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static blockno_t
+log_blockno(const void *addr) {
+    return ((uintptr_t)addr - DISKMAP) / BLKSIZE;
+}
+
+static bool
+log_find(const blockno_t *blocks, size_t n, blockno_t blockno) {
+    for (size_t i = 0; i < n; i++)
+        if (blocks[i] == blockno) return 1;
+    return 0;
+}
+
+/* Log blocks taken by a transaction of n blocks */
+static uint32_t
+log_space(size_t n) {
+    return n + CEILDIV(n, LOG_MAX_TXN);
+}
+
+/* FNV-1a over the block images of a record */
+static uint32_t
+log_checksum(const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    uint32_t hash = 2166136261U;
+    while (len--)
+        hash = (hash ^ *p++) * 16777619U;
+    return hash;
+}
+
+/* Write (or read) n blocks of buf to the log at block off */
+static void
+log_io(bool write, uint32_t off, uint8_t *buf, size_t n) {
+    size_t maxrun = nvme_max_sectors() / BLKSECTS;
+    int res;
+
+    for (size_t i = 0; i < n; i += maxrun) {
+        size_t run = MIN(maxrun, n - i);
+        uint64_t secno = (super->s_log_start + off + i) * BLKSECTS;
+        res = write ? nvme_write(secno, buf + i * BLKSIZE, run * BLKSECTS) :
+                      nvme_read(secno, buf + i * BLKSIZE, run * BLKSECTS);
+        if (res) panic("log %s error - %i", write ? "write" : "read", res);
+    }
+}
+
+/* Append a record of n (at most LOG_MAX_TXN) blocks to the log */
+static void
+log_write(const blockno_t *blocks, size_t n, uint32_t flags) {
+    struct LogHeader *hdr = (struct LogHeader *)log_buf;
+
+    for (size_t i = 0; i < n; i++) {
+        memcpy(log_buf + (i + 1) * BLKSIZE, diskaddr(blocks[i]), BLKSIZE);
+        hdr->lh_blocks[i] = blocks[i];
+    }
+    hdr->lh_magic = LOG_MAGIC;
+    hdr->lh_seq = log_seq;
+    hdr->lh_count = n;
+    hdr->lh_flags = flags;
+    hdr->lh_checksum = log_checksum(log_buf + BLKSIZE, n * BLKSIZE);
+    log_io(1, log_tail, log_buf, n + 1);
+
+    log_tail += n + 1;
+    log_seq++;
+    log_stats.ls_commits++;
+    log_stats.ls_blocks += n;
+}
+
+/* Add metadata block containing addr to the running transaction.
+ * Returns 0 if there is no log and the caller has to write
+ * the block home itself when it needs it on disk. */
+bool
+fs_log_block(const void *addr) {
+    if (!log_enabled) return 0;
+
+    blockno_t blockno = log_blockno(addr);
+    if (TSTBIT(log_pending_map, blockno)) return 1;
+
+    /* Requests that log more than LOG_OP_BLOCKS use fs_log_reserve() */
+    if (log_npending == log_txn_max)
+        panic("transaction of %zu blocks doesn't fit the log", log_npending + 1);
+    log_pending[log_npending++] = blockno;
+    SETBIT(log_pending_map, blockno);
+    return 1;
+}
+
+/* Check whether block containing addr has uncommitted changes */
+bool
+fs_log_pending(const void *addr) {
+    return log_npending && TSTBIT(log_pending_map, log_blockno(addr));
+}
+
+/* Check whether the latest contents of block containing addr
+ * are in the log, so that it can be written home at any time */
+bool
+fs_log_committed(const void *addr) {
+    blockno_t blockno = log_blockno(addr);
+    return !fs_log_pending(addr) && log_find(log_committed, log_ncommitted, blockno);
+}
+
+/* Check that the current request can log n more blocks
+ * on top of LOG_OP_BLOCKS ones any request may log.
+ * Returns 0 if the transaction would not fit the log. */
+bool
+fs_log_reserve(size_t n) {
+    return !log_enabled || log_npending + n + LOG_OP_BLOCKS <= log_txn_max;
+}
+
+/* Write all blocks of the running transaction to the log, split
+ * into records of at most LOG_MAX_TXN blocks.  Must be called only
+ * between requests.  Reclaims log space if another transaction
+ * might not fit. */
+void
+fs_log_commit(void) {
+    if (!log_npending) return;
+    assert(log_space(log_npending) <= log_nblocks - log_tail);
+
+    for (size_t i = 0; i < log_npending; i += LOG_MAX_TXN) {
+        size_t n = MIN(LOG_MAX_TXN, log_npending - i);
+        log_write(log_pending + i, n, i + n < log_npending ? LOG_CONTINUED : 0);
+    }
+
+    for (size_t i = 0; i < log_npending; i++) {
+        CLRBIT(log_pending_map, log_pending[i]);
+        if (!log_find(log_committed, log_ncommitted, log_pending[i]))
+            log_committed[log_ncommitted++] = log_pending[i];
+    }
+    log_npending = 0;
+
+    /* Pinned blocks could take the cache over its budget */
+    bc_set_budget(0);
+
+    if (log_nblocks - log_tail < log_space(log_txn_max)) fs_log_checkpoint();
+}
+
+/* Called by the server between requests.  Commits the running
+ * transaction if the next request might not fit in it. */
+void
+fs_log_request_done(void) {
+    if (log_npending + LOG_OP_BLOCKS > log_txn_max) fs_log_commit();
+}
+
+/* Log holds nothing that is not home yet,
+ * so its region may be overwritten */
+bool
+fs_log_idle(void) {
+    return !log_npending && !log_tail;
+}
+
+/* Write all committed blocks home and start the log over.
+ * The running transaction is committed first, since its blocks
+ * can't go home before that. */
+void
+fs_log_checkpoint(void) {
+    if (!log_enabled) return;
+    fs_log_commit();
+    if (!log_tail) return;
+
+    bc_writeback();
+    for (size_t i = 0; i < log_ncommitted; i++)
+        flush_block(diskaddr(log_committed[i]));
+    log_ncommitted = 0;
+
+    /* Records before log_seq are stale now */
+    super->s_log_seq = log_seq;
+    flush_block(super);
+    log_tail = 0;
+    log_stats.ls_checkpoints++;
+}
+
+/* Read the record at block off of the log into log_buf.
+ * Returns the number of its blocks, 0 if it is not valid. */
+static uint32_t
+log_read(uint32_t off, uint32_t seq) {
+    struct LogHeader *hdr = (struct LogHeader *)log_buf;
+
+    log_io(0, off, log_buf, 1);
+    if (hdr->lh_magic != LOG_MAGIC || hdr->lh_seq != seq ||
+        !hdr->lh_count || hdr->lh_count > LOG_MAX_TXN || off + 1 + hdr->lh_count > log_nblocks)
+        return 0;
+
+    uint32_t count = hdr->lh_count;
+    log_io(0, off + 1, log_buf + BLKSIZE, count);
+    if (log_checksum(log_buf + BLKSIZE, count * BLKSIZE) != hdr->lh_checksum)
+        return 0;
+    return count + 1;
+}
+
+/* Replay complete transactions left by a crash and enable the log */
+static void
+log_recover(void) {
+    if (!(super->s_features & FS_FEATURE_LOG)) return;
+    log_nblocks = MIN(super->s_log_nblocks, LOG_MAX_BLOCKS);
+    if (log_nblocks < 2 * (LOG_MAX_TXN + 1))
+        panic("log of %u blocks is too small", super->s_log_nblocks);
+
+    /* Two transactions fit the log, so one of them can be
+     * committed while the other is being checkpointed */
+    log_txn_max = log_nblocks / 2 * LOG_MAX_TXN / (LOG_MAX_TXN + 1);
+
+    /* Pages have to be backed by memory before DMA */
+    memset(log_buf, 0, sizeof(log_buf));
+
+    /* Find the end of the last complete transaction */
+    struct LogHeader *hdr = (struct LogHeader *)log_buf;
+    uint32_t end = 0, seq = super->s_log_seq, nseq = seq;
+    for (uint32_t off = 0, n; off < log_nblocks && (n = log_read(off, seq)); off += n) {
+        seq++;
+        if (!(hdr->lh_flags & LOG_CONTINUED)) {
+            end = off + n;
+            nseq = seq;
+        }
+    }
+
+    log_seq = super->s_log_seq;
+    for (uint32_t off = 0, n; off < end; off += n) {
+        if (!(n = log_read(off, log_seq)))
+            panic("log record %u is gone", log_seq);
+
+        for (uint32_t i = 0; i < hdr->lh_count; i++)
+            if (hdr->lh_blocks[i] < 2 || hdr->lh_blocks[i] >= super->s_nblocks)
+                panic("log record %u has bad block %u", log_seq, hdr->lh_blocks[i]);
+        for (uint32_t i = 0; i < hdr->lh_count; i++)
+            memcpy(diskaddr(hdr->lh_blocks[i]), log_buf + (i + 1) * BLKSIZE, BLKSIZE);
+        log_stats.ls_replayed += hdr->lh_count;
+        log_seq++;
+    }
+    assert(log_seq == nseq);
+
+    /* Replayed blocks are dirty in the cache, write them home
+     * before the log is reused.  Records of an incomplete
+     * transaction are skipped and made stale. */
+    if (log_seq != super->s_log_seq)
+        cprintf("replayed %lu blocks from the log\n", (unsigned long)log_stats.ls_replayed);
+    if (seq != super->s_log_seq) {
+        bc_writeback();
+        log_seq = seq;
+        super->s_log_seq = log_seq;
+        flush_block(super);
+    }
+
+    log_tail = 0;
+    log_enabled = 1;
+}
+
+/* Test that committed transactions survive a crash and
+ * a half-done one is lost entirely: log changes to free blocks,
+ * crash before they get home and replay the log as the next
+ * mount would.  The blocks stay free. */
+static void
+check_log(void) {
+    if (!log_enabled) return;
+    fs_log_checkpoint();
+
+    /* One more block than a record holds */
+    blockno_t blocks[LOG_MAX_TXN + 1];
+    size_t n = 0;
+    for (blockno_t b = super->s_nblocks - 1; b > 1 && n < LOG_MAX_TXN + 1; b--)
+        if (block_is_free(b)) blocks[n++] = b;
+    if (n < LOG_MAX_TXN + 1) return;
+
+    /* Home copies differ from the logged ones */
+    for (size_t i = 0; i < n; i++) {
+        memset(diskaddr(blocks[i]), 0, BLKSIZE);
+        flush_block(diskaddr(blocks[i]));
+    }
+
+    /* Complete transaction of two records */
+    for (size_t i = 0; i < n; i++) {
+        memset(diskaddr(blocks[i]), 0xA5, BLKSIZE);
+        assert(fs_log_block(diskaddr(blocks[i])));
+    }
+    fs_log_commit();
+    bool logged = log_tail != 0;
+
+    /* Operation in progress: its blocks don't go home and
+     * only the first record of its commit gets to the log */
+    for (size_t i = 0; i < n; i++) {
+        memset(diskaddr(blocks[i]), 0x5A, BLKSIZE);
+        assert(fs_log_block(diskaddr(blocks[i])));
+    }
+    bc_writeback();
+    flush_block(diskaddr(blocks[0]));
+    for (size_t i = 0; i < n; i++)
+        assert(fs_log_pending(diskaddr(blocks[i])) && is_page_dirty(diskaddr(blocks[i])));
+    log_write(log_pending, LOG_MAX_TXN, LOG_CONTINUED);
+
+    /* Crash */
+    for (size_t i = 0; i < n; i++) {
+        sys_unmap_region(CURENVID, diskaddr(blocks[i]), BLKSIZE);
+        CLRBIT(log_pending_map, blocks[i]);
+    }
+    log_enabled = 0;
+    log_npending = 0;
+    log_ncommitted = 0;
+
+    uint64_t replayed = log_stats.ls_replayed;
+    log_recover();
+    assert(log_stats.ls_replayed == replayed + (logged ? n : 0));
+    assert(log_tail == 0 && super->s_log_seq == log_seq);
+
+    /* Only the complete transaction went home */
+    for (size_t i = 0; i < n; i++) {
+        uint8_t *blk = diskaddr(blocks[i]);
+        sys_unmap_region(CURENVID, blk, BLKSIZE);
+        assert(blk[0] == 0xA5 && blk[BLKSIZE - 1] == 0xA5);
+        memset(blk, 0, BLKSIZE);
+        flush_block(blk);
+    }
+    cprintf("log replay is good\n");
+}
+
 /****************************************************************
  *                    File system structures
  ****************************************************************/
@@ -109,9 +516,231 @@ fs_init(void) {
     /* Set "bitmap" to the beginning of the first bitmap block. */
     bitmap = diskaddr(2);
 
+    log_recover();
+    check_log();
     check_bitmap();
 }
 
+/****************************************************************
+ *                           Extents
+ ****************************************************************/
+
+/* Number of leaf blocks needed to hold n extents */
+static uint32_t
+extent_nleaves(uint32_t n) {
+    return n > NEXTENT ? CEILDIV(n - NEXTENT, NLEAFEXTENT) : 0;
+}
+
+/* Return i'th extent of f, either from the File itself
+ * or from one of the leaf blocks. */
+static struct Extent *
+extent_at(struct File *f, uint32_t i) {
+    if (i < NEXTENT) return &f->f_extents[i];
+
+    i -= NEXTENT;
+    blockno_t *index = diskaddr(f->f_extindex);
+    return (struct Extent *)diskaddr(index[i / NLEAFEXTENT]) + i % NLEAFEXTENT;
+}
+
+/* Index of the last extent starting at or before filebno, -1 if none */
+static int32_t
+extent_find(struct File *f, blockno_t filebno) {
+    int32_t lo = 0, hi = (int32_t)f->f_nextents - 1, res = -1;
+
+    while (lo <= hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (extent_at(f, mid)->e_fileblk <= filebno) {
+            res = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return res;
+}
+
+/* Keep only the first n extents of f and free leaf blocks
+ * (and the index block) that are not needed any more. */
+static void
+extent_shrink(struct File *f, uint32_t n) {
+    uint32_t nleaves = extent_nleaves(n);
+
+    if (f->f_extindex) {
+        blockno_t *index = diskaddr(f->f_extindex);
+        for (uint32_t i = nleaves; i < extent_nleaves(f->f_nextents); i++) {
+            free_block(index[i]);
+            index[i] = 0;
+            fs_log_block(index);
+        }
+        if (!nleaves) {
+            free_block(f->f_extindex);
+            f->f_extindex = 0;
+        }
+    }
+
+    f->f_nextents = n;
+    fs_log_block(f);
+}
+
+/* Number of blocks changed by shifting extents i to n - 1 by one */
+static uint32_t
+extent_shift_blocks(uint32_t i, uint32_t n) {
+    return extent_nleaves(n + 1) - (i > NEXTENT ? (i - NEXTENT) / NLEAFEXTENT : 0) + 1;
+}
+
+/* Insert new extent at position i, allocating index
+ * and leaf blocks if needed.
+ * Returns 0 on success, -E_NO_DISK if there's no space for them
+ * or the shifted extents don't fit the log transaction. */
+static int
+extent_insert(struct File *f, uint32_t i, blockno_t fileblk, blockno_t diskblk, uint32_t len) {
+    uint32_t n = f->f_nextents;
+    uint32_t nleaves = extent_nleaves(n);
+
+    if (n == MAXEXTENTS) return -E_NO_DISK;
+    if (!fs_log_reserve(extent_shift_blocks(i, n))) return -E_NO_DISK;
+
+    if (extent_nleaves(n + 1) > nleaves) {
+        if (!f->f_extindex) {
+            if (!(f->f_extindex = alloc_block()))
+                return -E_NO_DISK;
+            memset(diskaddr(f->f_extindex), 0, BLKSIZE);
+        }
+
+        blockno_t *index = diskaddr(f->f_extindex);
+        if (!(index[nleaves] = alloc_block_near(nleaves ? index[nleaves - 1] + 1 : f->f_extindex + 1))) {
+            if (!nleaves) {
+                free_block(f->f_extindex);
+                f->f_extindex = 0;
+            }
+            return -E_NO_DISK;
+        }
+        fs_log_block(index);
+    }
+
+    for (uint32_t j = n; j > i; j--) {
+        struct Extent *dst = extent_at(f, j);
+        *dst = *extent_at(f, j - 1);
+        fs_log_block(dst);
+    }
+
+    struct Extent *e = extent_at(f, i);
+    e->e_fileblk = fileblk;
+    e->e_diskblk = diskblk;
+    e->e_len = len;
+    f->f_nextents = n + 1;
+    fs_log_block(e);
+    fs_log_block(f);
+    return 0;
+}
+
+/* Remove i'th extent (but not its blocks) */
+static void
+extent_remove(struct File *f, uint32_t i) {
+    for (uint32_t j = i; j + 1 < f->f_nextents; j++) {
+        struct Extent *dst = extent_at(f, j);
+        *dst = *extent_at(f, j + 1);
+        fs_log_block(dst);
+    }
+    extent_shrink(f, f->f_nextents - 1);
+}
+
+/* Map up to n blocks of extent file f starting at 'filebno'.
+ * Set *pdiskbno to the disk block backing filebno and return
+ * the number of blocks after it that are contiguous on disk.
+ * A hole is filled with newly allocated blocks, as large a run
+ * as possible placed right after the previous extent, when
+ * 'alloc' is set.  Otherwise *pdiskbno is set to 0 and
+ * the length of the hole is returned.
+ *
+ * Returns:
+ *  number of mapped blocks (at least 1) on success.
+ *  -E_NO_DISK if there's no space on the disk.
+ *  -E_INVAL if filebno is out of range. */
+static int
+extent_map(struct File *f, blockno_t filebno, blockno_t n, bool alloc, blockno_t *pdiskbno) {
+    const blockno_t maxblocks = MAXEXTFILESIZE / BLKSIZE;
+
+    if (!n || filebno >= maxblocks) return -E_INVAL;
+    n = MIN(n, maxblocks - filebno);
+
+    int32_t i = extent_find(f, filebno);
+    struct Extent *prev = i >= 0 ? extent_at(f, i) : NULL;
+    if (prev && filebno - prev->e_fileblk < prev->e_len) {
+        *pdiskbno = prev->e_diskblk + (filebno - prev->e_fileblk);
+        return MIN(n, prev->e_len - (filebno - prev->e_fileblk));
+    }
+
+    /* Hole ends where the next extent starts */
+    struct Extent *next = i + 1 < (int32_t)f->f_nextents ? extent_at(f, i + 1) : NULL;
+    if (next) n = MIN(n, next->e_fileblk - filebno);
+
+    *pdiskbno = 0;
+    if (!alloc) return n;
+
+    blockno_t hint = prev ? prev->e_diskblk + (filebno - prev->e_fileblk) : 0;
+    blockno_t diskbno = 0;
+    for (; n && !(diskbno = alloc_block_run(hint, n)); n /= 2)
+        ;
+    if (!diskbno) return -E_NO_DISK;
+
+    /* Grow a neighbouring extent instead of adding a new one
+     * if the new blocks continue it on disk */
+    bool join_prev = prev && prev->e_fileblk + prev->e_len == filebno &&
+                     prev->e_diskblk + prev->e_len == diskbno;
+    bool join_next = next && filebno + n == next->e_fileblk &&
+                     diskbno + n == next->e_diskblk;
+    /* Extents after next are shifted down if both are joined */
+    if (join_prev && join_next && !fs_log_reserve(extent_shift_blocks(i + 1, f->f_nextents)))
+        join_next = 0;
+    if (join_prev && join_next) {
+        prev->e_len += n + next->e_len;
+        fs_log_block(prev);
+        extent_remove(f, i + 1);
+    } else if (join_prev) {
+        prev->e_len += n;
+        fs_log_block(prev);
+    } else if (join_next) {
+        next->e_fileblk = filebno;
+        next->e_diskblk = diskbno;
+        next->e_len += n;
+        fs_log_block(next);
+    } else {
+        int res = extent_insert(f, i + 1, filebno, diskbno, n);
+        if (res < 0) {
+            for (blockno_t b = diskbno; b < diskbno + n; b++)
+                free_block(b);
+            return res;
+        }
+    }
+
+    *pdiskbno = diskbno;
+    return n;
+}
+
+/* Free blocks of extent file f past the first new_nblocks */
+static void
+extent_truncate_blocks(struct File *f, blockno_t new_nblocks) {
+    uint32_t n = f->f_nextents;
+
+    for (; n; n--) {
+        struct Extent *e = extent_at(f, n - 1);
+        if (e->e_fileblk + e->e_len <= new_nblocks) break;
+
+        uint32_t keep = e->e_fileblk < new_nblocks ? new_nblocks - e->e_fileblk : 0;
+        for (uint32_t b = keep; b < e->e_len; b++)
+            free_block(e->e_diskblk + b);
+        if (keep) {
+            e->e_len = keep;
+            fs_log_block(e);
+            break;
+        }
+    }
+
+    extent_shrink(f, n);
+}
+
 /* Find the disk block number slot for the 'filebno'th block in file 'f'.
  * Set '*ppdiskbno' to point to that slot.
  * The slot will be one of the f->f_direct[] entries,
@@ -124,7 +753,8 @@ fs_init(void) {
  *  -E_NOT_FOUND if the function needed to allocate an indirect block, but
  *      alloc was 0.
  *  -E_NO_DISK if there's no space on the disk for an indirect block.
- *  -E_INVAL if filebno is out of range (it's >= NDIRECT + NINDIRECT).
+ *  -E_INVAL if filebno is out of range (it's >= NDIRECT + NINDIRECT)
+ *      or f is an extent file, which has no block pointers.
  *
  * Analogy: This is like pgdir_walk for files.
  * Hint: Don't forget to clear any block you allocate. */
@@ -133,7 +763,9 @@ file_block_walk(struct File *f, blockno_t filebno, blockno_t **ppdiskbno, bool a
     // LAB 10: Your code here
 
     *ppdiskbno = NULL;
-    if (filebno < NDIRECT) {
+    if (f->f_flags & FILE_EXTENTS) {
+        return -E_INVAL;
+    } else if (filebno < NDIRECT) {
         *ppdiskbno = f->f_direct + filebno;
     } else if (filebno >= NDIRECT + NINDIRECT) {
         return -E_INVAL;
@@ -142,9 +774,11 @@ file_block_walk(struct File *f, blockno_t filebno, blockno_t **ppdiskbno, bool a
         if (!f->f_indirect) {
             if (!alloc)
                 return -E_NOT_FOUND;
-            if (!(f->f_indirect = alloc_block()))
+            if (!(f->f_indirect = alloc_block_near(f->f_direct[NDIRECT - 1] + 1)))
                 return -E_NO_DISK;
             memset(diskaddr(f->f_indirect), 0, BLKSIZE);
+            fs_log_block(diskaddr(f->f_indirect));
+            fs_log_block(f);
         }
         *ppdiskbno = (blockno_t *)diskaddr(f->f_indirect) + filebno;
     }
@@ -167,27 +801,219 @@ file_get_block(struct File *f, blockno_t filebno, char **blk) {
     *blk = NULL;
     blockno_t *block = NULL;
     int res;
+    if (f->f_flags & FILE_EXTENTS) {
+        blockno_t diskbno;
+        if ((res = extent_map(f, filebno, 1, true, &diskbno)) < 0)
+            return res;
+        *blk = (char *)diskaddr(diskbno);
+        return 0;
+    }
+
     if ((res = file_block_walk(f, filebno, &block, true)) < 0)
         return res;
 
-    if (!*block && !(*block = alloc_block()))
-        return -E_NO_DISK;
+    if (!*block) {
+        /* Place file blocks one after another */
+        blockno_t *prev = NULL;
+        blockno_t hint = 0;
+        if (filebno && file_block_walk(f, filebno - 1, &prev, false) >= 0 && *prev)
+            hint = *prev + 1;
+        if (!(*block = alloc_block_near(hint)))
+            return -E_NO_DISK;
+        fs_log_block(block);
+    }
 
     *blk = (char *)diskaddr(*block);
 
     return 0;
 }
 
-/* Try to find a file named "name" in dir.  If so, set *file to it.
- *
- * Returns 0 and sets *file on success, < 0 on error.  Errors are:
- *  -E_NOT_FOUND if the file is not found */
+/* Set *pdiskbno to the disk block holding the filebno'th block
+ * of file 'f', or to 0 if that block is not allocated.
+ * Never allocates anything.
+ * Returns 0 on success, -E_INVAL if filebno is out of range. */
+int
+file_block_map(struct File *f, blockno_t filebno, blockno_t *pdiskbno) {
+    int res;
+
+    if (f->f_flags & FILE_EXTENTS) {
+        res = extent_map(f, filebno, 1, false, pdiskbno);
+        return res < 0 ? res : 0;
+    }
+
+    blockno_t *slot;
+    res = file_block_walk(f, filebno, &slot, false);
+    *pdiskbno = res < 0 ? 0 : *slot;
+    return res == -E_NOT_FOUND ? 0 : MIN(res, 0);
+}
+
+/* Like file_get_block, but maps up to n blocks starting at filebno
+ * that are contiguous on disk and so in the block cache, allocating
+ * missing ones.  Sets *blk to the address of the first one.
+ * Returns number of mapped blocks, < 0 on error. */
 static int
-dir_lookup(struct File *dir, const char *name, struct File **file) {
-    /* Search dir for name.
-     * We maintain the invariant that the size of a directory-file
-     * is always a multiple of the file system's block size. */
-    assert((dir->f_size % BLKSIZE) == 0);
+file_get_run(struct File *f, blockno_t filebno, blockno_t n, char **blk) {
+    if (!(f->f_flags & FILE_EXTENTS)) {
+        int res = file_get_block(f, filebno, blk);
+        return res < 0 ? res : 1;
+    }
+
+    blockno_t diskbno;
+    int res = extent_map(f, filebno, n, true, &diskbno);
+    if (res < 0) return res;
+    *blk = diskaddr_range(diskbno, res);
+    return res;
+}
+
+/* Return the slot'th entry of dir or NULL on error */
+static struct File *
+dir_entry(struct File *dir, uint32_t slot) {
+    char *blk;
+    if (file_get_block(dir, slot / BLKFILES, &blk) < 0) return NULL;
+    return (struct File *)blk + slot % BLKFILES;
+}
+
+/* Free the index of dir, it becomes a linear directory */
+static void
+dirhash_drop(struct File *dir) {
+    if (dir->f_dirhash) {
+        blockno_t *index = diskaddr(dir->f_dirhash);
+        for (uint32_t i = 0; i < NDIRBUCKET; i++)
+            if (index[i]) free_block(index[i]);
+        free_block(dir->f_dirhash);
+    }
+    dir->f_dirhash = 0;
+    dir->f_flags &= ~FILE_DIRHASH;
+    fs_log_block(dir);
+}
+
+/* Look name up in the index of dir, hash is dir_name_hash(name) */
+static int
+dirhash_lookup(struct File *dir, const char *name, uint32_t hash, struct File **file) {
+    if (!dir->f_dirhash) return -E_NOT_FOUND;
+
+    blockno_t bucketno = ((blockno_t *)diskaddr(dir->f_dirhash))[hash % NDIRBUCKET];
+    if (!bucketno) return -E_NOT_FOUND;
+
+    struct DirHashBucket *bucket = diskaddr(bucketno);
+    for (uint32_t i = 0; i < bucket->db_count; i++) {
+        if (bucket->db_ents[i].dh_hash != hash) continue;
+
+        struct File *f = dir_entry(dir, bucket->db_ents[i].dh_slot);
+        if (f && !strcmp(f->f_name, name)) {
+            *file = f;
+            return 0;
+        }
+    }
+
+    return -E_NOT_FOUND;
+}
+
+/* Add slot'th entry of dir, which is called name, to the index.
+ * If there's no space for it, the index is dropped,
+ * lookups in dir become linear but keep working. */
+static void
+dirhash_insert(struct File *dir, const char *name, uint32_t slot) {
+    uint32_t hash = dir_name_hash(name);
+
+    if (!dir->f_dirhash) {
+        if (!(dir->f_dirhash = alloc_block())) goto drop;
+        memset(diskaddr(dir->f_dirhash), 0, BLKSIZE);
+        fs_log_block(dir);
+    }
+
+    blockno_t *index = diskaddr(dir->f_dirhash);
+    blockno_t *pbucket = &index[hash % NDIRBUCKET];
+    if (!*pbucket) {
+        if (!(*pbucket = alloc_block_near(dir->f_dirhash + 1))) goto drop;
+        ((struct DirHashBucket *)diskaddr(*pbucket))->db_count = 0;
+        fs_log_block(index);
+    }
+
+    struct DirHashBucket *bucket = diskaddr(*pbucket);
+    if (bucket->db_count == sizeof(bucket->db_ents) / sizeof(*bucket->db_ents)) goto drop;
+    bucket->db_ents[bucket->db_count].dh_hash = hash;
+    bucket->db_ents[bucket->db_count].dh_slot = slot;
+    bucket->db_count++;
+    fs_log_block(bucket);
+    return;
+
+drop:
+    cprintf("warning: no space to index %s, dropping directory index\n", name);
+    dirhash_drop(dir);
+}
+
+/* Remove index entries of dir at or past slot nslots.
+ * The index is dropped if its buckets don't fit the log transaction. */
+static void
+dirhash_truncate(struct File *dir, uint32_t nslots) {
+    dir->f_dirfree = MIN(dir->f_dirfree, nslots);
+    fs_log_block(dir);
+    if (!dir->f_dirhash) return;
+
+    blockno_t *index = diskaddr(dir->f_dirhash);
+    uint32_t nbuckets = 0;
+    for (uint32_t i = 0; i < NDIRBUCKET; i++)
+        nbuckets += !!index[i];
+    if (!fs_log_reserve(nbuckets)) {
+        dirhash_drop(dir);
+        return;
+    }
+
+    for (uint32_t i = 0; i < NDIRBUCKET; i++) {
+        if (!index[i]) continue;
+
+        struct DirHashBucket *bucket = diskaddr(index[i]);
+        for (uint32_t j = 0; j < bucket->db_count;) {
+            if (bucket->db_ents[j].dh_slot >= nslots) {
+                bucket->db_ents[j] = bucket->db_ents[--bucket->db_count];
+                fs_log_block(bucket);
+            } else {
+                j++;
+            }
+        }
+    }
+}
+
+/* Dentry cache: recent dir_lookup() results keyed by (directory, name),
+ * d_file is NULL for names known to be missing.  It is direct mapped,
+ * new entry replaces whatever was in its slot. */
+struct Dentry {
+    struct File *d_dir;
+    struct File *d_file;
+    uint32_t d_hash;
+    char d_name[MAXNAMELEN];
+};
+
+static struct Dentry dcache[DCACHE_SIZE];
+struct FsDentryStat dcache_stats;
+
+static struct Dentry *
+dcache_slot(struct File *dir, uint32_t hash) {
+    uint32_t dirhash = (uintptr_t)dir / sizeof(struct File);
+    return &dcache[(hash ^ dirhash * 2654435761U) % DCACHE_SIZE];
+}
+
+static void
+dcache_insert(struct File *dir, const char *name, uint32_t hash, struct File *file) {
+    struct Dentry *d = dcache_slot(dir, hash);
+    d->d_dir = dir;
+    d->d_file = file;
+    d->d_hash = hash;
+    strcpy(d->d_name, name);
+}
+
+/* Forget all cached names.  Called when directory entries
+ * disappear or are rewritten behind dir_lookup()'s back. */
+void
+dcache_flush(void) {
+    memset(dcache, 0, sizeof(dcache));
+    dcache_stats.ds_flushes++;
+}
+
+/* Search linear directory dir for name */
+static int
+dir_scan(struct File *dir, const char *name, struct File **file) {
     blockno_t nblock = dir->f_size / BLKSIZE;
     for (blockno_t i = 0; i < nblock; i++) {
         char *blk;
@@ -204,15 +1030,49 @@ dir_lookup(struct File *dir, const char *name, struct File **file) {
     return -E_NOT_FOUND;
 }
 
-/* Set *file to point at a free File structure in dir.  The caller is
- * responsible for filling in the File fields. */
+/* Try to find a file named "name" in dir.  If so, set *file to it.
+ *
+ * Returns 0 and sets *file on success, < 0 on error.  Errors are:
+ *  -E_NOT_FOUND if the file is not found */
+static int
+dir_lookup(struct File *dir, const char *name, struct File **file) {
+    /* Search dir for name.
+     * We maintain the invariant that the size of a directory-file
+     * is always a multiple of the file system's block size. */
+    assert((dir->f_size % BLKSIZE) == 0);
+
+    uint32_t hash = dir_name_hash(name);
+    struct Dentry *d = dcache_slot(dir, hash);
+    if (d->d_dir == dir && d->d_hash == hash && !strcmp(d->d_name, name)) {
+        dcache_stats.ds_hits++;
+        if (!d->d_file) {
+            dcache_stats.ds_neg_hits++;
+            return -E_NOT_FOUND;
+        }
+        *file = d->d_file;
+        return 0;
+    }
+    dcache_stats.ds_misses++;
+
+    int res = dir->f_flags & FILE_DIRHASH ? dirhash_lookup(dir, name, hash, file) :
+                                            dir_scan(dir, name, file);
+    if (!res || res == -E_NOT_FOUND)
+        dcache_insert(dir, name, hash, res ? NULL : *file);
+    return res;
+}
+
+/* Set *file to point at a free File structure in dir and *pslot
+ * to its entry number.  The caller is responsible for filling
+ * in the File fields.  Indexed directories start the search
+ * at f_dirfree instead of the first entry. */
 static int
-dir_alloc_file(struct File *dir, struct File **file) {
+dir_alloc_file(struct File *dir, struct File **file, uint32_t *pslot) {
     char *blk;
 
     assert((dir->f_size % BLKSIZE) == 0);
     blockno_t nblock = dir->f_size / BLKSIZE;
-    for (blockno_t i = 0; i < nblock; i++) {
+    blockno_t first = dir->f_flags & FILE_DIRHASH ? dir->f_dirfree / BLKFILES : 0;
+    for (blockno_t i = first; i < nblock; i++) {
         int res = file_get_block(dir, i, &blk);
         if (res < 0) return res;
 
@@ -220,6 +1080,9 @@ dir_alloc_file(struct File *dir, struct File **file) {
         for (blockno_t j = 0; j < BLKFILES; j++) {
             if (f[j].f_name[0] == '\0') {
                 *file = &f[j];
+                *pslot = i * BLKFILES + j;
+                dir->f_dirfree = *pslot + 1;
+                fs_log_block(dir);
                 return 0;
             }
         }
@@ -229,6 +1092,9 @@ dir_alloc_file(struct File *dir, struct File **file) {
 
     dir->f_size += BLKSIZE;
     *file = (struct File *)blk;
+    *pslot = nblock * BLKFILES;
+    dir->f_dirfree = *pslot + 1;
+    fs_log_block(dir);
     return 0;
 }
 
@@ -306,14 +1172,21 @@ file_create(const char *path, struct File **pf) {
     char name[MAXNAMELEN];
     int res;
     struct File *dir, *filp;
+    uint32_t slot;
 
     if (!(res = walk_path(path, &dir, &filp, name))) return -E_FILE_EXISTS;
     if (res != -E_NOT_FOUND || dir == 0) return res;
-    if ((res = dir_alloc_file(dir, &filp)) < 0) return res;
+    if ((res = dir_alloc_file(dir, &filp, &slot)) < 0) return res;
 
+    memset(filp, 0, sizeof(*filp));
     strcpy(filp->f_name, name);
+    if (super->s_features & FS_FEATURE_EXTENTS)
+        filp->f_flags |= FILE_EXTENTS;
+    if (dir->f_flags & FILE_DIRHASH)
+        dirhash_insert(dir, name, slot);
+    dcache_insert(dir, name, dir_name_hash(name), filp);
     *pf = filp;
-    file_flush(dir);
+    if (!fs_log_block(filp)) file_flush(dir);
     return 0;
 }
 
@@ -335,12 +1208,14 @@ file_read(struct File *f, void *buf, size_t count, off_t offset) {
         return 0;
 
     count = MIN(count, f->f_size - offset);
+    blockno_t end = CEILDIV(offset + count, BLKSIZE);
 
+    /* Whole extents are copied at once */
     for (off_t pos = offset; pos < offset + count;) {
-        int r = file_get_block(f, pos / BLKSIZE, &blk);
+        int r = file_get_run(f, pos / BLKSIZE, end - pos / BLKSIZE, &blk);
         if (r < 0) return r;
 
-        int bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
+        size_t bn = MIN((size_t)r * BLKSIZE - pos % BLKSIZE, offset + count - pos);
         memmove(buf, blk + pos % BLKSIZE, bn);
         pos += bn;
         buf += bn;
@@ -349,6 +1224,26 @@ file_read(struct File *f, void *buf, size_t count, off_t offset) {
     return count;
 }
 
+/* Find up to n whole blocks of f starting at block-aligned offset
+ * that are contiguous in the block cache, so they can be mapped
+ * elsewhere as a single region.  Partial last block is not included.
+ * Sets *blk to the address of the first one and writes back
+ * dirty ones: mapping them out would lose their dirty bits.
+ * Returns the number of blocks, < 0 on error. */
+int
+file_read_map(struct File *f, off_t offset, size_t n, char **blk) {
+    if (offset < 0 || offset % BLKSIZE) return -E_INVAL;
+    if (offset >= f->f_size) return 0;
+
+    n = MIN(n, (size_t)(f->f_size - offset) / BLKSIZE);
+    if (!n) return 0;
+
+    int res = file_get_run(f, offset / BLKSIZE, n, blk);
+    for (int i = 0; i < res; i++)
+        flush_block(*blk + i * BLKSIZE);
+    return res;
+}
+
 /* Write count bytes from buf into f, starting at seek position
  * offset.  This is meant to mimic the standard pwrite function.
  * Extends the file if necessary.
@@ -358,18 +1253,22 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset) {
     int res;
     off_t old_size = f->f_size;
 
+    /* Names could change under cached entries */
+    if (f->f_type == FTYPE_DIR) dcache_flush();
+
     /* Extend file if necessary */
     if (offset + count > f->f_size)
         if ((res = file_set_size(f, offset + count)) < 0) return res;
 
+    blockno_t end = CEILDIV(offset + count, BLKSIZE);
     for (off_t pos = offset; pos < offset + count;) {
         char *blk;
-        if ((res = file_get_block(f, pos / BLKSIZE, &blk)) < 0) {
+        if ((res = file_get_run(f, pos / BLKSIZE, end - pos / BLKSIZE, &blk)) < 0) {
             file_set_size(f, old_size);
             return res;
         }
 
-        blockno_t bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
+        size_t bn = MIN((size_t)res * BLKSIZE - pos % BLKSIZE, offset + count - pos);
         memmove(blk + pos % BLKSIZE, buf, bn);
         pos += bn;
         buf += bn;
@@ -389,6 +1288,7 @@ file_free_block(struct File *f, blockno_t filebno) {
     if (*ptr) {
         free_block(*ptr);
         *ptr = 0;
+        fs_log_block(ptr);
     }
     return 0;
 }
@@ -406,6 +1306,16 @@ static void
 file_truncate_blocks(struct File *f, off_t newsize) {
     blockno_t old_nblocks = CEILDIV(f->f_size, BLKSIZE);
     blockno_t new_nblocks = CEILDIV(newsize, BLKSIZE);
+    if (f->f_flags & FILE_DIRHASH)
+        dirhash_truncate(f, newsize / sizeof(struct File));
+    if (f->f_type == FTYPE_DIR)
+        dcache_flush();
+
+    if (f->f_flags & FILE_EXTENTS) {
+        extent_truncate_blocks(f, new_nblocks);
+        return;
+    }
+
     for (blockno_t bno = new_nblocks; bno < old_nblocks; bno++) {
         int res = file_free_block(f, bno);
         if (res < 0) cprintf("warning: file_free_block: %i", res);
@@ -414,16 +1324,19 @@ file_truncate_blocks(struct File *f, off_t newsize) {
     if (new_nblocks <= NDIRECT && f->f_indirect) {
         free_block(f->f_indirect);
         f->f_indirect = 0;
+        fs_log_block(f);
     }
 }
 
 /* Set the size of file f, truncating or extending as necessary. */
 int
 file_set_size(struct File *f, off_t newsize) {
+    if (newsize < 0 || newsize > (f->f_flags & FILE_EXTENTS ? MAXEXTFILESIZE : MAXFILESIZE))
+        return -E_INVAL;
     if (f->f_size > newsize)
         file_truncate_blocks(f, newsize);
     f->f_size = newsize;
-    flush_block(f);
+    if (!fs_log_block(f)) flush_block(f);
     return 0;
 }
 
@@ -435,21 +1348,52 @@ void
 file_flush(struct File *f) {
     blockno_t *pdiskbno;
 
-    for (blockno_t i = 0; i < CEILDIV(f->f_size, BLKSIZE); i++) {
-        if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-            pdiskbno == NULL || *pdiskbno == 0)
-            continue;
-        flush_block(diskaddr(*pdiskbno));
+    if (f->f_flags & FILE_EXTENTS) {
+        for (uint32_t i = 0; i < f->f_nextents; i++) {
+            struct Extent *e = extent_at(f, i);
+            for (blockno_t b = e->e_diskblk; b < e->e_diskblk + e->e_len; b++)
+                flush_block(diskaddr(b));
+        }
+    } else {
+        for (blockno_t i = 0; i < CEILDIV(f->f_size, BLKSIZE); i++) {
+            if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
+                pdiskbno == NULL || *pdiskbno == 0)
+                continue;
+            flush_block(diskaddr(*pdiskbno));
+        }
+    }
+
+    /* Metadata is durable once its log record is written,
+     * home locations are updated at the next checkpoint */
+    if (log_enabled) {
+        fs_log_commit();
+        return;
+    }
+
+    if ((f->f_flags & FILE_DIRHASH) && f->f_dirhash) {
+        blockno_t *index = diskaddr(f->f_dirhash);
+        for (uint32_t i = 0; i < NDIRBUCKET; i++)
+            if (index[i]) flush_block(diskaddr(index[i]));
+        flush_block(index);
     }
-    if (f->f_indirect)
+    if (f->f_flags & FILE_EXTENTS) {
+        if (f->f_extindex) {
+            blockno_t *index = diskaddr(f->f_extindex);
+            for (uint32_t i = 0; i < extent_nleaves(f->f_nextents); i++)
+                flush_block(diskaddr(index[i]));
+            flush_block(index);
+        }
+    } else if (f->f_indirect) {
         flush_block(diskaddr(f->f_indirect));
+    }
     flush_block(f);
 }
 
-/* Sync the entire file system.  A big hammer. */
+/* Sync the entire file system.  Only blocks in the dirty set
+ * are written, so cost depends on the amount of dirty data. */
 void
 fs_sync(void) {
-    for (int i = 1; i < super->s_nblocks; i++) {
-        flush_block(diskaddr(i));
-    }
+    fs_log_commit();
+    bc_writeback();
+    fs_log_checkpoint();
 }
\ No newline at end of file
@@ -11,29 +11,106 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE 0xC0000000
 
+/* Blocks read asynchronously by bc_fetch() land here first,
+ * one page per fill in flight (above the device mappings in pci.h) */
+#define BC_FILLMAP    0x7040000000
+#define BC_MAX_FILLS  16
+
+/* Block cache budget (in blocks), see bc_set_budget() */
+#define BC_MIN_BUDGET     16
+#define BC_DEFAULT_BUDGET 2048
+#define BC_MAX_BUDGET     8192
+
+/* Period of background write-back and its notification bit */
+#define BC_WRITEBACK_MS  2000
+#define BC_WRITEBACK_BIT (1ULL << 63)
+
+/* Metadata blocks in one log record, maximal log region size
+ * used and blocks a request may log without fs_log_reserve() */
+#define LOG_MAX_TXN    63
+#define LOG_MAX_BLOCKS 1024
+#define LOG_OP_BLOCKS  32
+
+/* Metadata log counters */
+struct LogStats {
+    uint64_t ls_commits;     /* Records written */
+    uint64_t ls_blocks;      /* Block images written to the log */
+    uint64_t ls_checkpoints; /* Times log space was reclaimed */
+    uint64_t ls_replayed;    /* Blocks restored from the log at mount */
+};
+
+/* Maximal number of blocks mapped by one FSREQ_READ_MAP */
+#define READ_MAP_MAX 64
+
+/* Maximal read-ahead window (in blocks) */
+#define BC_RA_MAX 32
+
+/* Block cache counters */
+struct BcStats {
+    uint64_t bs_hits;       /* diskaddr() of a cached block */
+    uint64_t bs_misses;     /* Blocks read from disk on fault */
+    uint64_t bs_evictions;  /* Blocks dropped to stay within budget */
+    uint64_t bs_writebacks; /* Dirty blocks written back on eviction */
+    uint64_t bs_resident;   /* Blocks counted against the budget */
+    uint64_t bs_readahead;  /* Blocks read ahead of a fault */
+    uint64_t bs_ra_wasted;  /* Read ahead blocks evicted unused */
+    uint64_t bs_wb_blocks;  /* Blocks written by bc_writeback() */
+    uint64_t bs_wb_ios;     /* NVMe writes issued by bc_writeback() */
+    uint64_t bs_fills;      /* Misses read by bc_fetch() */
+    uint64_t bs_fill_ios;   /* Times bc_fetch_wait() waited for fills */
+};
+
+/* Dentry cache size (entries), see dir_lookup() */
+#define DCACHE_SIZE 256
+
+extern struct BcStats bc_stats;
+extern struct FsDentryStat dcache_stats;
+extern struct LogStats log_stats;
 extern struct Super *super; /* superblock */
 extern uint32_t *bitmap;    /* bitmap blocks mapped in memory */
 
 /* bc.c */
 void *diskaddr(blockno_t blockno);
+void *diskaddr_range(blockno_t blockno, size_t n);
 void flush_block(void *addr);
 void bc_init(void);
+size_t bc_reclaim(size_t want);
+size_t bc_set_budget(size_t budget);
+size_t bc_writeback(void);
+bool bc_fetch(blockno_t blockno);
+bool bc_fetching(blockno_t blockno);
+size_t bc_fetch_wait(void);
 
 /* fs.c */
 void fs_init(void);
 int file_get_block(struct File *f, blockno_t file_blockno, char **pblk);
 int file_create(const char *path, struct File **f);
 int file_block_walk(struct File *f, blockno_t filebno, blockno_t **ppdiskbno, bool alloc);
+int file_block_map(struct File *f, blockno_t filebno, blockno_t *pdiskbno);
 int file_open(const char *path, struct File **f);
 ssize_t file_read(struct File *f, void *buf, size_t count, off_t offset);
+int file_read_map(struct File *f, off_t offset, size_t n, char **blk);
 ssize_t file_write(struct File *f, const void *buf, size_t count, off_t offset);
 int file_set_size(struct File *f, off_t newsize);
 void file_flush(struct File *f);
 int file_remove(const char *path);
 void fs_sync(void);
+void dcache_flush(void);
+
+bool fs_log_block(const void *addr);
+bool fs_log_pending(const void *addr);
+bool fs_log_committed(const void *addr);
+bool fs_log_reserve(size_t n);
+void fs_log_commit(void);
+void fs_log_request_done(void);
+void fs_log_checkpoint(void);
+bool fs_log_idle(void);
 
 bool block_is_free(blockno_t blockno);
+void free_block(blockno_t blockno);
 blockno_t alloc_block(void);
+blockno_t alloc_block_near(blockno_t hint);
+blockno_t alloc_block_run(blockno_t hint, size_t n);
 
 /* test.c */
 void fs_test(void);
@@ -34,6 +34,11 @@ typedef int bool;
 #define ROUNDUP(n, v) ((n)-1 + (v) - ((n)-1) % (v))
 #define MAX_DIR_ENTS  128
 
+/* Same as DISKSIZE in fs/fs.h */
+#define MAX_BLOCKS (0xC0000000U / BLKSIZE)
+/* Metadata log size, must hold several full transactions */
+#define LOG_BLOCKS 256
+
 struct Dir {
     struct File *f;
     struct File *ents;
@@ -41,6 +46,12 @@ struct Dir {
 };
 
 uint32_t nblocks;
+/* Write extent files instead of block pointer ones */
+bool extents = 1;
+/* Write hashed directory indexes */
+bool dirhash = 1;
+/* Reserve a metadata log after the bitmap */
+bool journal = 1;
 char *diskmap, *diskpos;
 struct Super *super;
 uint32_t *bitmap;
@@ -104,12 +115,21 @@ opendisk(const char *name) {
     super = alloc(BLKSIZE);
     super->s_magic = FS_MAGIC;
     super->s_nblocks = nblocks;
+    if (extents) super->s_features |= FS_FEATURE_EXTENTS;
     super->s_root.f_type = FTYPE_DIR;
     strcpy(super->s_root.f_name, "/");
 
     nbitblocks = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
     bitmap = alloc(nbitblocks * BLKSIZE);
     memset(bitmap, 0xFF, nbitblocks * BLKSIZE);
+
+    /* Log starts out empty, the image is zero filled */
+    if (journal) {
+        super->s_log_start = blockof(alloc(LOG_BLOCKS * BLKSIZE));
+        super->s_log_nblocks = LOG_BLOCKS;
+        super->s_log_seq = 0;
+        super->s_features |= FS_FEATURE_LOG;
+    }
 }
 
 void
@@ -128,6 +148,17 @@ finishfile(struct File *f, uint32_t start, uint32_t len) {
     int i;
     f->f_size = len;
     len = ROUNDUP(len, BLKSIZE);
+    if (extents) {
+        /* Files are written contiguously, so a single extent is enough */
+        f->f_flags |= FILE_EXTENTS;
+        if (len) {
+            f->f_nextents = 1;
+            f->f_extents[0].e_fileblk = 0;
+            f->f_extents[0].e_diskblk = start;
+            f->f_extents[0].e_len = len / BLKSIZE;
+        }
+        return;
+    }
     for (i = 0; i < len / BLKSIZE && i < NDIRECT; ++i)
         f->f_direct[i] = start + i;
     if (i == NDIRECT) {
@@ -155,12 +186,40 @@ diradd(struct Dir *d, uint32_t type, const char *name) {
     return out;
 }
 
+void
+indexdir(struct Dir *d) {
+    uint32_t *index = alloc(BLKSIZE);
+    int i;
+
+    d->f->f_flags |= FILE_DIRHASH;
+    d->f->f_dirhash = blockof(index);
+    d->f->f_dirfree = d->n;
+
+    for (i = 0; i < d->n; i++) {
+        uint32_t hash = dir_name_hash(d->ents[i].f_name);
+        uint32_t *pbucket = &index[hash % NDIRBUCKET];
+        if (!*pbucket) {
+            struct DirHashBucket *b = alloc(BLKSIZE);
+            *pbucket = blockof(b);
+        }
+
+        struct DirHashBucket *bucket = (struct DirHashBucket *)(diskmap + *pbucket * BLKSIZE);
+        if (bucket->db_count == sizeof(bucket->db_ents) / sizeof(*bucket->db_ents))
+            panic("directory bucket overflow");
+        bucket->db_ents[bucket->db_count].dh_hash = hash;
+        bucket->db_ents[bucket->db_count].dh_slot = i;
+        bucket->db_count++;
+    }
+}
+
 void
 finishdir(struct Dir *d) {
     int size = d->n * sizeof(struct File);
     struct File *start = alloc(size);
     memmove(start, d->ents, size);
     finishfile(d->f, blockof(start), ROUNDUP(size, BLKSIZE));
+    if (dirhash)
+        indexdir(d);
     free(d->ents);
     d->ents = NULL;
 }
@@ -179,7 +238,7 @@ writefile(struct Dir *dir, const char *name) {
         panic("stat %s: %s", name, strerror(errno));
     if (!S_ISREG(st.st_mode))
         panic("%s is not a regular file", name);
-    if (st.st_size >= MAXFILESIZE)
+    if (st.st_size >= (extents ? MAXEXTFILESIZE : MAXFILESIZE))
         panic("%s too large", name);
 
     last = strrchr(name, '/');
@@ -197,7 +256,8 @@ writefile(struct Dir *dir, const char *name) {
 
 void
 usage(void) {
-    fprintf(stderr, "Usage: fsformat fs.img NBLOCKS files...\n");
+    fprintf(stderr, "Usage: fsformat [-b] fs.img NBLOCKS files...\n"
+                    "  -b  use block pointers, linear directories and no log\n");
     exit(2);
 }
 
@@ -209,11 +269,20 @@ main(int argc, char **argv) {
 
     assert(BLKSIZE % sizeof(struct File) == 0);
 
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        extents = 0;
+        dirhash = 0;
+        journal = 0;
+        argc--;
+        argv++;
+    }
+
     if (argc < 3)
         usage();
 
+    /* Block pointer images keep the old size limit */
     nblocks = strtol(argv[2], &s, 0);
-    if (*s || s == argv[2] || nblocks < 2 || nblocks > 10240)
+    if (*s || s == argv[2] || nblocks < 2 || nblocks > (extents ? MAX_BLOCKS : 10240))
         usage();
 
     opendisk(argv[1]);
@@ -7,11 +7,12 @@ static int nvme_acmd_set_features(struct NvmeController *ctl, int nsid, int fid,
 static int nvme_acmd_create_cq(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq, uint64_t prp);
 static int nvme_acmd_create_sq(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq, uint64_t prp);
 static int nvme_acmd_identify(struct NvmeController *ctl, int nsid, uint64_t prp1, uint64_t prp2);
-static int nvme_cmd_rw(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq, int opc, int nsid, uint64_t slba, int nlb, uint64_t prp1, uint64_t prp2);
 
 /* NVMe Controller structure */
 static struct NvmeController nvme;
 
+struct NvmeStats nvme_stats;
+
 static int
 nvme_map(struct NvmeController *ctl) {
     ctl->mmio_base_addr = (volatile uint8_t *)NVME_VADDR;
@@ -140,8 +141,8 @@ nvme_setup_caps(struct NvmeController *ctl) {
     ctl->ci.maxqsize = cap.mqes + 1;
     ctl->ci.dbstride = 4 << cap.dstrd; /* in bytes */
 
-    /* Set limit to 1 PRP list page per IO submission */
-    ctl->ci.maxppio = ctl->ci.pagesize / sizeof(uint64_t);
+    /* Set limit to the PRP list of one command id */
+    ctl->ci.maxppio = MIN(ctl->ci.pagesize / sizeof(uint64_t), NVME_TAG_PRP);
 
     DEBUG("cap=%#lx mps=%u-%u to=%u maxqs=%u dbs=%u",
           cap.value, cap.mpsmin, cap.mpsmax, cap.to,
@@ -225,14 +226,18 @@ nvme_identify_controller(struct NvmeController *ctl) {
 
     union NvmeFeatureQNum qnum;
 
-    if (nvme_acmd_get_features(ctl, 0, NVME_FEATURE_NUM_QUEUES, 0, 0, &qnum.value)) {
+    /* Ask for as many I/O queues as we can use (0-based counts),
+     * the controller replies with the number allocated */
+    qnum.nsq = qnum.ncq = NVME_QUEUE_COUNT - 1;
+    if (nvme_acmd_set_features(ctl, 0, NVME_FEATURE_NUM_QUEUES, 0, 0, &qnum.value) &&
+        nvme_acmd_get_features(ctl, 0, NVME_FEATURE_NUM_QUEUES, 0, 0, &qnum.value)) {
         ERROR("nvme_acmd_get_features number of queues failed");
         return -NVME_UNSUPPORTED;
     }
 
     ci->maxqcount = (qnum.nsq < qnum.ncq ? qnum.nsq : qnum.ncq) + 1;
     ci->qcount = MIN(ci->maxqcount, NVME_QUEUE_COUNT);
-    ci->qsize = MIN(ci->maxqsize, NVME_QUEUE_SIZE);
+    ci->qsize = MIN(ci->maxqsize, NVME_IO_QUEUE_SIZE);
 
     DEBUG("maxcount = %d, qcount = %d, qsize = %d",
           ci->maxqcount, ci->qcount, ci->qsize);
@@ -285,7 +290,7 @@ nvme_setup_io_queue(struct NvmeController *ctl, int qid) {
             .id = qid + 1,
             .sq = (void *)sqbuff,
             .cq = (void *)cqbuff,
-            .size = NVME_QUEUE_SIZE,
+            .size = ctl->ci.qsize,
             .sq_doorbell = NVME_SQnTDBL(ctl, qid + 1),
             .cq_doorbell = NVME_CQnHDBL(ctl, qid + 1),
     };
@@ -336,9 +341,11 @@ nvme_init(void) {
     if (err)
         panic("NVMe namespace identification failed\n");
 
-    err = nvme_setup_io_queue(ctl, 0);
-    if (err)
-        panic("NVMe queue initialization failed\n");
+    for (uint32_t i = 0; i < ctl->ci.qcount; i++) {
+        err = nvme_setup_io_queue(ctl, i);
+        if (err)
+            panic("NVMe queue initialization failed\n");
+    }
 
 #ifdef PCIE_DEBUG
     nvme_dump_status(ctl);
@@ -432,6 +439,105 @@ nvme_submit_cmd(struct NvmeController *ctl, struct NvmeQueueAttributes *q) {
     return NVME_OK;
 }
 
+/* Tell the controller about commands queued on I/O queue q
+ * since the last doorbell write.  Several commands can be
+ * submitted with a single doorbell write this way. */
+static void
+nvme_io_kick(struct NvmeController *ctl, struct NvmeQueueAttributes *q) {
+    if (q->sq_kicked == q->sq_tail) return;
+
+    *NVME_REG32(ctl->mmio_base_addr, q->sq_doorbell) = q->sq_tail;
+    q->sq_kicked = q->sq_tail;
+    nvme_stats.ns_doorbells++;
+}
+
+/* Collect all completions posted to I/O queue q.  Statuses
+ * are kept by command id until the command owner asks for them. */
+static void
+nvme_io_reap(struct NvmeController *ctl, struct NvmeQueueAttributes *q) {
+    int stat, cid;
+
+    while ((cid = nvme_check_completion(ctl, q, &stat, NULL)) >= 0) {
+        if (cid < q->size && q->tag_state[cid] == NVME_TAG_LOST) {
+            q->tag_state[cid] = NVME_TAG_FREE;
+            q->inflight--;
+            continue;
+        }
+        if (cid >= q->size || q->tag_state[cid] != NVME_TAG_BUSY) {
+            ERROR("q=%d unexpected cid=%#x", q->id, cid);
+            continue;
+        }
+        q->tag_state[cid] = NVME_TAG_DONE;
+        q->tag_status[cid] = stat;
+        q->inflight--;
+        q->ndone++;
+    }
+}
+
+/* Pick I/O queue with the fewest commands in flight */
+static struct NvmeQueueAttributes *
+nvme_io_pick(struct NvmeController *ctl) {
+    struct NvmeQueueAttributes *best = &ctl->ioq[0];
+
+    for (uint32_t i = 1; i < ctl->ci.qcount; i++)
+        if (ctl->ioq[i].inflight + ctl->ioq[i].ndone < best->inflight + best->ndone)
+            best = &ctl->ioq[i];
+    return best;
+}
+
+/* Find a free command id on I/O queue q, reaping completions
+ * while the queue is full, until timeout (in seconds).  One entry
+ * stays unused, so that a full submission queue is not mistaken
+ * for an empty one.  Ids of completed commands belong to their
+ * submitters until nvme_reap() or nvme_wait() collects them, and
+ * only abandoned commands free their ids on completion, so there
+ * is no point in waiting if there are none of these. */
+static int
+nvme_io_alloc_tag(struct NvmeController *ctl, struct NvmeQueueAttributes *q, int timeout) {
+    uint64_t endtsc = read_tsc() + (uint64_t)timeout * tsc_freq;
+
+    for (;;) {
+        nvme_io_reap(ctl, q);
+
+        int free = -1;
+        bool lost = 0;
+        for (uint32_t cid = 0; cid < q->size; cid++) {
+            if (free < 0 && q->tag_state[cid] == NVME_TAG_FREE) free = cid;
+            lost |= q->tag_state[cid] == NVME_TAG_LOST;
+        }
+        if (free >= 0 && q->inflight < q->size - 1) return free;
+        if (free < 0 && !lost) return -NVME_ALLOC_FAILED;
+
+        /* Queued commands can't complete before the doorbell */
+        nvme_io_kick(ctl, q);
+        if (read_tsc() >= endtsc) return -NVME_CMD_TIMEOUT;
+        asm volatile("pause");
+    }
+}
+
+/* Wait for completion of command cid on I/O queue q until
+ * timeout (in seconds) and free its id.  Completions of other
+ * commands are recorded on the way.  A command that times out
+ * is abandoned and frees its id whenever it completes.
+ * @return  completion status (0 if ok). */
+static int
+nvme_io_wait(struct NvmeController *ctl, struct NvmeQueueAttributes *q, int cid, int timeout) {
+    uint64_t endtsc = read_tsc() + (uint64_t)timeout * tsc_freq;
+
+    nvme_io_kick(ctl, q);
+    while (q->tag_state[cid] == NVME_TAG_BUSY) {
+        nvme_io_reap(ctl, q);
+        if (q->tag_state[cid] == NVME_TAG_BUSY && read_tsc() >= endtsc) {
+            q->tag_state[cid] = NVME_TAG_LOST;
+            return -NVME_CMD_TIMEOUT;
+        }
+    }
+
+    q->tag_state[cid] = NVME_TAG_FREE;
+    q->ndone--;
+    return q->tag_status[cid];
+}
+
 static int
 nvme_acmd_identify(struct NvmeController *ctl, int nsid, uint64_t prp1, uint64_t prp2) {
     struct NvmeQueueAttributes *adminq = &ctl->adminq;
@@ -604,30 +710,66 @@ nvme_acmd_create_sq(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq,
     return err;
 }
 
+/* Fill PRP entries for a transfer of nsecs sectors at va.
+ * Buffer has to be virtually contiguous, but its pages can be
+ * anywhere in physical memory, so transfers spanning more than two
+ * pages describe them with a PRP list (one per command id). */
+static int
+nvme_setup_prp(struct NvmeController *ctl, const void *va, size_t nsecs,
+               uint64_t *list, uint64_t *prp1, uint64_t *prp2) {
+    uintptr_t start = (uintptr_t)va;
+    uintptr_t end = start + (nsecs << ctl->nsi.blockshift);
+    size_t npages = (ROUNDUP(end, PAGE_SIZE) - ROUNDDOWN(start, PAGE_SIZE)) / PAGE_SIZE;
+
+    if (!nsecs || npages > ctl->ci.maxppio)
+        return -NVME_BAD_ARG;
+
+    *prp1 = get_phys_addr((void *)start);
+    *prp2 = 0;
+    if (npages == 2) {
+        *prp2 = get_phys_addr((void *)ROUNDUP(start + 1, PAGE_SIZE));
+    } else if (npages > 2) {
+        for (size_t i = 1; i < npages; i++)
+            list[i - 1] = get_phys_addr((void *)(ROUNDDOWN(start, PAGE_SIZE) + i * PAGE_SIZE));
+        *prp2 = get_phys_addr(list);
+    }
+
+    return NVME_OK;
+}
+
 /**
- * NVMe submit a read write command.
- * @param   ioq         io queue
+ * NVMe queue a read write command on the least loaded I/O queue.
+ * The doorbell is not written, see nvme_io_kick().
  * @param   opc         op code
- * @param   cid         command id
  * @param   nsid        namespace
  * @param   slba        starting logical block address
  * @param   nlb         number of logical blocks
- * @param   prp1        PRP1 address
- * @param   prp2        PRP2 address
- * @return  0 if ok else errcode != 0.
+ * @param   va          buffer
+ * @return  tag (queue index and command id) if ok else errcode < 0.
  */
 static int
-nvme_cmd_rw(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq, int opc,
-            int nsid, uint64_t slba, int nlb, uint64_t prp1, uint64_t prp2) {
-    /* Create new NvmeCmdRW in ctl->ioq[0].
+nvme_cmd_rw_submit(struct NvmeController *ctl, int opc, int nsid,
+                   uint64_t slba, int nlb, const void *va) {
+    /* Create new NvmeCmdRW in one of ctl->ioq.
      * TIP: Look at the definition of the struct NvmeCmdRW for description of fields.
      *      Note the 'minus 1' for nlbs.
      * TIP: Fields common.fuse, common.psdt, mptr, prinfo, fua, lr, dsm, eilbrt, elbat
      *      and elbatm should remain zeroed. They are not used here.
-     * TIP: Use ioq->sq_tail as cid like it is done in other commands for simplicity. */
+     * Commands can complete out of order, so cid is a free tag,
+     * not ioq->sq_tail as in admin commands. */
     // LAB 10: Your code here
-    int cid = ioq->sq_tail;
-    struct NvmeCmdRW * cmd = &ioq->sq[cid].rw;
+    struct NvmeQueueAttributes *ioq = nvme_io_pick(ctl);
+    int cid = nvme_io_alloc_tag(ctl, ioq, 300);
+    if (cid < 0)
+        return cid;
+
+    int tag = (ioq->id - 1) * NVME_IO_QUEUE_SIZE + cid;
+    uint64_t *list = (uint64_t *)(ctl->buffer + PAGE_SIZE * NVME_PRP_PAGE) + tag * NVME_TAG_PRP;
+    uint64_t prp1, prp2;
+    if (nvme_setup_prp(ctl, va, nlb, list, &prp1, &prp2))
+        return -NVME_BAD_ARG;
+
+    struct NvmeCmdRW * cmd = &ioq->sq[ioq->sq_tail].rw;
     memset(cmd, 0, sizeof(struct NvmeCmdRW));
     cmd->common.opc = opc;
     cmd->common.nsid = nsid;
@@ -641,19 +783,49 @@ nvme_cmd_rw(struct NvmeController *ctl, struct NvmeQueueAttributes *ioq, int opc
           ioq->id, ioq->sq_head, ioq->sq_tail, cid, nsid, slba, nlb, prp1, prp2,
           opc == NVME_CMD_READ ? 'R' : 'W');
 
-    /* Submit the command and synchronously wait for its completion
-     * TIP: Use nvme_submit_cmd() and nvme_wait_completion(). Don't
-     *      forget to check for potential errors! */
-    // LAB 10: Your code here
+    ioq->tag_state[cid] = NVME_TAG_BUSY;
+    ioq->inflight++;
+    ioq->sq_tail = (ioq->sq_tail + 1) % ioq->size;
 
-    int err = nvme_submit_cmd(ctl, ioq);
-    if (err != NVME_OK) {
-        return err;
-    }
+    nvme_stats.ns_cmds++;
+    return tag;
+}
 
-    err = nvme_wait_completion(ctl, ioq, cid, 300);
+/* Decode tag into its I/O queue and command id */
+static struct NvmeQueueAttributes *
+nvme_tag_queue(struct NvmeController *ctl, int tag, int *cid) {
+    if (tag < 0 || tag >= (int)ctl->ci.qcount * NVME_IO_QUEUE_SIZE)
+        return NULL;
 
-    return err;
+    struct NvmeQueueAttributes *q = &ctl->ioq[tag / NVME_IO_QUEUE_SIZE];
+    *cid = tag % NVME_IO_QUEUE_SIZE;
+    return q->tag_state[*cid] == NVME_TAG_BUSY || q->tag_state[*cid] == NVME_TAG_DONE ? q : NULL;
+}
+
+/**
+ * NVMe submit a read write command and wait for its completion.
+ * @return  0 if ok else errcode != 0.
+ */
+static int
+nvme_cmd_rw(struct NvmeController *ctl, int opc, int nsid,
+            uint64_t slba, int nlb, const void *va) {
+    int tag = nvme_cmd_rw_submit(ctl, opc, nsid, slba, nlb, va);
+    if (tag < 0)
+        return tag;
+
+    return nvme_io_wait(ctl, &ctl->ioq[tag / NVME_IO_QUEUE_SIZE], tag % NVME_IO_QUEUE_SIZE, 300);
+}
+
+/* Maximal number of sectors transferred by one command */
+size_t
+nvme_max_sectors(void) {
+    return nvme.nsi.maxbpio;
+}
+
+/* Maximal number of commands in flight at once */
+size_t
+nvme_queue_depth(void) {
+    return nvme.ci.qcount * (nvme.ci.qsize - 1);
 }
 
 int
@@ -661,8 +833,7 @@ nvme_write(uint64_t secno, const void *src, size_t nsecs) {
     if (!src)
         return -NVME_BAD_ARG;
 
-    return nvme_cmd_rw(&nvme, &nvme.ioq[0], NVME_CMD_WRITE,
-                       nvme.nsi.id, secno, nsecs, get_phys_addr((void *)src), 0);
+    return nvme_cmd_rw(&nvme, NVME_CMD_WRITE, nvme.nsi.id, secno, nsecs, src);
 }
 
 
@@ -671,15 +842,89 @@ nvme_read(uint64_t secno, void *dst, size_t nsecs) {
     if (!dst)
         return -NVME_BAD_ARG;
 
-    /* Submit NVME_CMD_READ to ioq[0].
+    /* Submit NVME_CMD_READ to one of I/O queues.
      * TIP: This is achieved in exactly the same way as the write command.
      *      Remember that the command takes physical address as an argument
      *      and 'dst' is a virtual address. */
     // LAB 10: Your code here
 
+    return nvme_cmd_rw(&nvme, NVME_CMD_READ, nvme.nsi.id, secno, nsecs, dst);
+}
+
+/* Asynchronous interface.  nvme_submit_read() and nvme_submit_write()
+ * queue a command and return its tag without waiting.  Buffers
+ * must stay mapped (and backed by memory) until the command completes.
+ * Queued commands are handed to the controller by nvme_kick(), one
+ * doorbell write per queue for the whole batch, or when somebody
+ * waits.  Completions are collected by nvme_reap() in batches,
+ * or one by one with nvme_wait(). */
+
+int
+nvme_submit_read(uint64_t secno, void *dst, size_t nsecs) {
     if (!dst)
         return -NVME_BAD_ARG;
 
-    return nvme_cmd_rw(&nvme, &nvme.ioq[0], NVME_CMD_READ,
-                       nvme.nsi.id, secno, nsecs, get_phys_addr((void *)dst), 0);
+    return nvme_cmd_rw_submit(&nvme, NVME_CMD_READ, nvme.nsi.id, secno, nsecs, dst);
+}
+
+int
+nvme_submit_write(uint64_t secno, const void *src, size_t nsecs) {
+    if (!src)
+        return -NVME_BAD_ARG;
+
+    return nvme_cmd_rw_submit(&nvme, NVME_CMD_WRITE, nvme.nsi.id, secno, nsecs, src);
+}
+
+/* Ring doorbells of queues with new commands */
+void
+nvme_kick(void) {
+    for (uint32_t i = 0; i < nvme.ci.qcount; i++)
+        nvme_io_kick(&nvme, &nvme.ioq[i]);
+}
+
+/* Store up to max completed commands into done.  With wait, spins
+ * until at least one command completes, if any is in flight.
+ * Returns number of completions stored. */
+size_t
+nvme_reap(struct NvmeCompletion *done, size_t max, bool wait) {
+    uint64_t endtsc = 0;
+    size_t n = 0;
+
+    nvme_kick();
+    for (;;) {
+        bool inflight = 0;
+
+        for (uint32_t i = 0; i < nvme.ci.qcount && n < max; i++) {
+            struct NvmeQueueAttributes *q = &nvme.ioq[i];
+            nvme_io_reap(&nvme, q);
+            inflight |= q->inflight > 0;
+
+            for (uint32_t cid = 0; q->ndone && cid < q->size && n < max; cid++) {
+                if (q->tag_state[cid] != NVME_TAG_DONE) continue;
+                done[n++] = (struct NvmeCompletion){i * NVME_IO_QUEUE_SIZE + cid, q->tag_status[cid]};
+                q->tag_state[cid] = NVME_TAG_FREE;
+                q->ndone--;
+            }
+        }
+
+        if (n || !wait || !inflight) break;
+        if (!endtsc) endtsc = read_tsc() + 300 * tsc_freq;
+        if (read_tsc() >= endtsc) break;
+        asm volatile("pause");
+    }
+
+    nvme_stats.ns_reaped += n;
+    return n;
+}
+
+/* Wait for the command started with tag to complete.
+ * Returns its status, 0 if ok. */
+int
+nvme_wait(int tag) {
+    int cid;
+    struct NvmeQueueAttributes *q = nvme_tag_queue(&nvme, tag, &cid);
+    if (!q)
+        return -NVME_BAD_ARG;
+
+    return nvme_io_wait(&nvme, q, cid, 300);
 }
@@ -48,12 +48,19 @@
 #define NVME_INT_MASK     0xFFFFFFFF
 
 /* NVMe options */
-#define NVME_MAX_QUEUES  2
 #define NVME_QUEUE_SIZE  32
-#define NVME_QUEUE_COUNT 1
 #define NVME_AQSIZE      16
-/* We need 2 pages per queue: 1 admin queue + 1 I/O queue */
-#define NVME_PAGE_COUNT  (2*(NVME_QUEUE_COUNT + 1))
+/* I/O queues used, if the controller gives us that many */
+#define NVME_QUEUE_COUNT 4
+/* I/O submission queue fills its page (64-byte entries) */
+#define NVME_IO_QUEUE_SIZE 64
+/* PRP list entries per command id, limits pages per I/O */
+#define NVME_TAG_PRP     64
+/* Pages of PRP lists of all command ids of all I/O queues */
+#define NVME_PRP_PAGES   (NVME_QUEUE_COUNT * NVME_IO_QUEUE_SIZE * NVME_TAG_PRP * sizeof(uint64_t) / PAGE_SIZE)
+/* We need 2 pages per queue: 1 admin queue + NVME_QUEUE_COUNT I/O queues */
+#define NVME_PRP_PAGE    (2*(NVME_QUEUE_COUNT + 1))
+#define NVME_PAGE_COUNT  (NVME_PRP_PAGE + NVME_PRP_PAGES)
 
 #define NVME_REG32(reg, offset) (volatile uint32_t *)((uint8_t *)(reg) + offset)
 #define NVME_REG64(reg, offset) (volatile uint64_t *)((uint8_t *)(reg) + offset)
@@ -309,6 +316,14 @@ struct NvmeIdentifyControllerData {
     uint8_t vs[1024];      /* Vendor specific */
 } PACKED ALIGNED(PAGE_SIZE);
 
+/* States of I/O command ids (tags) */
+enum nvme_tag_state {
+    NVME_TAG_FREE = 0, /* Can be used for a new command */
+    NVME_TAG_BUSY = 1, /* Submitted and not completed */
+    NVME_TAG_DONE = 2, /* Completed, status is not collected yet */
+    NVME_TAG_LOST = 3, /* Timed out, freed when it completes */
+};
+
 struct NvmeQueueAttributes {
     uint32_t id;   /* Queue ID */
     uint32_t size; /* Queue size */
@@ -322,6 +337,13 @@ struct NvmeQueueAttributes {
     uint32_t sq_tail;     /* Submission queue tail */
     uint32_t cq_head;     /* Completion queue head */
     bool cq_phase;        /* Completion queue phase bit */
+
+    /* I/O queues only: commands may complete in any order */
+    uint32_t sq_kicked;                      /* Tail last written to the doorbell */
+    uint32_t inflight;                       /* Commands in NVME_TAG_BUSY or LOST */
+    uint32_t ndone;                          /* Commands in NVME_TAG_DONE */
+    uint8_t tag_state[NVME_IO_QUEUE_SIZE];   /* State by command id */
+    uint16_t tag_status[NVME_IO_QUEUE_SIZE]; /* Completion status by command id */
 };
 
 struct NvmeContollerInfo {
@@ -367,7 +389,10 @@ struct NvmeController {
      * 1st 4kB boundary is the start of the admin submission queue.
      * 2nd 4kB boundary is the start of the admin completion queue.
      * 3rd 4kB boundary is the start of I/O submission queue #1.
-     * 4th 4kB boundary is the start of I/O completion queue #1. */
+     * 4th 4kB boundary is the start of I/O completion queue #1.
+     * ... and so on for NVME_QUEUE_COUNT I/O queues.
+     * Remaining pages are PRP lists, NVME_TAG_PRP entries
+     * per command id (see NVME_PRP_PAGE). */
     uint8_t *buffer;
 
     struct NvmeQueueAttributes adminq;
@@ -375,8 +400,49 @@ struct NvmeController {
 };
 
 
+/* Completed asynchronous command */
+struct NvmeCompletion {
+    int nc_tag;    /* Tag returned on submission */
+    int nc_status; /* Completion status, 0 if ok */
+};
+
+struct NvmeStats {
+    uint64_t ns_cmds;      /* I/O commands submitted */
+    uint64_t ns_doorbells; /* Submission doorbell writes */
+    uint64_t ns_reaped;    /* Completions returned by nvme_reap() */
+};
+
+extern struct NvmeStats nvme_stats;
+
+/* Throughput benchmark parameters and results, see nvme_bench() */
+struct NvmeBench {
+    uint64_t nb_start;     /* First sector of the region used */
+    uint64_t nb_nsecs;     /* Region size, I/Os wrap around in it */
+    uint32_t nb_depth;     /* Commands kept in flight */
+    uint32_t nb_iosecs;    /* Sectors per command */
+    uint32_t nb_nios;      /* Commands to complete */
+    bool nb_write;         /* Write zeroes instead of reading */
+    uint64_t nb_nsec;      /* Time taken, in nanoseconds */
+    uint64_t nb_doorbells; /* Doorbell writes issued */
+};
+
+/* Benchmark buffers, one per command in flight, are limited to
+ * this size, and each run transfers about NVME_BENCH_BYTES */
+#define NVME_BENCH_MAXBUF (8 * 1024 * 1024)
+#define NVME_BENCH_BYTES  (16 * 1024 * 1024)
+
 int nvme_init(void);
 
 int nvme_write(uint64_t secno, const void *src, size_t nsecs);
 int nvme_read(uint64_t secno, void *dst, size_t nsecs);
+size_t nvme_max_sectors(void);
+size_t nvme_queue_depth(void);
+
+int nvme_submit_read(uint64_t secno, void *dst, size_t nsecs);
+int nvme_submit_write(uint64_t secno, const void *src, size_t nsecs);
+void nvme_kick(void);
+size_t nvme_reap(struct NvmeCompletion *done, size_t max, bool wait);
+int nvme_wait(int tag);
+
+int nvme_bench(struct NvmeBench *nb);
 #endif
@@ -0,0 +1,90 @@
+/* NVMe throughput benchmark.  Keeps nb_depth commands in flight
+ * over sequential sectors of a region, resubmitting from each batch
+ * of completions, so that it measures the asynchronous interface
+ * the same way the file server uses it. */
+
+#include "fs.h"
+#include "nvme.h"
+
+#define NVME_BENCH_BATCH 32
+
+int
+nvme_bench(struct NvmeBench *nb) {
+    static int tags[NVME_QUEUE_COUNT * NVME_IO_QUEUE_SIZE];
+    struct NvmeCompletion done[NVME_BENCH_BATCH];
+    size_t iosize = nb->nb_iosecs * SECTSIZE;
+    size_t bufsize = ROUNDUP(nb->nb_depth * iosize, PAGE_SIZE);
+    uint8_t *buf = (uint8_t *)NVME_BENCH_VADDR;
+    struct timespec start, end;
+    int res = 0;
+
+    if (!nb->nb_depth || nb->nb_depth > nvme_queue_depth() || !nb->nb_iosecs ||
+        nb->nb_iosecs > nvme_max_sectors() || nb->nb_nsecs < nb->nb_iosecs ||
+        !nb->nb_nios || bufsize > NVME_BENCH_MAXBUF)
+        return -NVME_BAD_ARG;
+
+    if (sys_alloc_region(CURENVID, buf, bufsize, PROT_RW) < 0)
+        return -NVME_ALLOC_FAILED;
+    /* Make pages backed by real memory before DMA */
+    memset(buf, 0, bufsize);
+
+    uint64_t next = 0, doorbells = nvme_stats.ns_doorbells;
+    uint32_t submitted = 0, completed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Slot i uses i'th piece of the buffer */
+    for (uint32_t i = 0; i < nb->nb_depth; i++)
+        tags[i] = -1;
+
+    while (completed < nb->nb_nios) {
+        for (uint32_t i = 0; i < nb->nb_depth && submitted < nb->nb_nios; i++) {
+            if (tags[i] >= 0) continue;
+
+            if (next + nb->nb_iosecs > nb->nb_nsecs) next = 0;
+            uint64_t secno = nb->nb_start + next;
+            next += nb->nb_iosecs;
+
+            tags[i] = nb->nb_write ? nvme_submit_write(secno, buf + i * iosize, nb->nb_iosecs) :
+                                     nvme_submit_read(secno, buf + i * iosize, nb->nb_iosecs);
+            if (tags[i] < 0) {
+                res = tags[i];
+                goto out;
+            }
+            submitted++;
+        }
+
+        /* Rings doorbells for the whole batch submitted above */
+        size_t n = nvme_reap(done, NVME_BENCH_BATCH, 1);
+        if (!n) {
+            res = -NVME_CMD_TIMEOUT;
+            goto out;
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            if (done[j].nc_status) res = -NVME_IOCMD_FAILED;
+            for (uint32_t i = 0; i < nb->nb_depth; i++) {
+                if (tags[i] == done[j].nc_tag) {
+                    tags[i] = -1;
+                    break;
+                }
+            }
+        }
+        completed += n;
+        if (res) goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    nb->nb_nsec = (end.tv_sec - start.tv_sec) * NSEC_PER_SEC + end.tv_nsec - start.tv_nsec;
+    nb->nb_doorbells = nvme_stats.ns_doorbells - doorbells;
+
+out:
+    /* Commands still in flight use the buffer */
+    while (completed < submitted) {
+        size_t n = nvme_reap(done, NVME_BENCH_BATCH, 1);
+        if (!n) panic("nvme_bench: commands never completed");
+        completed += n;
+    }
+    sys_unmap_region(CURENVID, buf, bufsize);
+    return res;
+}
@@ -33,6 +33,7 @@
 #define ECAM_VADDR       0x7000000000
 #define NVME_VADDR       0x7010000000
 #define NVME_QUEUE_VADDR 0x7020000000
+#define NVME_BENCH_VADDR 0x7030000000
 
 #define PCI_MAX_DEVICES    10
 #define PCI_NUM_DEVICES    32
@@ -134,16 +134,13 @@ serve_open(envid_t envid, struct Fsreq_open *req,
             return res;
         }
     }
-    if ((res = file_open(path, &f)) < 0) {
-        if (debug) cprintf("file_open failed: %i", res);
-        return res;
-    }
 
     /* Save the file pointer */
     o->o_file = f;
 
     /* Fill out the Fd structure */
     o->o_fd->fd_file.id = o->o_fileid;
+    strcpy(o->o_fd->fd_file.name, f->f_name);
     o->o_fd->fd_omode = req->req_omode & O_ACCMODE;
     o->o_fd->fd_dev_id = devfile.dev_id;
     o->o_mode = req->req_omode;
@@ -158,17 +155,16 @@ serve_open(envid_t envid, struct Fsreq_open *req,
     return 0;
 }
 
-/* Set the size of req->req_fileid to req->req_size bytes, truncating
+/* Set the size of file words[0] to words[1] bytes, truncating
  * or extending the file as necessary. */
 int
-serve_set_size(envid_t envid, union Fsipc *ipc) {
-    struct Fsreq_set_size *req = &ipc->set_size;
+serve_set_size(envid_t envid, uint64_t *words) {
     struct OpenFile *o;
     int r;
 
     if (debug) {
         cprintf("serve_set_size %08x %08x %08x\n",
-                envid, req->req_fileid, req->req_size);
+                envid, (uint32_t)words[0], (uint32_t)words[1]);
     }
 
     /* Every file system IPC call has the same general structure.
@@ -176,12 +172,55 @@ serve_set_size(envid_t envid, union Fsipc *ipc) {
 
     /* First, use openfile_lookup to find the relevant open file.
      * On failure, return the error code to the client with ipc_send. */
-    if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+    if ((r = openfile_lookup(envid, words[0], &o)) < 0)
         return r;
 
     /* Second, call the relevant file system function (from fs/fs.c).
      * On failure, return the error code to the client. */
-    return file_set_size(o->o_file, req->req_size);
+    return file_set_size(o->o_file, (off_t)words[1]);
+}
+
+/* Read at most n bytes from the current seek position in fileid
+ * into buf, then update the seek position.  Returns the number
+ * of bytes successfully read, or < 0 on error. */
+static int
+serve_read_buf(envid_t envid, uint32_t fileid, void *buf, size_t n) {
+    // LAB 10: Your code here
+    struct OpenFile *o;
+    int res;
+
+    if ((res = openfile_lookup(envid, fileid, &o)) < 0)
+        return res;
+
+    int bytes_cnt; ;
+    if ((bytes_cnt = file_read(o->o_file, buf, n, o->o_fd->fd_offset)) > 0)
+        o->o_fd->fd_offset += bytes_cnt;
+    return bytes_cnt;
+}
+
+/* Write n bytes from buf to fileid, starting at the current seek
+ * position, and update the seek position accordingly.  Extend the file
+ * if necessary.  Returns the number of bytes written, or < 0 on error. */
+static int
+serve_write_buf(envid_t envid, uint32_t fileid, const void *buf, size_t n) {
+    // LAB 10: Your code here
+    struct OpenFile *o;
+    int res;
+
+    if ((res = openfile_lookup(envid, fileid, &o)))
+        return res;
+
+    off_t max_off = n + o->o_fd->fd_offset;
+    if (max_off > o->o_file->f_size)
+    {
+        if ((res = file_set_size(o->o_file, max_off)) < 0) 
+            return res;
+    }
+
+    int bytes_cnt;
+    if ((bytes_cnt = file_write(o->o_file, buf, n, o->o_fd->fd_offset)) > 0)
+        o->o_fd->fd_offset += bytes_cnt;
+    return bytes_cnt;
 }
 
 /* Read at most ipc->read.req_n bytes from the current seek position
@@ -197,21 +236,48 @@ serve_read(envid_t envid, union Fsipc *ipc) {
                 envid, req->req_fileid, (uint32_t)req->req_n);
     }
 
-    // LAB 10: Your code here
-    struct Fsret_read *ret = &ipc->readRet;
+    return serve_read_buf(envid, req->req_fileid, ipc->readRet.ret_buf,
+                          MIN(req->req_n, sizeof(ipc->readRet.ret_buf)));
+}
+
+/* Find up to words[1] whole blocks of file words[0] at the current
+ * seek position for FSREQ_READ_MAP.  Sets *pg_store and *size_store
+ * to the block cache region to map into the caller, copy-on-write,
+ * and updates the seek position.  Returns the number of bytes mapped,
+ * or < 0 on error. */
+static int
+serve_read_map(envid_t envid, uint64_t *words, void **pg_store, size_t *size_store) {
     struct OpenFile *o;
-    int res;
+    char *blk;
 
-    if ((res = openfile_lookup(envid, req->req_fileid, &o)) < 0)
-        return res;
+    if (debug) cprintf("serve_read_map %08x %08x %lu\n", envid, (uint32_t)words[0], (unsigned long)words[1]);
 
-    if (req->req_n > PAGE_SIZE)
-        req->req_n = PAGE_SIZE;
+    int res = openfile_lookup(envid, words[0], &o);
+    if (res < 0) return res;
 
-    int bytes_cnt; ;
-    if ((bytes_cnt = file_read(o->o_file, ret->ret_buf, req->req_n, o->o_fd->fd_offset)) > 0)
-        o->o_fd->fd_offset += bytes_cnt;
-    return bytes_cnt;
+    /* Blocks are mapped out with their dirty bits written back,
+     * which can't be done before the commit.  Nothing has been
+     * changed by this request yet, so it can commit here */
+    fs_log_commit();
+
+    /* Run has to stay cached while it is being mapped,
+     * so it is kept well within the cache budget */
+    size_t n = MIN(words[1], MIN(READ_MAP_MAX, bc_set_budget(0) / 4));
+    res = file_read_map(o->o_file, o->o_fd->fd_offset, n, &blk);
+    if (res <= 0) return res;
+
+    /* Only present pages can be mapped.  Touching a block can still
+     * evict another one of the run, so they are touched backwards
+     * and the run ends before the first one that is gone */
+    for (int i = res - 1; i >= 0; i--)
+        (void)*(volatile char *)(blk + i * BLKSIZE);
+    for (int i = 1; i < res; i++)
+        if (!is_page_present(blk + i * BLKSIZE)) res = i;
+
+    *pg_store = blk;
+    *size_store = res * BLKSIZE;
+    o->o_fd->fd_offset += res * BLKSIZE;
+    return res * BLKSIZE;
 }
 
 /* Write req->req_n bytes from req->req_buf to req_fileid, starting at
@@ -224,53 +290,32 @@ serve_write(envid_t envid, union Fsipc *ipc) {
     if (debug)
         cprintf("serve_write %08x %08x %08x\n", envid, req->req_fileid, (uint32_t)req->req_n);
 
-    // LAB 10: Your code here
-    struct OpenFile *o;
-    int res;
-
-    if ((res = openfile_lookup(envid, req->req_fileid, &o)))
-        return res;
-
-    off_t max_off = req->req_n + o->o_fd->fd_offset;
-    if (max_off > o->o_file->f_size)
-    {
-        if ((res = file_set_size(o->o_file, max_off)) < 0) 
-            return res;
-    }
-
-    int bytes_cnt;
-    if ((bytes_cnt = file_write(o->o_file, req->req_buf, req->req_n, o->o_fd->fd_offset)) > 0)
-        o->o_fd->fd_offset += bytes_cnt;
-    return bytes_cnt;
+    return serve_write_buf(envid, req->req_fileid, req->req_buf,
+                           MIN(req->req_n, sizeof(req->req_buf)));
 }
 
-/* Stat ipc->stat.req_fileid.  Return the file's struct Stat to the
- * caller in ipc->statRet. */
+/* Stat file words[0].  Return its size and type to the caller
+ * in words[0] and words[1], name is already in the Fd page. */
 int
-serve_stat(envid_t envid, union Fsipc *ipc) {
-    struct Fsreq_stat *req = &ipc->stat;
-    struct Fsret_stat *ret = &ipc->statRet;
-
-    if (debug) cprintf("serve_stat %08x %08x\n", envid, req->req_fileid);
+serve_stat(envid_t envid, uint64_t *words) {
+    if (debug) cprintf("serve_stat %08x %08x\n", envid, (uint32_t)words[0]);
 
     struct OpenFile *o;
-    int res = openfile_lookup(envid, req->req_fileid, &o);
+    int res = openfile_lookup(envid, words[0], &o);
     if (res < 0) return res;
 
-    strcpy(ret->ret_name, o->o_file->f_name);
-    ret->ret_size = o->o_file->f_size;
-    ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
+    words[0] = o->o_file->f_size;
+    words[1] = (o->o_file->f_type == FTYPE_DIR);
     return 0;
 }
 
-/* Flush all data and metadata of req->req_fileid to disk. */
+/* Flush all data and metadata of file words[0] to disk. */
 int
-serve_flush(envid_t envid, union Fsipc *ipc) {
-    struct Fsreq_flush *req = &ipc->flush;
-    if (debug) cprintf("serve_flush %08x %08x\n", envid, req->req_fileid);
+serve_flush(envid_t envid, uint64_t *words) {
+    if (debug) cprintf("serve_flush %08x %08x\n", envid, (uint32_t)words[0]);
 
     struct OpenFile *o;
-    int res = openfile_lookup(envid, req->req_fileid, &o);
+    int res = openfile_lookup(envid, words[0], &o);
     if (res < 0) return res;
 
     file_flush(o->o_file);
@@ -278,23 +323,323 @@ serve_flush(envid_t envid, union Fsipc *ipc) {
 }
 
 int
-serve_sync(envid_t envid, union Fsipc *req) {
+serve_sync(envid_t envid, uint64_t *words) {
     fs_sync();
     return 0;
 }
 
+/* Environment was started by the kernel rather than
+ * by another program, so it may change server settings */
+static bool
+serve_privileged(envid_t envid) {
+    const volatile struct Env *env = &envs[ENVX(envid)];
+    return env->env_id == envid && !env->env_parent_id;
+}
+
+/* Report block cache counters */
+int
+serve_cache_stat(envid_t envid, uint64_t *words) {
+    if (debug) cprintf("serve_cache_stat %08x\n", envid);
+
+    int budget = bc_set_budget(0);
+    words[0] = bc_stats.bs_hits;
+    words[1] = bc_stats.bs_misses;
+    words[2] = bc_stats.bs_evictions;
+    words[3] = bc_stats.bs_resident;
+    if (debug) cprintf("block cache: %lu write-backs, %lu read ahead (%lu wasted), %lu blocks synced in %lu writes\n",
+                       (unsigned long)bc_stats.bs_writebacks, (unsigned long)bc_stats.bs_readahead,
+                       (unsigned long)bc_stats.bs_ra_wasted, (unsigned long)bc_stats.bs_wb_blocks,
+                       (unsigned long)bc_stats.bs_wb_ios);
+    if (debug) cprintf("block cache: %lu misses filled asynchronously in %lu batches\n",
+                       (unsigned long)bc_stats.bs_fills, (unsigned long)bc_stats.bs_fill_ios);
+    return budget;
+}
+
+/* Change block cache budget to words[0] blocks */
+int
+serve_cache_budget(envid_t envid, uint64_t *words) {
+    if (debug) cprintf("serve_cache_budget %08x %lu\n", envid, (unsigned long)words[0]);
+
+    if (!serve_privileged(envid)) return -E_BAD_ENV;
+    if (!words[0]) return -E_INVAL;
+    return bc_set_budget(words[0]);
+}
+
+/* Report dentry cache counters */
+int
+serve_dentry_stat(envid_t envid, uint64_t *words) {
+    words[0] = dcache_stats.ds_hits;
+    words[1] = dcache_stats.ds_neg_hits;
+    words[2] = dcache_stats.ds_misses;
+    words[3] = dcache_stats.ds_flushes;
+    if (debug) {
+        uint64_t total = dcache_stats.ds_hits + dcache_stats.ds_misses;
+        cprintf("dentry cache: %lu%% hits of %lu lookups\n",
+                (unsigned long)(total ? dcache_stats.ds_hits * 100 / total : 0), (unsigned long)total);
+    }
+    return 0;
+}
+
+/* Run NVMe benchmark with words[0] commands (and FSBENCH_* flags)
+ * of words[1] bytes in flight.  Reads go over the whole disk, writes
+ * over the metadata log region, which is only allowed while the log
+ * is idle (after sync()).  The server does nothing else meanwhile,
+ * so only environments started by the kernel may run it. */
+int
+serve_nvme_bench(envid_t envid, uint64_t *words) {
+    struct NvmeBench nb = {
+            .nb_depth = words[0] & ~FSBENCH_WRITE,
+            .nb_iosecs = words[1] / SECTSIZE,
+            .nb_write = !!(words[0] & FSBENCH_WRITE),
+    };
+
+    if (debug) cprintf("serve_nvme_bench %08x %u %u %d\n", envid, nb.nb_depth, nb.nb_iosecs, nb.nb_write);
+
+    if (!serve_privileged(envid)) return -E_BAD_ENV;
+    if (words[1] % SECTSIZE) return -E_INVAL;
+    if (nb.nb_write && (!(super->s_features & FS_FEATURE_LOG) || !fs_log_idle()))
+        return -E_NOT_SUPP;
+
+    /* Benchmark reaps all completions, ring fills must not be among them */
+    bc_fetch_wait();
+    if (nb.nb_write) {
+        nb.nb_start = (uint64_t)super->s_log_start * BLKSECTS;
+        nb.nb_nsecs = (uint64_t)super->s_log_nblocks * BLKSECTS;
+    } else {
+        nb.nb_start = 0;
+        nb.nb_nsecs = (uint64_t)super->s_nblocks * BLKSECTS;
+    }
+    if (nb.nb_iosecs) nb.nb_nios = MAX(NVME_BENCH_BYTES / (nb.nb_iosecs * SECTSIZE), nb.nb_depth);
+
+    int res = nvme_bench(&nb);
+    if (res == -NVME_BAD_ARG) return -E_INVAL;
+    if (res) return -E_UNSPECIFIED;
+
+    words[0] = nb.nb_nsec;
+    words[1] = (uint64_t)nb.nb_nios * nb.nb_iosecs * SECTSIZE;
+    words[2] = nb.nb_doorbells;
+    return 0;
+}
+
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
         /* Open is handled specially because it passes pages */
         //[FSREQ_OPEN] =   (fshandler)serve_open,
         [FSREQ_READ] = serve_read,
+        [FSREQ_WRITE] = serve_write};
+#define NHANDLERS (sizeof(handlers) / sizeof(handlers[0]))
+
+/* Fixed-size requests: arguments come in IPC_NWORDS words,
+ * handler overwrites them with the reply words */
+typedef int (*fswordhandler)(envid_t envid, uint64_t *words);
+
+fswordhandler word_handlers[] = {
         [FSREQ_STAT] = serve_stat,
         [FSREQ_FLUSH] = serve_flush,
-        [FSREQ_WRITE] = serve_write,
         [FSREQ_SET_SIZE] = serve_set_size,
-        [FSREQ_SYNC] = serve_sync};
-#define NHANDLERS (sizeof(handlers) / sizeof(handlers[0]))
+        [FSREQ_SYNC] = serve_sync,
+        [FSREQ_CACHE_STAT] = serve_cache_stat,
+        [FSREQ_CACHE_BUDGET] = serve_cache_budget,
+        [FSREQ_DENTRY_STAT] = serve_dentry_stat,
+        [FSREQ_NVME_BENCH] = serve_nvme_bench};
+#define NWORDHANDLERS (sizeof(word_handlers) / sizeof(word_handlers[0]))
+
+/* Request rings are mapped after Fd pages */
+#define NFSRING     16
+#define FSRING_BASE (FILE_BASE + MAXOPEN * PAGE_SIZE)
+
+static envid_t fsring_owner[NFSRING];
+/* Previous entry failed, kept while the ring waits for blocks */
+static bool fsring_failed[NFSRING];
+
+static struct FsRing *
+fsring_at(size_t i) {
+    return (struct FsRing *)(FSRING_BASE + i * sizeof(struct FsRing));
+}
+
+/* Allocate a request ring for envid.  Rings whose clients are all
+ * gone (only the server maps them) are reused. */
+static int
+serve_ring_setup(envid_t envid, void **pg_store, int *perm_store) {
+    for (size_t i = 0; i < NFSRING; i++) {
+        struct FsRing *ring = fsring_at(i);
+        int res = sys_region_refs(ring, sizeof(*ring));
+        if (res > 1) continue;
+        if (!res && (res = sys_alloc_region(0, ring, sizeof(*ring), PROT_RW)) < 0)
+            return res;
+
+        memset(ring, 0, __builtin_offsetof(struct FsRing, fr_data));
+        fsring_owner[i] = envid;
+        fsring_failed[i] = 0;
+
+        *pg_store = ring;
+        *perm_store = PROT_RW | PROT_SHARE;
+        return 0;
+    }
+    return -E_NO_MEM;
+}
+
+static int64_t
+fsring_execute(envid_t envid, struct FsRingEntry *ent, char *data) {
+    size_t n = MIN(ent->re_arg, PAGE_SIZE);
+
+    switch (ent->re_type) {
+    case FSREQ_READ:
+        return serve_read_buf(envid, ent->re_fileid, data, n);
+    case FSREQ_WRITE:
+        return serve_write_buf(envid, ent->re_fileid, data, n);
+    }
+
+    if (ent->re_type < NWORDHANDLERS && word_handlers[ent->re_type]) {
+        uint64_t words[IPC_NWORDS] = {(uint32_t)ent->re_fileid, ent->re_arg};
+        int res = word_handlers[ent->re_type](envid, words);
+        for (size_t i = 0; i < sizeof(ent->re_words) / sizeof(*ent->re_words); i++)
+            ent->re_words[i] = words[i];
+        return res;
+    }
+
+    return -E_INVAL;
+}
+
+/* Go over cached blocks that read or write entry ent touches when
+ * the seek position is off.  With start, fills of missing blocks are
+ * started.  Returns true if some of the blocks are being read. */
+static bool
+fsring_blocks(envid_t envid, struct FsRingEntry *ent, int64_t off, bool start) {
+    struct OpenFile *o;
+    blockno_t diskbno;
+    bool wait = 0;
+
+    if (ent->re_type != FSREQ_READ && ent->re_type != FSREQ_WRITE) return 0;
+    if (openfile_lookup(envid, ent->re_fileid, &o) < 0 || off < 0) return 0;
+
+    /* Blocks past the end are allocated, not read */
+    struct File *f = o->o_file;
+    int64_t end = MIN(off + (int64_t)MIN(ent->re_arg, PAGE_SIZE), f->f_size);
+
+    for (int64_t pos = ROUNDDOWN(off, BLKSIZE); pos < end; pos += BLKSIZE) {
+        if (file_block_map(f, pos / BLKSIZE, &diskbno) < 0 || !diskbno) continue;
+        if (start ? bc_fetch(diskbno) : bc_fetching(diskbno)) wait = 1;
+    }
+
+    return wait;
+}
+
+/* Start fills of blocks missed by entries queued in ring i,
+ * predicting seek positions of sequential reads and writes. */
+static void
+fsring_prefetch(size_t i, uint32_t head, uint32_t tail) {
+    struct FsRing *ring = fsring_at(i);
+    int32_t fileids[FSRING_SIZE];
+    int64_t offsets[FSRING_SIZE];
+    size_t nfiles = 0;
+
+    for (; head != tail; head++) {
+        struct FsRingEntry *ent = &ring->fr_ent[head % FSRING_SIZE];
+        struct OpenFile *o;
+        size_t j = 0;
+
+        if (ent->re_type != FSREQ_READ && ent->re_type != FSREQ_WRITE) continue;
+        if (openfile_lookup(fsring_owner[i], ent->re_fileid, &o) < 0) continue;
+
+        while (j < nfiles && fileids[j] != ent->re_fileid) j++;
+        if (j == nfiles) {
+            fileids[nfiles] = ent->re_fileid;
+            offsets[nfiles++] = o->o_fd->fd_offset;
+        }
+
+        fsring_blocks(fsring_owner[i], ent, offsets[j], 1);
+        offsets[j] += MIN(ent->re_arg, PAGE_SIZE);
+    }
+}
+
+/* Execute entries queued in all request rings.
+ * Requests are run as an event loop: first reads of all blocks
+ * missed by queued entries are started together, then entries
+ * that have their blocks cached are executed while the reads
+ * are in flight.  A ring stops at the first entry that waits
+ * for a block (entries of a ring complete in order) and goes on
+ * after the reads are done, on the next poll.
+ * Returns true if there was anything to do. */
+static bool
+fsring_poll(void) {
+    uint32_t heads[NFSRING], tails[NFSRING];
+    bool busy = 0;
+
+    for (size_t i = 0; i < NFSRING; i++) {
+        if (!fsring_owner[i]) continue;
+
+        struct FsRing *ring = fsring_at(i);
+        heads[i] = ring->fr_head;
+        tails[i] = __atomic_load_n(&ring->fr_tail, __ATOMIC_ACQUIRE);
+
+        /* Tail is written by client, don't trust it */
+        if (tails[i] - heads[i] > FSRING_SIZE) tails[i] = heads[i] + FSRING_SIZE;
+        fsring_prefetch(i, heads[i], tails[i]);
+    }
+    /* All fills go to the device with one doorbell per queue */
+    nvme_kick();
+
+    for (size_t i = 0; i < NFSRING; i++) {
+        if (!fsring_owner[i]) continue;
+
+        struct FsRing *ring = fsring_at(i);
+        uint32_t head = heads[i];
+
+        for (; head != tails[i]; head++) {
+            struct FsRingEntry *ent = &ring->fr_ent[head % FSRING_SIZE];
+            char *data = ring->fr_data[head % FSRING_SIZE];
+
+            if (fsring_failed[i] && (ent->re_flags & FSRING_LINK)) {
+                ent->re_res = -E_CANCELED;
+            } else {
+                struct OpenFile *o;
+                if (openfile_lookup(fsring_owner[i], ent->re_fileid, &o) >= 0 &&
+                    fsring_blocks(fsring_owner[i], ent, o->o_fd->fd_offset, 0)) break;
+
+                ent->re_res = fsring_execute(fsring_owner[i], ent, data);
+                fs_log_request_done();
+                bool io = ent->re_type == FSREQ_READ || ent->re_type == FSREQ_WRITE;
+                fsring_failed[i] = ent->re_res < 0 || (io && ent->re_res < MIN(ent->re_arg, PAGE_SIZE));
+            }
+
+            __atomic_store_n(&ring->fr_head, head + 1, __ATOMIC_RELEASE);
+            busy = 1;
+        }
+
+        /* Next batch of entries starts a new chain */
+        if (head == tails[i]) fsring_failed[i] = 0;
+
+        /* Wake the client if it sleeps in its ring */
+        if (head != heads[i] && __atomic_exchange_n(&ring->fr_waiting, 0, __ATOMIC_SEQ_CST))
+            sys_ipc_notify(fsring_owner[i], FSRING_NOTIFY);
+    }
+
+    if (bc_fetch_wait()) busy = 1;
+    return busy;
+}
+
+/* Tell clients to notify us after queueing requests.
+ * Returns false if some request was queued meanwhile. */
+static bool
+fsring_sleep(void) {
+    for (size_t i = 0; i < NFSRING; i++)
+        if (fsring_owner[i]) fsring_at(i)->fr_sleeping = 1;
+
+    /* Pairs with the fence in client after advancing fr_tail */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (size_t i = 0; i < NFSRING; i++)
+        if (fsring_owner[i] && fsring_at(i)->fr_tail != fsring_at(i)->fr_head) return 0;
+    return 1;
+}
+
+static void
+fsring_wake(void) {
+    for (size_t i = 0; i < NFSRING; i++)
+        if (fsring_owner[i]) fsring_at(i)->fr_sleeping = 0;
+}
 
 void
 serve(void) {
@@ -303,16 +648,86 @@ serve(void) {
     void *pg;
 
     while (1) {
+        /* Log commits happen only between requests */
+        fs_log_request_done();
+
+        /* Poll request rings while they have work
+         * and only sleep when all of them are empty */
+        if (fsring_poll() || !fsring_sleep()) {
+            fsring_wake();
+            continue;
+        }
+
         perm = 0;
         size_t sz = PAGE_SIZE;
         req = ipc_recv((int32_t *)&whom, fsreq, &sz, &perm);
+        fsring_wake();
+
+        /* Client queued something into its ring
+         * or it's time for background write-back */
+        if ((int32_t)req == -E_IPC_NOTIFIED) {
+            uint64_t bits = 0;
+            sys_ipc_queue_recv(NULL, 0, &bits, 0);
+            if (bits & BC_WRITEBACK_BIT) {
+                fs_log_commit();
+                size_t written = bc_writeback();
+                if (debug && written) cprintf("fs wrote back %zu blocks\n", written);
+            }
+            continue;
+        }
+
+        /* Failed receive leaves whom zero, which is
+         * not a reclaim request from the kernel */
+        if ((int32_t)req < 0) {
+            cprintf("fs ipc_recv failed: %i\n", (int32_t)req);
+            continue;
+        }
+
         if (debug) {
             cprintf("fs req %d from %08x [page %08lx: %s]\n",
                     req, whom, (unsigned long)get_uvpt_entry(fsreq),
                     (char *)fsreq);
         }
 
-        /* All requests must contain an argument page */
+        /* Message from the kernel asks us to shrink the block cache */
+        if (!whom) {
+            size_t dropped = bc_reclaim(req);
+            if (debug) cprintf("fs dropped %zu blocks of %u asked\n", dropped, req);
+            continue;
+        }
+
+        if (req == FSREQ_RING_SETUP) {
+            pg = NULL;
+            res = serve_ring_setup(whom, &pg, &perm);
+            ipc_send(whom, res, pg, sizeof(struct FsRing), perm);
+            continue;
+        }
+
+        /* Cached blocks are mapped copy-on-write, so the client
+         * keeps a snapshot even if the server writes them later */
+        if (req == FSREQ_READ_MAP && !(perm & PROT_R)) {
+            uint64_t words[IPC_NWORDS];
+            size_t size = 0;
+            for (size_t i = 0; i < IPC_NWORDS; i++)
+                words[i] = thisenv->env_ipc_words[i];
+            pg = NULL;
+            res = serve_read_map(whom, words, &pg, &size);
+            ipc_send(whom, res, pg, size, PROT_RW | PROT_LAZY);
+            continue;
+        }
+
+        /* Fixed-size requests come without a page,
+         * so there's nothing to unmap after them */
+        if (!(perm & PROT_R) && req < NWORDHANDLERS && word_handlers[req]) {
+            uint64_t words[IPC_NWORDS];
+            for (size_t i = 0; i < IPC_NWORDS; i++)
+                words[i] = thisenv->env_ipc_words[i];
+            res = word_handlers[req](whom, words);
+            ipc_send_words(whom, res, words);
+            continue;
+        }
+
+        /* All other requests must contain an argument page */
         if (!(perm & PROT_R)) {
             cprintf("Invalid request from %08x: no argument page\n", whom);
             continue; /* Just leave it hanging... */
@@ -327,8 +742,13 @@ serve(void) {
             cprintf("Invalid request code %d from %08x\n", req, whom);
             res = -E_INVAL;
         }
-        ipc_send(whom, res, pg, PAGE_SIZE, perm);
-        sys_unmap_region(0, fsreq, PAGE_SIZE);
+        if ((perm & IPC_DONATE) && !pg) {
+            /* Request page was donated, give it back with the reply */
+            ipc_send(whom, res, fsreq, PAGE_SIZE, PROT_RW | IPC_DONATE);
+        } else {
+            ipc_send(whom, res, pg, PAGE_SIZE, perm);
+            sys_unmap_region(0, fsreq, PAGE_SIZE);
+        }
     }
 }
 
@@ -348,5 +768,12 @@ umain(int argc, char **argv) {
     serve_init();
     fs_init();
     fs_test();
+
+    /* Clean cached blocks can be dropped when memory runs low */
+    sys_env_set_reclaimable(CURENVID, 1);
+    /* Clients with request rings wake us up with notifications */
+    sys_ipc_endpoint((void *)MAX_USER_ADDRESS, 0);
+    /* Dirty blocks are written back periodically */
+    sys_ipc_timer(BC_WRITEBACK_BIT, BC_WRITEBACK_MS);
     serve();
 }
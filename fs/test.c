@@ -14,19 +14,19 @@ check_consistency(void) {
 
 void
 check_dir(struct File *dir) {
-    uint32_t *blk;
+    blockno_t blk;
     struct File *files;
 
     blockno_t nblock = dir->f_size / BLKSIZE;
     for (blockno_t i = 0; i < nblock; ++i) {
-        if (file_block_walk(dir, i, &blk, 0) < 0) continue;
+        if (file_block_map(dir, i, &blk) < 0 || !blk) continue;
 
-        files = (struct File *)diskaddr(*blk);
+        files = (struct File *)diskaddr(blk);
 
         for (blockno_t j = 0; j < BLKFILES; ++j) {
             struct File *f = &(files[j]);
             if (strcmp(f->f_name, "\0") != 0) {
-                blockno_t *pdiskbno = NULL;
+                blockno_t diskbno = 0;
 
                 cprintf("checking consistency of %s\n", f->f_name);
 
@@ -34,10 +34,10 @@ check_dir(struct File *dir) {
                     if (f->f_type == FTYPE_DIR) {
                         check_dir(f);
                     }
-                    if (file_block_walk(f, k, &pdiskbno, 0) < 0 || pdiskbno == NULL || *pdiskbno == 0) {
+                    if (file_block_map(f, k, &diskbno) < 0 || diskbno == 0) {
                         continue;
                     }
-                    assert(!block_is_free(*pdiskbno));
+                    assert(!block_is_free(diskbno));
                 }
             }
         }
@@ -50,6 +50,7 @@ fs_test(void) {
     int r;
     char *blk;
     uint32_t *bits;
+    bool logged = super->s_features & FS_FEATURE_LOG;
 
     /* Back up bitmap */
     if ((r = sys_alloc_region(0, (void *)PAGE_SIZE, PAGE_SIZE, PROT_RW)) < 0)
@@ -64,6 +65,22 @@ fs_test(void) {
     /* And is not free any more */
     assert(!TSTBIT(bitmap, r));
     cprintf("alloc_block is good\n");
+
+    /* Runs are contiguous and start at the hint if it is free */
+    blockno_t run;
+    if (!(run = alloc_block_run(r + 1, 8)))
+        panic("alloc_block_run: %i", -E_NO_DISK);
+    for (blockno_t b = run; b < run + 8; b++) {
+        assert(TSTBIT(bits, b));
+        assert(!TSTBIT(bitmap, b));
+    }
+    bool hint_free = 1;
+    for (blockno_t b = r + 1; b < r + 9; b++)
+        hint_free &= b < super->s_nblocks && TSTBIT(bits, b);
+    if (hint_free) assert(run == r + 1);
+    for (blockno_t b = run; b < run + 8; b++)
+        free_block(b);
+    cprintf("alloc_block_run is good\n");
     check_consistency();
     cprintf("fs consistency is good\n");
 
@@ -87,21 +104,44 @@ fs_test(void) {
     assert(!is_page_dirty(blk));
     cprintf("file_flush is good\n");
 
+    /* Blocks cleaned by write-back keep taking writes */
+    bc_writeback();
+    assert(!is_page_dirty(blk));
+    *(volatile char *)blk = *(volatile char *)blk;
+    assert(is_page_dirty(blk));
+    assert(bc_writeback() > 0);
+    assert(!is_page_dirty(blk));
+    cprintf("bc_writeback is good\n");
+
     if ((r = file_set_size(f, 0)) < 0)
         panic("file_set_size: %i", r);
-    assert(f->f_direct[0] == 0);
-    assert(!is_page_dirty(f));
+    if (f->f_flags & FILE_EXTENTS)
+        assert(f->f_nextents == 0 && f->f_extindex == 0);
+    else
+        assert(f->f_direct[0] == 0);
+    /* With the log, the change waits for the next commit */
+    if (logged)
+        assert(fs_log_pending(f));
+    else
+        assert(!is_page_dirty(f));
     cprintf("file_truncate is good\n");
 
     if ((r = file_set_size(f, strlen(msg))) < 0)
         panic("file_set_size 2: %i", r);
-    assert(!is_page_dirty(f));
+    if (logged)
+        assert(fs_log_pending(f));
+    else
+        assert(!is_page_dirty(f));
     if ((r = file_get_block(f, 0, &blk)) < 0)
         panic("file_get_block 2: %i", r);
     strcpy(blk, msg);
     assert(is_page_dirty(blk));
     file_flush(f);
     assert(!is_page_dirty(blk));
-    assert(!is_page_dirty(f));
+    /* Committed File goes home at the next checkpoint */
+    if (logged)
+        assert(fs_log_committed(f));
+    else
+        assert(!is_page_dirty(f));
     cprintf("file rewrite is good\n");
 }
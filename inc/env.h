@@ -6,6 +6,7 @@
 #include <inc/types.h>
 #include <inc/trap.h>
 #include <inc/memlayout.h>
+#include <inc/ipc.h>
 
 typedef int32_t envid_t;
 
@@ -55,6 +56,11 @@ struct AddressSpace {
     pml4e_t *pml4;     /* Virtual address of pml4 */
     uintptr_t cr3;     /* Physical address of pml4 */
     struct Page *root; /* root node of address space tree */
+
+    /* Last range accepted by user_mem_check(),
+     * reset on every unmap */
+    uintptr_t checked_start, checked_end;
+    int checked_perm;
 };
 
 
@@ -82,6 +88,16 @@ struct Env {
     uint32_t env_ipc_value;  /* Data value sent to us */
     envid_t env_ipc_from;    /* envid of the sender */
     int env_ipc_perm;        /* Perm of page mapping received */
+    uint64_t env_ipc_words[IPC_NWORDS]; /* Words received with sys_ipc_send_words() */
+
+    /* Memory pressure */
+    bool env_mem_reclaimable; /* Env shrinks its caches on kernel request */
+    int env_mem_notify;       /* State of memory pressure notification */
+    bool env_mem_waiting;     /* Env waits for reclaim to retry page fault */
+    bool env_mem_retried;     /* Env was woken after reclaim round */
+
+    /* System call ring */
+    uintptr_t env_ring; /* User address of struct SysRing or 0 */
 };
 
 #endif /* !JOS_INC_ENV_H */
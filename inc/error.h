@@ -27,6 +27,9 @@ enum {
     E_FILE_EXISTS = 17, /* File already exists */
     E_NOT_EXEC = 18,    /* File not a valid executable */
     E_NOT_SUPP = 19,    /* Operation not supported */
+    E_CANCELED = 20,    /* Operation canceled by failure of linked one */
+    E_IPC_QUEUE_FULL = 21, /* Receiver's IPC queue is full */
+    E_IPC_NOTIFIED = 22,   /* IPC receive interrupted by notification */
     MAXERROR
 };
 
@@ -8,6 +8,11 @@
 #include <inc/types.h>
 #include <inc/fs.h>
 
+/* Maximum number of file descriptors a program may hold open concurrently */
+#define MAXFD 32
+/* Bottom of file descriptor area, file data pages follow it */
+#define FDTABLE 0xD0000000LL
+
 struct Fd;
 struct Stat;
 struct Dev;
@@ -25,6 +30,7 @@ struct Dev {
 
 struct FdFile {
     int id;
+    char name[MAXNAMELEN]; /* Filled by the server on open, for stat */
 };
 
 struct Fd {
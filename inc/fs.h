@@ -28,23 +28,59 @@ typedef uint32_t blockno_t;
 
 #define MAXFILESIZE ((NDIRECT + NINDIRECT) * BLKSIZE)
 
+/* Extent files (FILE_EXTENTS) map runs of file blocks
+ * to runs of disk blocks.  First NEXTENT extents are kept
+ * in the File itself, the rest go to leaf blocks listed
+ * in the extent index block (f_extindex). */
+#define NEXTENT 8
+/* Number of extents in an extent leaf block */
+#define NLEAFEXTENT (BLKSIZE / sizeof(struct Extent))
+#define MAXEXTENTS  (NEXTENT + NINDIRECT * NLEAFEXTENT)
+
+/* Extent file size is limited only by off_t */
+#define MAXEXTFILESIZE ((int32_t)(0x80000000U - BLKSIZE))
+
 #define SETBIT(v, n) ((v)[(n / 32)] |= 1U << ((n) % 32))
 #define CLRBIT(v, n) ((v)[(n / 32)] &= ~(1U << ((n) % 32)))
 #define TSTBIT(v, n) ((v)[(n / 32)] & (1U << ((n) % 32)))
 
+struct Extent {
+    blockno_t e_fileblk; /* first file block */
+    blockno_t e_diskblk; /* first disk block */
+    uint32_t e_len;      /* number of blocks */
+} __attribute__((packed));
+
 struct File {
     char f_name[MAXNAMELEN]; /* filename */
     off_t f_size;            /* file size in bytes */
     uint32_t f_type;         /* file type */
 
-    /* Block pointers. */
-    /* A block is allocated iff its value is != 0. */
-    blockno_t f_direct[NDIRECT]; /* direct blocks */
-    blockno_t f_indirect;        /* indirect block */
+    union {
+        /* Block pointers. */
+        /* A block is allocated iff its value is != 0. */
+        struct {
+            blockno_t f_direct[NDIRECT]; /* direct blocks */
+            blockno_t f_indirect;        /* indirect block */
+        };
+
+        /* Extents sorted by e_fileblk, used with FILE_EXTENTS.
+         * Blocks not covered by any extent are not allocated. */
+        struct {
+            uint32_t f_nextents;              /* total number of extents */
+            blockno_t f_extindex;             /* extent index block */
+            struct Extent f_extents[NEXTENT]; /* first extents */
+        };
+    };
+
+    uint32_t f_flags; /* FILE_* flags */
+
+    /* Directories with FILE_DIRHASH */
+    blockno_t f_dirhash; /* directory index block */
+    uint32_t f_dirfree;  /* no free entries before this one */
 
     /* Pad out to 256 bytes; must do arithmetic in case we're compiling
      * fsformat on a 64-bit machine. */
-    uint8_t f_pad[256 - MAXNAMELEN - 8 - 4 * NDIRECT - 4];
+    uint8_t f_pad[256 - MAXNAMELEN - 8 - 8 - 12 * NEXTENT - 4 - 8];
 } __attribute__((packed)); /* required only on some 64-bit machines */
 
 /* An inode block contains exactly BLKFILES 'struct File's */
@@ -54,6 +90,38 @@ struct File {
 #define FTYPE_REG 0 /* Regular file */
 #define FTYPE_DIR 1 /* Directory */
 
+/* File flags */
+#define FILE_EXTENTS 0x1 /* Blocks are mapped with extents */
+#define FILE_DIRHASH 0x2 /* Directory has a hashed name index */
+
+/* Hashed directory index.
+ * Index block of a FILE_DIRHASH directory holds NDIRBUCKET
+ * bucket block numbers (0 if bucket is empty); name hash picks
+ * the bucket and the bucket lists (hash, entry number) pairs
+ * of directory entries in it.  Directory blocks themselves
+ * are the same array of struct File as in linear directories. */
+#define NDIRBUCKET (BLKSIZE / sizeof(blockno_t))
+
+struct DirHashEntry {
+    uint32_t dh_hash; /* dir_name_hash() of the name */
+    uint32_t dh_slot; /* entry number in the directory */
+};
+
+struct DirHashBucket {
+    uint32_t db_count; /* used entries */
+    uint32_t db_pad;
+    struct DirHashEntry db_ents[(BLKSIZE - 8) / sizeof(struct DirHashEntry)];
+};
+
+/* FNV-1a hash of a file name */
+static inline uint32_t
+dir_name_hash(const char *name) {
+    uint32_t hash = 2166136261U;
+    while (*name)
+        hash = (hash ^ (uint8_t)*name++) * 16777619U;
+    return hash;
+}
+
 /* File system super-block (both in-memory and on-disk) */
 
 #define FS_MAGIC 0x4A0530AE /* related vaguely to 'J\0S!' */
@@ -62,20 +130,109 @@ struct Super {
     uint32_t s_magic;    /* Magic number: FS_MAGIC */
     blockno_t s_nblocks; /* Total number of blocks on disk */
     struct File s_root;  /* Root directory node */
+    uint32_t s_features; /* FS_FEATURE_* flags */
+
+    /* Metadata log, with FS_FEATURE_LOG */
+    blockno_t s_log_start;   /* First block of the log region */
+    uint32_t s_log_nblocks;  /* Size of the log region in blocks */
+    uint32_t s_log_seq;      /* Sequence number of the first valid record */
+};
+
+/* Superblock features */
+#define FS_FEATURE_EXTENTS 0x1 /* New files are extent files */
+#define FS_FEATURE_LOG     0x2 /* Metadata updates go through the log */
+
+/* Metadata log record: a header block followed by lh_count
+ * block images to be copied to lh_blocks[] home locations.
+ * Records are appended one after another starting at s_log_start
+ * with sequence numbers increasing by one from s_log_seq.
+ * A record is valid only if its checksum matches, so it can be
+ * written with a single (not atomic) sequential write.
+ * Larger transactions take several records, all but the last one
+ * have LOG_CONTINUED set.  Records of a transaction are replayed
+ * only if all of them are valid. */
+#define LOG_MAGIC 0x4A4C4F47 /* 'JLOG' */
+
+#define LOG_CONTINUED 0x1 /* Transaction goes on in the next record */
+
+struct LogHeader {
+    uint32_t lh_magic;    /* LOG_MAGIC */
+    uint32_t lh_seq;      /* Record sequence number */
+    uint32_t lh_count;    /* Number of block images */
+    uint32_t lh_checksum; /* log_checksum() of the images */
+    uint32_t lh_flags;    /* LOG_CONTINUED */
+    blockno_t lh_blocks[(BLKSIZE - 20) / sizeof(blockno_t)];
 };
 
-/* Definitions for requests from clients to file system */
+/* Definitions for requests from clients to file system.
+ *
+ * Fixed-size requests and replies are passed as IPC words
+ * with ipc_send_words(), so they don't map the request page:
+ *   FSREQ_SET_SIZE  fileid, size   -> result
+ *   FSREQ_STAT      fileid         -> result; size, isdir
+ *   FSREQ_FLUSH     fileid         -> result
+ *   FSREQ_SYNC                     -> result
+ *   FSREQ_CACHE_STAT               -> budget; hits, misses, evictions, resident
+ *   FSREQ_CACHE_BUDGET budget      -> new budget
+ *   FSREQ_DENTRY_STAT              -> 0; hits, negative hits, misses, flushes
+ *   FSREQ_READ_MAP  fileid, n      -> bytes mapped copy-on-write at the
+ *                                     receive address, up to n whole blocks
+ *   FSREQ_NVME_BENCH depth|flags, iosize -> result; nsec, bytes, doorbells
+ * Other requests pass union Fsipc on the request page. */
 enum {
     FSREQ_OPEN = 1,
     FSREQ_SET_SIZE,
     /* Read returns a Fsret_read on the request page */
     FSREQ_READ,
     FSREQ_WRITE,
-    /* Stat returns a Fsret_stat on the request page */
+    /* File name is kept in Fd page, see struct FdFile */
     FSREQ_STAT,
     FSREQ_FLUSH,
     FSREQ_REMOVE,
-    FSREQ_SYNC
+    FSREQ_SYNC,
+    /* Returns struct FsRing shared with the server */
+    FSREQ_RING_SETUP,
+    /* Block cache counters */
+    FSREQ_CACHE_STAT,
+    /* Replace block cache budget (in blocks), only allowed
+     * for environments started by the kernel */
+    FSREQ_CACHE_BUDGET,
+    /* Dentry cache counters */
+    FSREQ_DENTRY_STAT,
+    /* Block-aligned read that maps cached blocks instead of copying */
+    FSREQ_READ_MAP,
+    /* Raw NVMe throughput with depth commands of iosize bytes in flight,
+     * only allowed for environments started by the kernel */
+    FSREQ_NVME_BENCH
+};
+
+/* FSREQ_NVME_BENCH flag: write zeroes to the metadata log region
+ * instead of reading the whole disk, only done while the log
+ * is idle (right after sync()) */
+#define FSBENCH_WRITE 0x40000000
+
+struct FsCacheStat {
+    uint64_t cs_hits;
+    uint64_t cs_misses;
+    uint64_t cs_evictions;
+    uint64_t cs_resident;
+    uint64_t cs_budget;
+};
+
+struct FsDentryStat {
+    uint64_t ds_hits;     /* Lookups answered from the cache */
+    uint64_t ds_neg_hits; /* Hits telling the name is missing */
+    uint64_t ds_misses;   /* Lookups that searched the directory */
+    uint64_t ds_flushes;  /* Whole cache invalidations */
+};
+
+struct FsBench {
+    uint32_t fb_depth;     /* Commands kept in flight */
+    uint32_t fb_iosize;    /* Bytes per command */
+    bool fb_write;         /* See FSBENCH_WRITE */
+    uint64_t fb_nsec;      /* Time taken */
+    uint64_t fb_bytes;     /* Bytes transferred */
+    uint64_t fb_doorbells; /* NVMe doorbell writes */
 };
 
 union Fsipc {
@@ -83,10 +240,6 @@ union Fsipc {
         char req_path[MAXPATHLEN];
         int req_omode;
     } open;
-    struct Fsreq_set_size {
-        int req_fileid;
-        off_t req_size;
-    } set_size;
     struct Fsreq_read {
         int req_fileid;
         size_t req_n;
@@ -99,17 +252,6 @@ union Fsipc {
         size_t req_n;
         char req_buf[PAGE_SIZE - (2 * sizeof(size_t))];
     } write;
-    struct Fsreq_stat {
-        int req_fileid;
-    } stat;
-    struct Fsret_stat {
-        char ret_name[MAXNAMELEN];
-        off_t ret_size;
-        int ret_isdir;
-    } statRet;
-    struct Fsreq_flush {
-        int req_fileid;
-    } flush;
     struct Fsreq_remove {
         char req_path[MAXPATHLEN];
     } remove;
@@ -118,4 +260,47 @@ union Fsipc {
     char _pad[PAGE_SIZE];
 };
 
+/* Request ring shared between a client and the file server.
+ *
+ * Client gets it with FSREQ_RING_SETUP and then queues FSREQ_READ,
+ * FSREQ_WRITE and fixed-size requests into fr_ent without any page
+ * mapping.  Entry i uses data slot fr_data[i % FSRING_SIZE] for read
+ * and write payload.  Server executes entries in order, storing
+ * result (and reply words of fixed-size requests) into the entry
+ * and advancing fr_head.
+ *
+ * Server polls rings while they have work.  Before going to sleep
+ * it sets fr_sleeping, and client that sees it set after advancing
+ * fr_tail wakes the server up with sys_ipc_notify().  In the other
+ * direction, client waiting for its entries sets fr_waiting and sleeps
+ * until the server takes the flag after advancing fr_head and notifies
+ * it with FSRING_NOTIFY. */
+
+#define FSRING_SIZE 8
+
+/* Notification bit for client waiting in its ring */
+#define FSRING_NOTIFY (1ULL << 63)
+
+/* Entry flags */
+#define FSRING_LINK 0x1 /* Cancel if previous entry failed or was short */
+
+struct FsRingEntry {
+    uint32_t re_type;     /* FSREQ_* */
+    uint32_t re_flags;    /* FSRING_* flags */
+    int32_t re_fileid;    /* Open file id */
+    uint32_t re_padding;
+    uint64_t re_arg;      /* Byte count or new size */
+    int64_t re_res;       /* Result */
+    uint64_t re_words[4]; /* Reply words */
+};
+
+struct FsRing {
+    volatile uint32_t fr_tail;     /* Next entry to queue, advanced by client */
+    volatile uint32_t fr_head;     /* Next entry to execute, advanced by server */
+    volatile uint32_t fr_sleeping; /* Server waits for notification */
+    volatile uint32_t fr_waiting;  /* Client waits for notification */
+    struct FsRingEntry fr_ent[FSRING_SIZE];
+    char fr_data[FSRING_SIZE][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+};
+
 #endif /* !JOS_INC_FS_H */
@@ -0,0 +1,55 @@
+#ifndef JOS_INC_IPC_H
+#define JOS_INC_IPC_H
+
+#include <inc/types.h>
+
+/* Queued IPC endpoints.
+ *
+ * An environment that called sys_ipc_endpoint() gets a kernel
+ * managed queue of IPC_QUEUE_LEN messages.  sys_ipc_queue_send()
+ * never blocks: it fails with -E_IPC_QUEUE_FULL if the queue is full.
+ * sys_ipc_queue_recv() takes up to N messages at once.
+ *
+ * If the endpoint has page slots, message i carries its region
+ * at slots + (i % IPC_QUEUE_LEN) * maxsz, so the region is only
+ * guaranteed to stay there until IPC_QUEUE_LEN more messages
+ * are queued.
+ *
+ * sys_ipc_notify() ORs bits into the notification mask of the
+ * receiver without using a queue slot; the receiver collects
+ * and clears the mask with sys_ipc_queue_recv().  Every environment
+ * has a mask, so an endpoint is only needed for queued messages.
+ * Pending or new notification also interrupts sys_ipc_recv()
+ * of the receiver with -E_IPC_NOTIFIED, so it can wait for both
+ * kinds of messages.
+ *
+ * sys_ipc_timer() makes the kernel notify the endpoint owner with
+ * given bits every period milliseconds (rounded up to the timer tick),
+ * at most IPC_NTIMERS environments can have a timer at once.
+ * Period can't be longer than IPC_TIMER_MAX_MS. */
+
+#define IPC_QUEUE_LEN    16
+#define IPC_NTIMERS      8
+#define IPC_TIMER_MAX_MS (24 * 60 * 60 * 1000ULL)
+
+/* Number of 64-bit words carried by sys_ipc_send_words().
+ * Words travel in system call argument registers and are
+ * stored in receiver's env_ipc_words, so nothing gets mapped. */
+#define IPC_NWORDS 4
+
+/* Permission flag for sys_ipc_try_send() and sys_ipc_queue_send():
+ * move the region to the receiver instead of sharing it.  Sender
+ * loses the part that was received; receiver sees the flag in
+ * env_ipc_perm (msg_perm). */
+#define IPC_DONATE 0x800000
+
+struct IpcMsg {
+    int32_t msg_from;   /* envid of the sender */
+    uint32_t msg_value; /* Data value */
+    int msg_perm;       /* Perm of received region, 0 if none */
+    uint32_t msg_size;  /* Size of received region */
+    uintptr_t msg_va;   /* Address of received region */
+    uint64_t msg_padding;
+};
+
+#endif /* !JOS_INC_IPC_H */
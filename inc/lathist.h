@@ -0,0 +1,33 @@
+#ifndef JOS_INC_LATHIST_H
+#define JOS_INC_LATHIST_H
+
+#include <inc/types.h>
+
+/* Kernel latency histograms, mapped read-only at ULATHIST.
+ *
+ * Every system call (counted between entry and exit of syscall())
+ * and every trap from user mode (from trap() entry until return
+ * to user mode) adds one to the bucket of its TSC cycle count:
+ * bucket i counts latencies in [2^i, 2^(i+1)) cycles.
+ * Calls that never return to the caller (like sys_yield())
+ * are not counted.  sys_lathist_reset() zeroes all counters. */
+
+#define LATHIST_NBUCKETS  32
+#define LATHIST_NSYSCALLS 32
+#define LATHIST_NTRAPS    64 /* Traps with larger numbers go to the last row */
+
+struct LatHistPage {
+    uint64_t lh_reset_tsc; /* TSC at the last reset */
+    uint32_t lh_resets;    /* Number of resets */
+    uint32_t lh_padding;
+    uint32_t lh_syscall[LATHIST_NSYSCALLS][LATHIST_NBUCKETS];
+    uint32_t lh_trap[LATHIST_NTRAPS][LATHIST_NBUCKETS];
+};
+
+static inline unsigned
+lathist_bucket(uint64_t cycles) {
+    unsigned bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    return bucket < LATHIST_NBUCKETS ? bucket : LATHIST_NBUCKETS - 1;
+}
+
+#endif /* !JOS_INC_LATHIST_H */
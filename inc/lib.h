@@ -17,6 +17,11 @@
 #include <inc/memlayout.h>
 #include <inc/syscall.h>
 #include <inc/vsyscall.h>
+#include <inc/lathist.h>
+#include <inc/time.h>
+#include <inc/sysring.h>
+#include <inc/mapvec.h>
+#include <inc/ipc.h>
 #include <inc/trap.h>
 #include <inc/fs.h>
 #include <inc/fd.h>
@@ -38,7 +43,8 @@ void umain(int argc, char **argv);
 
 /* libmain.c or entry.S */
 extern const char *binaryname;
-extern const volatile int vsys[];
+extern const volatile struct VsysPage vsys;
+extern const volatile struct LatHistPage lathist;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 
@@ -87,17 +93,33 @@ static envid_t sys_exofork(void);
 int sys_env_set_status(envid_t env, int status);
 int sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
 int sys_env_set_pgfault_upcall(envid_t env, void *upcall);
+int sys_env_set_reclaimable(envid_t env, bool on);
 int sys_alloc_region(envid_t env, void *pg, size_t size, int perm);
 int sys_map_region(envid_t src_env, void *src_pg,
                    envid_t dst_env, void *dst_pg, size_t size, int perm);
 int sys_map_physical_region(uintptr_t pa, envid_t dst_env,
                             void *dst_pg, size_t size, int perm);
 int sys_unmap_region(envid_t env, void *pg, size_t size);
+int sys_map_regionv(envid_t src_env, envid_t dst_env, const struct MapVec *vec, size_t n);
+int sys_unmap_regionv(envid_t env, const struct MapVec *vec, size_t n);
 int sys_ipc_try_send(envid_t to_env, uint64_t value, void *pg, size_t size, int perm);
+int sys_ipc_send_words(envid_t to_env, uint32_t value, const uint64_t *words);
 int sys_ipc_recv(void *rcv_pg, size_t size);
 int sys_gettime(void);
-
+int sys_lathist_reset(void);
+int sys_ring_setup(void *va);
+int sys_ring_enter(size_t to_submit);
+int sys_ipc_endpoint(void *slots, size_t maxsz);
+int sys_ipc_queue_send(envid_t to_env, uint32_t value, void *pg, size_t size, int perm);
+int sys_ipc_queue_recv(struct IpcMsg *msgs, size_t n, uint64_t *notify, bool block);
+int sys_ipc_notify(envid_t to_env, uint64_t bits);
+int sys_ipc_timer(uint64_t bits, uint64_t period_ms);
+
+/* vsyscall.c */
 int vsys_gettime(void);
+int clock_gettime(int clock, struct timespec *ts);
+envid_t vsys_getenvid(void);
+uint64_t vsys_ticks(void);
 
 /* This must be inlined. Exercise for reader: why? */
 static inline envid_t __attribute__((always_inline))
@@ -111,8 +133,10 @@ sys_exofork(void) {
 
 /* ipc.c */
 void ipc_send(envid_t to_env, uint32_t value, void *pg, size_t size, int perm);
+void ipc_send_words(envid_t to_env, uint32_t value, const uint64_t *words);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, size_t *psize, int *perm_store);
 envid_t ipc_find_env(enum EnvType type);
+int ipc_queue_recv(struct IpcMsg *msgs, size_t n, uint64_t *notify);
 
 /* fork.c */
 envid_t fork(void);
@@ -142,6 +166,10 @@ int open(const char *path, int mode);
 int ftruncate(int fd, off_t size);
 int remove(const char *path);
 int sync(void);
+int fs_cache_stat(struct FsCacheStat *stat);
+int fs_cache_budget(size_t budget);
+int fs_dentry_stat(struct FsDentryStat *stat);
+int fs_nvme_bench(struct FsBench *bench);
 
 /* spawn.c */
 envid_t spawn(const char *program, const char **argv);
@@ -160,6 +188,20 @@ int pipeisclosed(int pipefd);
 /* wait.c */
 void wait(envid_t env);
 
+/* sysring.c */
+int sysring_alloc_region(envid_t env, void *pg, size_t size, int perm, int flags);
+int sysring_map_region(envid_t src_env, void *src_pg, envid_t dst_env,
+                       void *dst_pg, size_t size, int perm, int flags);
+int sysring_unmap_region(envid_t env, void *pg, size_t size, int flags);
+int sysring_ipc_try_send(envid_t to_env, uint64_t value, void *pg,
+                         size_t size, int perm, int flags);
+int sysring_run(void);
+
+/* mapvec.c */
+void mapvec_init(struct MapVecBatch *batch, envid_t src_env, envid_t dst_env, bool unmap);
+int mapvec_add(struct MapVecBatch *batch, void *src_pg, void *dst_pg, size_t size, int perm);
+int mapvec_flush(struct MapVecBatch *batch);
+
 /* File open modes */
 #define O_RDONLY  0x0000 /* open for reading only */
 #define O_WRONLY  0x0001 /* open for writing only */
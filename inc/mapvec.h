@@ -0,0 +1,36 @@
+#ifndef JOS_INC_MAPVEC_H
+#define JOS_INC_MAPVEC_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+/* Descriptors for vectored memory system calls.
+ *
+ * sys_map_regionv() maps every [mv_srcva, mv_srcva + mv_size)
+ * of the source environment at mv_dstva of the destination
+ * with mv_perm, sys_unmap_regionv() unmaps [mv_dstva, mv_dstva + mv_size)
+ * (mv_srcva and mv_perm are ignored).  All descriptors are
+ * checked before anything is changed and TLB is invalidated
+ * once for the whole batch. */
+
+#define MAPVEC_MAX 32 /* Maximal number of descriptors per call */
+
+struct MapVec {
+    uintptr_t mv_srcva;
+    uintptr_t mv_dstva;
+    size_t mv_size;
+    int mv_perm;
+    uint32_t mv_padding;
+};
+
+/* User side batch collecting descriptors for one of the calls
+ * (see lib/mapvec.c) */
+struct MapVecBatch {
+    envid_t mb_srcenv;
+    envid_t mb_dstenv;
+    bool mb_unmap;
+    size_t mb_count;
+    struct MapVec mb_vec[MAPVEC_MAX];
+};
+
+#endif /* !JOS_INC_MAPVEC_H */
@@ -19,7 +19,8 @@
 #define GD_KD32 0x20 /* kernel data 32bit */
 #define GD_UT   0x28 /* user text */
 #define GD_UD   0x30 /* user data */
-#define GD_TSS0 0x38 /* Task segment selector for CPU 0 */
+#define GD_UTS  0x38 /* user text loaded by SYSRET (execute only) */
+#define GD_TSS0 0x40 /* Task segment selector for CPU 0 */
 
 /*
  * Virtual memory map:                                Permissions
@@ -58,7 +59,11 @@
  *                     .                              .        400 * HUGE_PAGE_SIZE
  *                     .                              .
  *                     |                              |
- * UENVS ----------->  +------------------------------+ 0x8000da0000
+ * UENVS ----------->  +------------------------------+ 0x801fc00000
+ *                     |     Virtual Syscall Page     | R-/R-  PAGE_SIZE
+ * UVSYS ----------->  +------------------------------+ 0x801fbff000
+ *                     |  Kernel Latency Histograms   | R-/R-  4 * PAGE_SIZE
+ * ULATHIST -------->  +------------------------------+ 0x801fbfb000
  *                     |                              |
  *                     |                              |
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -150,6 +155,10 @@
 #define UVSYS_SIZE PAGE_SIZE
 #define UVSYS      (UENVS - UVSYS_SIZE)
 
+/* Kernel latency histograms (see inc/lathist.h) */
+#define ULATHIST_SIZE (4 * PAGE_SIZE)
+#define ULATHIST      (UVSYS - ULATHIST_SIZE)
+
 /*
  * Top of user VM. User can manipulate VA from MAX_USER_ADDRESS-1 and down!
  */
@@ -20,6 +20,18 @@ enum {
     SYS_ipc_try_send,
     SYS_ipc_recv,
     SYS_gettime,
+    SYS_env_set_reclaimable,
+    SYS_ring_setup,
+    SYS_ring_enter,
+    SYS_ipc_endpoint,
+    SYS_ipc_queue_send,
+    SYS_ipc_queue_recv,
+    SYS_ipc_notify,
+    SYS_ipc_send_words,
+    SYS_lathist_reset,
+    SYS_map_regionv,
+    SYS_unmap_regionv,
+    SYS_ipc_timer,
     NSYSCALLS
 };
 
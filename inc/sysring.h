@@ -0,0 +1,45 @@
+#ifndef JOS_INC_SYSRING_H
+#define JOS_INC_SYSRING_H
+
+#include <inc/types.h>
+
+/* System call submission ring.
+ *
+ * An environment registers one page containing struct SysRing
+ * with sys_ring_setup() and fills submission entries (SQE)
+ * with system call numbers and arguments.  sys_ring_enter()
+ * executes queued calls in order and stores results
+ * as completion entries (CQE), so a batch of calls
+ * costs a single kernel entry.
+ *
+ * All indices are free running and are taken modulo SYSRING_SIZE.
+ * User advances sq_tail and cq_head, kernel advances sq_head and cq_tail. */
+
+#define SYSRING_SIZE 32
+
+/* SQE flags */
+#define SQE_LINK 0x1 /* Cancel next entry if this one fails */
+
+struct SysRingSqe {
+    uint32_t sqe_op;      /* SYS_* number */
+    uint32_t sqe_flags;   /* SQE_* flags */
+    uint64_t sqe_args[6]; /* System call arguments */
+    uint64_t sqe_data;    /* Opaque value copied to completion */
+};
+
+struct SysRingCqe {
+    int64_t cqe_res;   /* System call result */
+    uint64_t cqe_data; /* sqe_data of the completed entry */
+};
+
+struct SysRing {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint8_t sr_padding[48];
+    struct SysRingSqe sq[SYSRING_SIZE];
+    struct SysRingCqe cq[SYSRING_SIZE];
+};
+
+#endif /* !JOS_INC_SYSRING_H */
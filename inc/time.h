@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/assert.h>
 
@@ -14,6 +15,15 @@ struct tm {
     int tm_year; /* Year - 1900.  */
 };
 
+/* Clocks for clock_gettime() */
+#define CLOCK_REALTIME  0 /* Wall clock time */
+#define CLOCK_MONOTONIC 1 /* Time since boot */
+
+struct timespec {
+    int64_t tv_sec;  /* Seconds */
+    int64_t tv_nsec; /* Nanoseconds [0, 1e9) */
+};
+
 #define MINUTE       (60)
 #define HOUR         (60 * 60)
 #define DAY          (24 * 60 * 60)
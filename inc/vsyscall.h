@@ -1,10 +1,52 @@
 #ifndef JOS_INC_VSYSCALL_H
 #define JOS_INC_VSYSCALL_H
 
-/* system call numbers */
-enum {
-    VSYS_gettime,
-    NVSYSCALLS
+#include <inc/types.h>
+
+/* Layout of the read-only page mapped at UVSYS in every environment.
+ *
+ * Kernel updates it under a sequence lock: vs_seq is odd while an
+ * update is in progress.  Readers must retry until they observe the
+ * same even vs_seq before and after reading the fields they need
+ * (see vsys_read_begin()/vsys_read_retry()).
+ *
+ * Time since boot in nanoseconds is
+ *   vs_mono_base + vsys_tsc2ns(read_tsc() - vs_tsc_base, vs_tsc_freq)
+ * and Unix time is that plus vs_wall_offset. */
+
+#define VSYS_VERSION 2
+
+#define NSEC_PER_SEC 1000000000ULL
+
+struct VsysPage {
+    volatile uint32_t vs_seq;     /* Sequence lock counter */
+    uint32_t vs_version;          /* Layout version, VSYS_VERSION */
+    uint64_t vs_tsc_freq;         /* TSC ticks per second */
+    uint64_t vs_tsc_base;         /* TSC value at last update */
+    uint64_t vs_mono_base;        /* Time since boot in ns at vs_tsc_base */
+    uint64_t vs_wall_offset;      /* Unix time in ns at boot */
+    uint64_t vs_ticks;            /* Timer interrupts since boot */
+    volatile int32_t vs_curenv;   /* Currently running environment */
 };
 
+/* Convert TSC ticks to nanoseconds without overflowing */
+static inline uint64_t
+vsys_tsc2ns(uint64_t delta, uint64_t freq) {
+    return delta / freq * NSEC_PER_SEC + delta % freq * NSEC_PER_SEC / freq;
+}
+
+static inline uint32_t
+vsys_read_begin(const volatile struct VsysPage *page) {
+    uint32_t seq;
+    while ((seq = page->vs_seq) & 1) asm volatile("pause");
+    asm volatile("" ::: "memory");
+    return seq;
+}
+
+static inline bool
+vsys_read_retry(const volatile struct VsysPage *page, uint32_t seq) {
+    asm volatile("" ::: "memory");
+    return page->vs_seq != seq;
+}
+
 #endif /* !JOS_INC_VSYSCALL_H */
@@ -10,6 +10,8 @@
 #include <inc/dwarf.h>
 
 #include <kern/env.h>
+#include <kern/ipc.h>
+#include <kern/lathist.h>
 #include <kern/kdebug.h>
 #include <kern/macro.h>
 #include <kern/monitor.h>
@@ -34,7 +36,6 @@ struct Env *envs = NULL;
 #endif
 
 /* Virtual syscall page address */
-volatile int *vsys;
 
 /* Free environment list
  * (linked by Env->env_link) */
@@ -99,14 +100,14 @@ env_init(void) {
      * Don't forget about rounding.
      * kzalloc_region only works with current_space != NULL */
     // LAB 12: Your code here
-    size_t uvsys_size = ROUNDUP(sizeof(int) * NVSYSCALLS, PAGE_SIZE);
-    vsys = (volatile int *)kzalloc_region(uvsys_size);
+    size_t uvsys_size = ROUNDUP(sizeof(struct VsysPage), PAGE_SIZE);
+    vsys = (volatile struct VsysPage *)kzalloc_region(uvsys_size);
     assert(vsys != NULL);
 
     int res;
     if ((res = map_region(current_space, UVSYS, &kspace, (uintptr_t) vsys, uvsys_size, PROT_R | PROT_USER_ | PROT_SHARE)) < 0) 
         panic("env_init - map_region: %i\n", res);
-        
+
     /* Allocate envs array with kzalloc_region().
      * Don't forget about rounding.
      * kzalloc_region() only works with current_space != NULL */
@@ -114,6 +115,7 @@ env_init(void) {
     size_t envs_size = ROUNDUP(sizeof(struct Env) * NENV, PAGE_SIZE);
     envs = (struct Env *)kzalloc_region(envs_size);
     memset(envs, 0, sizeof(*envs) * NENV);
+    ipc_init();
 
     /* Map envs to UENVS read-only,
      * but user-accessible (with PROT_USER_ set) */
@@ -212,6 +214,17 @@ env_alloc(struct Env **newenv_store, envid_t parent_id, enum EnvType type) {
     /* Also clear the IPC receiving flag. */
     env->env_ipc_recving = 0;
 
+    env->env_mem_reclaimable = 0;
+    env->env_mem_notify = MEM_NOTIFY_NONE;
+    env->env_mem_waiting = 0;
+    env->env_mem_retried = 0;
+
+    /* Child has to register its own system call ring */
+    env->env_ring = 0;
+
+    /* ...and IPC endpoint */
+    ipc_queue_reset(env);
+
     /* Commit the allocation */
     env_free_list = env->env_link;
     *newenv_store = env;
@@ -461,6 +474,126 @@ env_create(uint8_t *binary, size_t size, enum EnvType type) {
 }
 
 
+/*
+ * Memory pressure notification.
+ *
+ * When free memory drops below MEM_LOW_WATERMARK environments
+ * registered with sys_env_set_reclaimable() receive an IPC message
+ * from envid 0 carrying the number of pages kernel wants back.
+ * Reclaimer acknowledges by calling sys_ipc_recv() again.
+ * Environments page faulting without memory meanwhile sleep until
+ * every reclaimer is done (or MEM_PRESSURE_TIMEOUT ticks pass)
+ * and retry the access once before being destroyed.
+ */
+static size_t mem_reclaim_busy;
+static uint32_t mem_pressure_want;
+static unsigned mem_pressure_ticks;
+
+static void
+mem_notify_deliver(struct Env *env) {
+    env->env_mem_notify = MEM_NOTIFY_SENT;
+    env->env_ipc_recving = 0;
+    env->env_ipc_value = mem_pressure_want;
+    env->env_ipc_from = 0;
+    env->env_ipc_perm = 0;
+    env->env_ipc_maxsz = 0;
+}
+
+static void
+mem_pressure_wake(void) {
+    for (size_t i = 0; i < NENV; i++) {
+        if (!envs[i].env_mem_waiting) continue;
+        envs[i].env_mem_waiting = 0;
+        envs[i].env_mem_retried = 1;
+        if (envs[i].env_status == ENV_NOT_RUNNABLE)
+            envs[i].env_status = ENV_RUNNABLE;
+    }
+}
+
+static void
+mem_pressure_done(struct Env *env) {
+    env->env_mem_notify = MEM_NOTIFY_NONE;
+    if (!--mem_reclaim_busy) mem_pressure_wake();
+}
+
+/* Ask reclaimable envs to shrink if free memory is low
+ * (or unconditionally if force is set) */
+void
+mem_pressure_notify(bool force) {
+    if (mem_reclaim_busy) return;
+
+    size_t nfree = free_memory_pages();
+    if (nfree >= MEM_LOW_WATERMARK && !force) return;
+
+    mem_pressure_want = MEM_HIGH_WATERMARK > nfree ? MEM_HIGH_WATERMARK - nfree : 1;
+    mem_pressure_ticks = 0;
+
+    for (size_t i = 0; i < NENV; i++) {
+        struct Env *env = &envs[i];
+        if (env->env_status == ENV_FREE || !env->env_mem_reclaimable) continue;
+
+        mem_reclaim_busy++;
+        if (env->env_ipc_recving) {
+            mem_notify_deliver(env);
+            env->env_status = ENV_RUNNABLE;
+        } else {
+            env->env_mem_notify = MEM_NOTIFY_PENDING;
+        }
+    }
+
+    if (trace_envs && mem_reclaim_busy)
+        cprintf("Memory pressure: %zu pages free, asking %zu envs for %u pages\n",
+                nfree, mem_reclaim_busy, mem_pressure_want);
+}
+
+/* Called on every timer tick */
+void
+mem_pressure_tick(void) {
+    if (!mem_reclaim_busy) {
+        mem_pressure_notify(0);
+        return;
+    }
+
+    if (++mem_pressure_ticks < MEM_PRESSURE_TIMEOUT) return;
+
+    /* Stop waiting for reclaimers that did not respond */
+    for (size_t i = 0; i < NENV; i++)
+        envs[i].env_mem_notify = MEM_NOTIFY_NONE;
+    mem_reclaim_busy = 0;
+    mem_pressure_wake();
+}
+
+/* Put env that could not get memory to sleep until reclaim is done.
+ * Returns false if waiting makes no sense and env should be destroyed */
+bool
+mem_pressure_wait(struct Env *env) {
+    if (env->env_mem_retried || env->env_mem_reclaimable) {
+        env->env_mem_retried = 0;
+        return 0;
+    }
+
+    mem_pressure_notify(1);
+    if (!mem_reclaim_busy) return 0;
+
+    env->env_mem_waiting = 1;
+    env->env_status = ENV_NOT_RUNNABLE;
+    return 1;
+}
+
+/* Handle memory pressure part of sys_ipc_recv().
+ * Returns true if notification was delivered instead of blocking */
+bool
+mem_pressure_recv(struct Env *env) {
+    /* Reclaimer asking for next message has finished shrinking */
+    if (env->env_mem_notify == MEM_NOTIFY_SENT)
+        mem_pressure_done(env);
+
+    if (env->env_mem_notify != MEM_NOTIFY_PENDING) return 0;
+
+    mem_notify_deliver(env);
+    return 1;
+}
+
 /* Frees env and all memory it uses */
 void
 env_free(struct Env *env) {
@@ -476,9 +609,15 @@ env_free(struct Env *env) {
         switch_address_space(&kspace);
 
     static_assert(MAX_USER_ADDRESS % HUGE_PAGE_SIZE == 0, "Misaligned MAX_USER_ADDRESS");
+    /* Memory is returned lazily by reclaim_address_spaces() */
     release_address_space(&env->address_space);
 #endif
 
+    /* Don't wait for reclaimer that is gone */
+    if (env->env_mem_notify != MEM_NOTIFY_NONE)
+        mem_pressure_done(env);
+    env->env_mem_waiting = 0;
+
     /* Return the environment to the free list */
     env->env_status = ENV_FREE;
     env->env_link = env_free_list;
@@ -537,6 +676,8 @@ csys_yield(struct Trapframe *tf) {
 
 _Noreturn void
 env_pop_tf(struct Trapframe *tf) {
+    lathist_trap_exit();
+
     asm volatile(
             "movq %0, %%rsp\n"
             "movq 0(%%rsp), %%r15\n"
@@ -564,6 +705,37 @@ env_pop_tf(struct Trapframe *tf) {
     panic("Reached unrecheble\n");
 }
 
+/* Faster variant of env_pop_tf() for returning from SYSCALL.
+ * SYSRET takes RIP from RCX and RFLAGS from R11, so the values
+ * saved in these registers are lost, and loads fixed user CS/SS
+ * from STAR_MSR.  Caller must ensure that RIP is canonical. */
+_Noreturn void
+env_sysret_tf(struct Trapframe *tf) {
+    asm volatile(
+            "movq %0, %%rsp\n"
+            "movq 0(%%rsp), %%r15\n"
+            "movq 8(%%rsp), %%r14\n"
+            "movq 16(%%rsp), %%r13\n"
+            "movq 24(%%rsp), %%r12\n"
+            "movq 40(%%rsp), %%r10\n"
+            "movq 48(%%rsp), %%r9\n"
+            "movq 56(%%rsp), %%r8\n"
+            "movq 64(%%rsp), %%rsi\n"
+            "movq 72(%%rsp), %%rdi\n"
+            "movq 80(%%rsp), %%rbp\n"
+            "movq 88(%%rsp), %%rdx\n"
+            "movq 104(%%rsp), %%rbx\n"
+            "movq 112(%%rsp), %%rax\n"
+            "movq 152(%%rsp), %%rcx\n" /* tf_rip */
+            "movq 168(%%rsp), %%r11\n" /* tf_rflags */
+            "movq 176(%%rsp), %%rsp\n" /* tf_rsp */
+            "sysretq" ::"g"(tf)
+            : "memory");
+
+    /* Mostly to placate the compiler */
+    panic("Reached unrecheble\n");
+}
+
 /* Context switch from curenv to env.
  * This function does not return.
  *
@@ -603,6 +775,7 @@ env_run(struct Env *env) {
         }
         curenv = env;
         curenv->env_status = ENV_RUNNING;
+        vsys->vs_curenv = env->env_id;
         ++curenv->env_runs;
         switch_address_space(&curenv->address_space);
     }
@@ -20,8 +20,25 @@ void env_create(uint8_t *binary, size_t size, enum EnvType type);
 void env_destroy(struct Env *env);
 
 int envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+
+/* Memory pressure watermarks (in pages) */
+#define MEM_LOW_WATERMARK   2048
+#define MEM_HIGH_WATERMARK  4096
+/* Ticks to wait for reclaimers before giving up */
+#define MEM_PRESSURE_TIMEOUT 4
+
+/* env_mem_notify states */
+#define MEM_NOTIFY_NONE    0
+#define MEM_NOTIFY_PENDING 1 /* Delivered on next sys_ipc_recv() */
+#define MEM_NOTIFY_SENT    2 /* Env is reclaiming */
+
+void mem_pressure_notify(bool force);
+void mem_pressure_tick(void);
+bool mem_pressure_wait(struct Env *env);
+bool mem_pressure_recv(struct Env *env);
 _Noreturn void env_run(struct Env *e);
 _Noreturn void env_pop_tf(struct Trapframe *tf);
+_Noreturn void env_sysret_tf(struct Trapframe *tf);
 
 #ifdef CONFIG_KSPACE
 extern void sys_exit(void);
@@ -16,6 +16,8 @@
 #include <kern/sched.h>
 #include <kern/picirq.h>
 #include <kern/kclock.h>
+#include <kern/timekeep.h>
+#include <kern/lathist.h>
 #include <kern/kdebug.h>
 #include <kern/traceopt.h>
 
@@ -154,6 +156,10 @@ i386_init(void) {
     /* User environment initialization functions */
     env_init();
 
+    /* Read RTC once and start keeping time (needs UVSYS page) */
+    timekeep_init();
+    lathist_init();
+
     /* Choose the timer used for scheduling: hpet or pit */
     timers_schedule("hpet0");
 #ifdef CONFIG_KSPACE
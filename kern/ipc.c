@@ -0,0 +1,205 @@
+/* Queued IPC endpoints, see inc/ipc.h */
+
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/ipc.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/timekeep.h>
+
+static struct IpcQueue *ipc_queues;
+
+/* Environments with periodic notifications, entries
+ * of dead environments are dropped lazily */
+static envid_t ipc_timers[IPC_NTIMERS];
+
+#define QUEUE(env) (&ipc_queues[ENVX((env)->env_id)])
+
+void
+ipc_init(void) {
+    ipc_queues = kzalloc_region(sizeof(*ipc_queues) * NENV);
+}
+
+/* Drop endpoint of a new or dead environment */
+void
+ipc_queue_reset(struct Env *env) {
+    memset(QUEUE(env), 0, sizeof(struct IpcQueue));
+}
+
+static void
+ipc_wake(struct IpcQueue *queue, struct Env *env) {
+    if (!queue->waiting) return;
+    queue->waiting = 0;
+    env->env_status = ENV_RUNNABLE;
+}
+
+int
+ipc_endpoint(struct Env *env, uintptr_t slots, size_t maxsz) {
+    struct IpcQueue *queue = QUEUE(env);
+
+    if (slots < MAX_USER_ADDRESS) {
+        if (PAGE_OFFSET(slots) || !maxsz || PAGE_OFFSET(maxsz)) return -E_INVAL;
+        if (maxsz > (MAX_USER_ADDRESS - slots) / IPC_QUEUE_LEN) return -E_INVAL;
+    } else {
+        slots = MAX_USER_ADDRESS;
+        maxsz = 0;
+    }
+
+    queue->slots = slots;
+    queue->maxsz = maxsz;
+    queue->enabled = 1;
+    return 0;
+}
+
+int
+ipc_queue_send(struct Env *src, struct Env *dst, uint32_t value, uintptr_t srcva, size_t size, int perm) {
+    struct IpcQueue *queue = QUEUE(dst);
+
+    if (!queue->enabled) return -E_IPC_NOT_RECV;
+    if (queue->tail - queue->head >= IPC_QUEUE_LEN) return -E_IPC_QUEUE_FULL;
+
+    struct IpcMsg *msg = &queue->msgs[queue->tail % IPC_QUEUE_LEN];
+    msg->msg_from = src->env_id;
+    msg->msg_value = value;
+    msg->msg_perm = 0;
+    msg->msg_size = 0;
+    msg->msg_va = MAX_USER_ADDRESS;
+
+    if (srcva < MAX_USER_ADDRESS && queue->slots < MAX_USER_ADDRESS && size) {
+        if (PAGE_OFFSET(srcva)) return -E_INVAL;
+
+        uintptr_t dstva = queue->slots + (queue->tail % IPC_QUEUE_LEN) * queue->maxsz;
+        size = MIN(ROUNDUP(size, PAGE_SIZE), queue->maxsz);
+
+        int res = perm & IPC_DONATE ?
+                move_region(&dst->address_space, dstva, &src->address_space, srcva, size, (perm & ~IPC_DONATE) | PROT_USER_) :
+                map_region(&dst->address_space, dstva, &src->address_space, srcva, size, perm | PROT_USER_);
+        if (res < 0) return res;
+
+        msg->msg_perm = perm;
+        msg->msg_size = size;
+        msg->msg_va = dstva;
+    }
+
+    queue->tail++;
+    ipc_wake(queue, dst);
+    return 0;
+}
+
+/* Copy up to n messages to msgs (kernel or checked user buffer)
+ * and collect notification bits if notify is not NULL.
+ * Returns number of messages.  If there was nothing to receive
+ * and block is set env is put to sleep and 0 is returned;
+ * caller should retry after being woken up. */
+int
+ipc_queue_recv(struct Env *env, struct IpcMsg *msgs, size_t n, uint64_t *notify, bool block) {
+    struct IpcQueue *queue = QUEUE(env);
+
+    /* Notification mask works without an endpoint */
+    if (!queue->enabled && (n || !notify)) return -E_INVAL;
+
+    size_t count = 0;
+    while (count < n && queue->head != queue->tail) {
+        nosan_memcpy(&msgs[count++], &queue->msgs[queue->head % IPC_QUEUE_LEN], sizeof(*msgs));
+        queue->head++;
+    }
+
+    if (notify) {
+        uint64_t bits = queue->notify;
+        nosan_memcpy(notify, &bits, sizeof(bits));
+        queue->notify = 0;
+        if (bits) return count;
+    }
+
+    if (!count && block) {
+        queue->waiting = 1;
+        env->env_status = ENV_NOT_RUNNABLE;
+    }
+    return count;
+}
+
+int
+ipc_notify(struct Env *dst, uint64_t bits) {
+    struct IpcQueue *queue = QUEUE(dst);
+
+    queue->notify |= bits;
+    ipc_wake(queue, dst);
+
+    /* Blocked sys_ipc_recv() fails with -E_IPC_NOTIFIED */
+    if (dst->env_ipc_recving) {
+        dst->env_ipc_recving = 0;
+        dst->env_tf.tf_regs.reg_rax = -E_IPC_NOTIFIED;
+        dst->env_status = ENV_RUNNABLE;
+    }
+    return 0;
+}
+
+/* Env has unread notification bits */
+bool
+ipc_notify_pending(struct Env *env) {
+    struct IpcQueue *queue = QUEUE(env);
+    return queue->notify;
+}
+
+/* Timer slot holds a live environment with a running timer */
+static bool
+ipc_timer_alive(envid_t envid) {
+    if (!envid) return 0;
+
+    struct Env *env = &envs[ENVX(envid)];
+    struct IpcQueue *queue = QUEUE(env);
+    return env->env_id == envid && env->env_status != ENV_FREE &&
+           queue->enabled && queue->timer_period;
+}
+
+/* Notify env with bits every period_ms milliseconds,
+ * zero period cancels the timer */
+int
+ipc_timer(struct Env *env, uint64_t bits, uint64_t period_ms) {
+    struct IpcQueue *queue = QUEUE(env);
+    if (!queue->enabled) return -E_IPC_NOT_RECV;
+    /* Period is kept in nanoseconds */
+    if (period_ms > IPC_TIMER_MAX_MS) return -E_INVAL;
+
+    envid_t *slot = NULL;
+    for (size_t i = 0; i < IPC_NTIMERS && (!slot || *slot != env->env_id); i++)
+        if (ipc_timers[i] == env->env_id || (!slot && !ipc_timer_alive(ipc_timers[i])))
+            slot = &ipc_timers[i];
+
+    if (!period_ms) {
+        if (slot && *slot == env->env_id) *slot = 0;
+        queue->timer_period = 0;
+        return 0;
+    }
+    if (!slot) return -E_NO_MEM;
+
+    *slot = env->env_id;
+    queue->timer_bits = bits;
+    queue->timer_period = period_ms * 1000000;
+    queue->timer_next = timekeep_monotonic() + queue->timer_period;
+    return 0;
+}
+
+/* Deliver due periodic notifications, called on timer interrupt */
+void
+ipc_timer_tick(void) {
+    uint64_t now = 0;
+
+    for (size_t i = 0; i < IPC_NTIMERS; i++) {
+        if (!ipc_timers[i]) continue;
+        if (!ipc_timer_alive(ipc_timers[i])) {
+            ipc_timers[i] = 0;
+            continue;
+        }
+
+        struct Env *env = &envs[ENVX(ipc_timers[i])];
+        struct IpcQueue *queue = QUEUE(env);
+        if (!now) now = timekeep_monotonic();
+        if (now < queue->timer_next) continue;
+
+        queue->timer_next = now + queue->timer_period;
+        ipc_notify(env, queue->timer_bits);
+    }
+}
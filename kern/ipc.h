@@ -0,0 +1,33 @@
+#ifndef JOS_KERN_IPC_H
+#define JOS_KERN_IPC_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/ipc.h>
+#include <inc/env.h>
+
+struct IpcQueue {
+    struct IpcMsg msgs[IPC_QUEUE_LEN];
+    uint32_t head, tail; /* Free running indices */
+    uint64_t notify;     /* Pending notification bits */
+    uintptr_t slots;     /* Page slots for regions, or MAX_USER_ADDRESS */
+    size_t maxsz;        /* Size of each slot */
+    bool enabled;        /* Env has an endpoint */
+    bool waiting;        /* Env sleeps in sys_ipc_queue_recv() */
+    uint64_t timer_bits;   /* Bits of periodic notification */
+    uint64_t timer_period; /* Its period in ns, 0 if there's no timer */
+    uint64_t timer_next;   /* Monotonic time of the next one */
+};
+
+void ipc_init(void);
+void ipc_queue_reset(struct Env *env);
+int ipc_endpoint(struct Env *env, uintptr_t slots, size_t maxsz);
+int ipc_queue_send(struct Env *src, struct Env *dst, uint32_t value, uintptr_t srcva, size_t size, int perm);
+int ipc_queue_recv(struct Env *env, struct IpcMsg *msgs, size_t n, uint64_t *notify, bool block);
+int ipc_notify(struct Env *dst, uint64_t bits);
+bool ipc_notify_pending(struct Env *env);
+int ipc_timer(struct Env *env, uint64_t bits, uint64_t period_ms);
+void ipc_timer_tick(void);
+
+#endif /* !JOS_KERN_IPC_H */
@@ -0,0 +1,87 @@
+/* System call and trap latency histograms, see inc/lathist.h */
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/syscall.h>
+#include <inc/stdio.h>
+
+#include <kern/lathist.h>
+#include <kern/pmap.h>
+
+volatile struct LatHistPage *lathist;
+
+/* Trap being handled: number and TSC at trap() entry */
+static uint64_t trap_pending = (uint64_t)-1;
+static uint64_t trap_start;
+
+void
+lathist_init(void) {
+    static_assert(sizeof(struct LatHistPage) <= ULATHIST_SIZE, "LatHistPage does not fit");
+    static_assert(NSYSCALLS <= LATHIST_NSYSCALLS, "Too many system calls for LatHistPage");
+
+    lathist = kzalloc_region(ULATHIST_SIZE);
+    assert(lathist);
+
+    int res = map_region(current_space, ULATHIST, &kspace, (uintptr_t)lathist,
+                         ULATHIST_SIZE, PROT_R | PROT_USER_ | PROT_SHARE);
+    if (res < 0) panic("lathist_init: %i", res);
+
+    lathist->lh_reset_tsc = read_tsc();
+}
+
+void
+lathist_reset(void) {
+    memset((void *)lathist->lh_syscall, 0, sizeof(lathist->lh_syscall));
+    memset((void *)lathist->lh_trap, 0, sizeof(lathist->lh_trap));
+    lathist->lh_reset_tsc = read_tsc();
+    lathist->lh_resets++;
+}
+
+void
+lathist_syscall(uint64_t syscallno, uint64_t cycles) {
+    if (syscallno < LATHIST_NSYSCALLS)
+        lathist->lh_syscall[syscallno][lathist_bucket(cycles)]++;
+}
+
+void
+lathist_trap_enter(uint64_t trapno) {
+    trap_pending = MIN(trapno, LATHIST_NTRAPS - 1);
+    trap_start = read_tsc();
+}
+
+/* Called right before returning to user mode */
+void
+lathist_trap_exit(void) {
+    if (trap_pending == (uint64_t)-1) return;
+    lathist->lh_trap[trap_pending][lathist_bucket(read_tsc() - trap_start)]++;
+    trap_pending = (uint64_t)-1;
+}
+
+/* CPU goes idle, time until next return to user is not trap handling */
+void
+lathist_trap_cancel(void) {
+    trap_pending = (uint64_t)-1;
+}
+
+static void
+print_row(const char *kind, size_t num, volatile uint32_t *row) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < LATHIST_NBUCKETS; i++)
+        total += row[i];
+    if (!total) return;
+
+    cprintf("%s %2zu: %8lu |", kind, num, (unsigned long)total);
+    for (size_t i = 0; i < LATHIST_NBUCKETS; i++)
+        if (row[i]) cprintf(" 2^%zu:%u", i, row[i]);
+    cprintf("\n");
+}
+
+void
+lathist_print(void) {
+    cprintf("Latency histograms (TSC cycles), %u resets\n", lathist->lh_resets);
+    for (size_t i = 0; i < LATHIST_NSYSCALLS; i++)
+        print_row("syscall", i, lathist->lh_syscall[i]);
+    for (size_t i = 0; i < LATHIST_NTRAPS; i++)
+        print_row("trap   ", i, lathist->lh_trap[i]);
+}
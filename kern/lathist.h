@@ -0,0 +1,19 @@
+#ifndef JOS_KERN_LATHIST_H
+#define JOS_KERN_LATHIST_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/lathist.h>
+
+extern volatile struct LatHistPage *lathist;
+
+void lathist_init(void);
+void lathist_reset(void);
+void lathist_syscall(uint64_t syscallno, uint64_t cycles);
+void lathist_trap_enter(uint64_t trapno);
+void lathist_trap_exit(void);
+void lathist_trap_cancel(void);
+void lathist_print(void);
+
+#endif /* !JOS_KERN_LATHIST_H */
@@ -17,6 +17,8 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
+#include <kern/timekeep.h>
+#include <kern/lathist.h>
 
 #define WHITESPACE "\t\r\n "
 #define MAXARGS    16
@@ -33,6 +35,9 @@ int mon_frequency(int argc, char **argv, struct Trapframe *tf);
 int mon_memory(int argc, char **argv, struct Trapframe *tf);
 int mon_pagetable(int argc, char **argv, struct Trapframe *tf);
 int mon_virt(int argc, char **argv, struct Trapframe *tf);
+int mon_reclaim(int argc, char **argv, struct Trapframe *tf);
+int mon_ticks(int argc, char **argv, struct Trapframe *tf);
+int mon_lathist(int argc, char **argv, struct Trapframe *tf);
 
 struct Command {
     const char *name;
@@ -52,6 +57,9 @@ static struct Command commands[] = {
         {"memory", "Display allocated memory pages", mon_memory},
         {"pagetable", "Display current page table", mon_pagetable},
         {"virt", "Display virtual memory tree", mon_virt},
+        {"reclaim", "Display deferred address space teardown statistics", mon_reclaim},
+        {"ticks", "Display timer tick handler latency", mon_ticks},
+        {"lathist", "Display (or reset) syscall and trap latency histograms", mon_lathist},
 };
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
 
@@ -193,6 +201,43 @@ mon_virt(int argc, char **argv, struct Trapframe *tf) {
     return 0;
 }
 
+int
+mon_reclaim(int argc, char **argv, struct Trapframe *tf) {
+    dump_reclaim_stats();
+    return 0;
+}
+
+/* Compare timekeeping work done on each timer tick
+ * with a single RTC read which used to be done there instead */
+int
+mon_ticks(int argc, char **argv, struct Trapframe *tf) {
+    uint64_t freq = timekeep_tsc_freq() / 1000000;
+    if (!freq) freq = 1;
+
+    uint64_t start = read_tsc();
+    gettime();
+    uint64_t rtc = read_tsc() - start;
+
+    uint64_t avg = tick_stats.count ? tick_stats.cycles / tick_stats.count : 0;
+    cprintf("ticks: %lu\n", (unsigned long)tick_stats.count);
+    cprintf("tick handler: avg %lu cycles (%lu us), max %lu cycles (%lu us)\n",
+            (unsigned long)avg, (unsigned long)(avg / freq),
+            (unsigned long)tick_stats.max, (unsigned long)(tick_stats.max / freq));
+    cprintf("RTC read: %lu cycles (%lu us)\n", (unsigned long)rtc, (unsigned long)(rtc / freq));
+    cprintf("TSC frequency: %lu Hz\n", (unsigned long)timekeep_tsc_freq());
+    return 0;
+}
+
+int
+mon_lathist(int argc, char **argv, struct Trapframe *tf) {
+    if (argc > 1 && !strcmp(argv[1], "reset")) {
+        lathist_reset();
+        return 0;
+    }
+    lathist_print();
+    return 0;
+}
+
 // LAB 4: Your code here
 int
 mon_dumpcmos(int argc, char **argv, struct Trapframe *tf)
@@ -12,6 +12,7 @@
 #include <kern/pmap.h>
 #include <kern/traceopt.h>
 #include <kern/trap.h>
+#include <kern/tsc.h>
 
 /*
  * Term "page" used here does not
@@ -25,8 +26,8 @@
 static struct List free_classes[MAX_CLASS];
 /* List of descriptor pools */
 static struct PagePool *first_pool;
-/* List of free descriptors */
-static struct List free_descriptors;
+/* List of pools that have free descriptors */
+static struct List free_pools;
 static size_t free_desc_count;
 /* Physical memory size */
 size_t max_memory_map_addr;
@@ -65,7 +66,12 @@ extern char pfstacktop[], pfstack[];
 #define PAGE_IS_FREE(p) (!(p)->refc && !(p)->left && !(p)->right)
 #define PAGE_IS_UNIQ(p) ((p)->refc == 1 && !(p)->left && !(p)->right)
 
-#define INIT_DESCR 256
+/* Number of statically allocated pools
+ * used before memory allocator is ready */
+#define INIT_POOLS 2
+
+/* Pool containing descriptor (pools are POOL_CLASS-aligned) */
+#define DESC_POOL(p) ((struct PagePool *)ROUNDDOWN((uintptr_t)(p), CLASS_SIZE(POOL_CLASS)))
 
 #define ABSDIFF(x, y) ((x) > (y) ? (x) - (y) : (y) - (x))
 
@@ -119,14 +125,41 @@ ensure_free_desc(size_t count) {
     }
 
     assert(free_desc_count >= count);
-    assert(!list_empty(&free_descriptors));
+    assert(!list_empty(&free_pools));
+}
+
+static void
+pool_add_free(struct PagePool *pool, struct Page *page) {
+    if (!pool->nfree++) list_append(&free_pools, &pool->link);
+    list_append(&pool->free, (struct List *)page);
+    free_desc_count++;
+}
+
+static void
+init_pool(struct PagePool *pool, size_t ndesc) {
+    list_init(&pool->free);
+    pool->nfree = 0;
+    /* Append in reverse so that descriptors are handed out in address order */
+    for (size_t i = ndesc; i > 0; i--)
+        pool_add_free(pool, &pool->data[i - 1]);
+    pool->next = first_pool;
+    first_pool = pool;
 }
 
+/* Allocate new descriptor.
+ * Descriptors are taken from the pool of near if possible
+ * to keep nodes of one tree close to each other in memory */
 static struct Page *
-alloc_descriptor(enum PageState state) {
+alloc_descriptor_near(enum PageState state, struct Page *near) {
     ensure_free_desc(1);
 
-    struct Page *new = (struct Page *)list_del(free_descriptors.next);
+    struct PagePool *pool = near && near != &root ? DESC_POOL(near) : NULL;
+    if (!pool || !pool->nfree)
+        pool = (struct PagePool *)free_pools.next;
+
+    assert(pool->nfree);
+    struct Page *new = (struct Page *)list_del(pool->free.next);
+    if (!--pool->nfree) list_del(&pool->link);
 
     memset(new, 0, sizeof *new);
     list_init((struct List *)new);
@@ -136,16 +169,20 @@ alloc_descriptor(enum PageState state) {
     return new;
 }
 
+static struct Page *
+alloc_descriptor(enum PageState state) {
+    return alloc_descriptor_near(state, NULL);
+}
+
 static void
 free_descriptor(struct Page *page) {
     list_del((struct List *)page);
-    list_append(&free_descriptors, (struct List *)page);
-    free_desc_count++;
+    pool_add_free(DESC_POOL(page), page);
 }
 
 static void
 _assert_root(const char *file, int line, struct Page *p, bool phy) {
-    while (p->parent) p = p->parent;
+    while (p->parent) p = page_parent(p);
     if ((p == &root) != phy)
         _panic(file, line, "Page %p (phy %p) should%s be physical\n", p, (void *)PADDR(p), phy ? "" : "n't");
 }
@@ -154,8 +191,8 @@ static void
 free_desc_rec(struct Page *p) {
     while (p) {
         assert(!p->refc);
-        free_desc_rec(p->right);
-        struct Page *tmp = p->left;
+        free_desc_rec(page_right(p));
+        struct Page *tmp = page_left(p);
         free_descriptor(p);
         p = tmp;
     }
@@ -187,14 +224,14 @@ alloc_child(struct Page *parent, bool right) {
     // родитель не может быть минимального класса — иначе делить нечего
     assert(parent->class > 0);
 
-    struct Page *child = alloc_descriptor(parent->state);
+    struct Page *child = alloc_descriptor_near(parent->state, parent);
     assert(child);
 
     // класс ребёнка: вдвое меньший размер
     child->class  = parent->class - 1;
-    child->parent = parent;
-    child->left   = NULL;
-    child->right  = NULL;
+    child->parent = desc_ref(parent);
+    child->left   = 0;
+    child->right  = 0;
 
     // refc ребёнка: 0, если у родителя 0; иначе 1
     child->refc = parent->refc ? 1 : 0;
@@ -204,18 +241,18 @@ alloc_child(struct Page *parent, bool right) {
 
     if (!right) {
         // левый ребёнок — нижняя половина диапазона
-        assert(parent->left == NULL);
+        assert(!parent->left);
         child->addr  = parent->addr;
-        parent->left = child;
+        parent->left = desc_ref(child);
     } else {
         // правый — верхняя половина диапазона
-        assert(parent->right == NULL);
+        assert(!parent->right);
         uint64_t base = (uint64_t)parent->addr;
         uint64_t res  = base + (uint64_t)child_units;
         // защита от переполнения
         assert(res > base);
         child->addr   = (uintptr_t)res;
-        parent->right = child;
+        parent->right = desc_ref(child);
     }
 
     // делаем из head пустой список (кольцевой)
@@ -248,7 +285,7 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
 
             if (was_free) {
                 /* Recalculate free lists for allocatable page */
-                struct Page *other = !right ? node->right : node->left;
+                struct Page *other = !right ? page_right(node) : page_left(node);
                 assert(other->state == ALLOCATABLE_NODE);
                 list_del((struct List *)node);
                 list_append(&free_classes[node->class - 1], (struct List *)other);
@@ -260,7 +297,7 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
 
         assert((node->left && node->right) || !alloc);
 
-        node = right ? node->right : node->left;
+        node = right ? page_right(node) : page_left(node);
     }
 
     if (alloc) assert(node);
@@ -269,9 +306,9 @@ page_lookup(struct Page *hint, uintptr_t addr, int class, enum PageState type, b
         assert(!node->refc);
 
         /* Need to free old subtree when retyping memory */
-        free_desc_rec(node->left);
-        free_desc_rec(node->right);
-        node->left = node->right = NULL;
+        free_desc_rec(page_left(node));
+        free_desc_rec(page_right(node));
+        node->left = node->right = 0;
         list_del((struct List *)node);
 
         /* We cannot change RESERVED_NODE memory to ALLOCATABLE_NODE */
@@ -297,8 +334,8 @@ page_ref(struct Page *node) {
     if (!node->refc++) {
         list_del((struct List *)node);
         list_init((struct List *)node);
-        page_ref(node->left);
-        page_ref(node->right);
+        page_ref(page_left(node));
+        page_ref(page_right(node));
     }
 }
 
@@ -313,8 +350,8 @@ page_unref(struct Page *page) {
      * to prevent double frees */
 
     if (page->refc == 1) {
-        page_unref(page->left);
-        page_unref(page->right);
+        page_unref(page_left(page));
+        page_unref(page_right(page));
     }
 
     page->refc--;
@@ -322,16 +359,16 @@ page_unref(struct Page *page) {
     /* Try to merge free page with adjacent */
     if (PAGE_IS_FREE(page)) {
         while (page != &root) {
-            struct Page *par = page->parent;
+            struct Page *par = page_parent(page);
             assert_physical(par);
             if (par->state == page->state &&
-                PAGE_IS_FREE(par->left) &&
-                PAGE_IS_FREE(par->right)) {
-                free_descriptor(par->left);
-                par->left = NULL;
+                PAGE_IS_FREE(page_left(par)) &&
+                PAGE_IS_FREE(page_right(par))) {
+                free_descriptor(page_left(par));
+                par->left = 0;
 
-                free_descriptor(par->right);
-                par->right = NULL;
+                free_descriptor(page_right(par));
+                par->right = 0;
 
                 if (par->state == ALLOCATABLE_NODE) {
                     assert(list_empty((struct List *)par));
@@ -353,17 +390,20 @@ page_unref(struct Page *page) {
     }
 }
 
-void
-alloc_virtual_child(struct Page *parent, struct Page **dst) {
+struct Page *
+alloc_virtual_child(struct Page *parent, bool right) {
     assert_virtual(parent);
     assert(parent->phy && parent->phy->left && parent->phy->right);
 
-    if ((*dst = alloc_descriptor(parent->state))) {
-        (*dst)->parent = parent;
-        (*dst)->phy = dst == &parent->left ? parent->phy->left : parent->phy->right;
-        page_ref((*dst)->phy);
-        list_append((struct List *)(*dst)->phy, (struct List *)(*dst));
+    struct Page *child = alloc_descriptor_near(parent->state, parent);
+    if (child) {
+        child->parent = desc_ref(parent);
+        child->phy = right ? page_right(parent->phy) : page_left(parent->phy);
+        page_ref(child->phy);
+        list_append((struct List *)child->phy, (struct List *)child);
+        *(right ? &parent->right : &parent->left) = desc_ref(child);
     }
+    return child;
 }
 
 /*
@@ -387,7 +427,7 @@ alloc_virtual_child(struct Page *parent, struct Page **dst) {
  */
 static void
 check_virtual_class(struct Page *node, int class) {
-    while (node->parent) class ++, node = node->parent;
+    while (node->parent) class ++, node = page_parent(node);
     assert(class == MAX_CLASS);
 }
 
@@ -404,7 +444,7 @@ page_lookup_virtual(struct Page *node, uintptr_t addr, int class, int alloc) {
         bool right = addr & CLASS_SIZE(nclass - 1);
 
 
-        struct Page **next = right ? &node->right : &node->left;
+        desc_ref_t *next = right ? &node->right : &node->left;
 
         if (!*next) {
             if (!alloc) break;
@@ -421,10 +461,8 @@ page_lookup_virtual(struct Page *node, uintptr_t addr, int class, int alloc) {
 
                 assert(node->phy->left && node->phy->right);
 
-                alloc_virtual_child(node, &node->left);
-                if (!node->left) return NULL;
-                alloc_virtual_child(node, &node->right);
-                if (!node->right) return NULL;
+                if (!alloc_virtual_child(node, 0)) return NULL;
+                if (!alloc_virtual_child(node, 1)) return NULL;
 
                 list_del((struct List *)node);
                 page_unref(node->phy);
@@ -432,12 +470,13 @@ page_lookup_virtual(struct Page *node, uintptr_t addr, int class, int alloc) {
                 node->state = INTERMEDIATE_NODE;
             } else {
                 assert(node->state == INTERMEDIATE_NODE);
-                *next = alloc_descriptor(INTERMEDIATE_NODE);
-                (*next)->parent = node;
+                struct Page *child = alloc_descriptor_near(INTERMEDIATE_NODE, node);
+                child->parent = desc_ref(node);
+                *next = desc_ref(child);
             }
             assert(*next);
         }
-        node = *next;
+        node = desc_ptr(*next);
         nclass--;
     }
 
@@ -501,14 +540,15 @@ unmap_page_remove(struct Page *node) {
         page_unref(node->phy);
     } else {
         assert((node->state & NODE_TYPE_MASK) == INTERMEDIATE_NODE);
-        unmap_page_remove(node->left);
-        unmap_page_remove(node->right);
+        unmap_page_remove(page_left(node));
+        unmap_page_remove(page_right(node));
     }
 
-    if (node->parent) {
-        *(node->parent->left == node ?
-                  &node->parent->left :
-                  &node->parent->right) = NULL;
+    struct Page *parent = page_parent(node);
+    if (parent) {
+        *(page_left(parent) == node ?
+                  &parent->left :
+                  &parent->right) = 0;
     }
 
     free_descriptor(node);
@@ -576,20 +616,20 @@ check_physical_tree(struct Page *page) {
     assert(page->class >= 0);
     assert(!(page2pa(page) & CLASS_MASK(page->class)));
     if (page->state == ALLOCATABLE_NODE || page->state == RESERVED_NODE) {
-        if (page->left) assert(page->left->state == page->state);
-        if (page->right) assert(page->right->state == page->state);
+        if (page->left) assert(page_left(page)->state == page->state);
+        if (page->right) assert(page_right(page)->state == page->state);
     }
     if (page->left) {
-        assert(page->left->class + 1 == page->class);
-        assert(page2pa(page) == page2pa(page->left));
+        assert(page_left(page)->class + 1 == page->class);
+        assert(page2pa(page) == page2pa(page_left(page)));
     }
     if (page->right) {
-        assert(page->right->class + 1 == page->class);
-        assert(page->addr + (1ULL << (page->class - 1)) == page->right->addr);
+        assert(page_right(page)->class + 1 == page->class);
+        assert(page->addr + (1ULL << (page->class - 1)) == page_right(page)->addr);
     }
     if (page->parent) {
-        assert(page->parent->class - 1 == page->class);
-        assert((page->parent->left == page) ^ (page->parent->right == page));
+        assert(page_parent(page)->class - 1 == page->class);
+        assert((page_left(page_parent(page)) == page) ^ (page_right(page_parent(page)) == page));
     } else {
         assert(page->class == MAX_CLASS);
         assert(page == &root);
@@ -611,12 +651,12 @@ check_physical_tree(struct Page *page) {
         }
     }
     if (page->left) {
-        assert(page->left->parent == page);
-        check_physical_tree(page->left);
+        assert(page_parent(page_left(page)) == page);
+        check_physical_tree(page_left(page));
     }
     if (page->right) {
-        assert(page->right->parent == page);
-        check_physical_tree(page->right);
+        assert(page_parent(page_right(page)) == page);
+        check_physical_tree(page_right(page));
     }
 }
 
@@ -636,12 +676,12 @@ check_virtual_tree(struct Page *page, int class) {
         assert(page->state == INTERMEDIATE_NODE);
     }
     if (page->left) {
-        assert(page->left->parent == page);
-        check_virtual_tree(page->left, class - 1);
+        assert(page_parent(page_left(page)) == page);
+        check_virtual_tree(page_left(page), class - 1);
     }
     if (page->right) {
-        assert(page->right->parent == page);
-        check_virtual_tree(page->right, class - 1);
+        assert(page_parent(page_right(page)) == page);
+        check_virtual_tree(page_right(page), class - 1);
     }
 }
 
@@ -656,10 +696,10 @@ dump_virtual_tree(struct Page *node, int class) {
     if (!node)
         return;
 
-    dump_virtual_tree(node->left, class);
+    dump_virtual_tree(page_left(node), class);
 
     int depth = 0;
-    for (struct Page *p = node->parent; p; p = p->parent)
+    for (struct Page *p = page_parent(node); p; p = page_parent(p))
         depth++;
 
     for (int i = 0; i < depth; i++)
@@ -687,7 +727,7 @@ dump_virtual_tree(struct Page *node, int class) {
     }
     cprintf("\n");
 
-    dump_virtual_tree(node->right, class);
+    dump_virtual_tree(page_right(node), class);
 }
 
 void
@@ -918,21 +958,64 @@ memcpy_page(struct AddressSpace *dst, uintptr_t va, struct Page *page) {
         switch_address_space(old);
 }
 
+/* Ranges longer than this are invalidated by reloading CR3 */
+#define TLB_FLUSH_THRESHOLD (64 * PAGE_SIZE)
+
+/* Pending invalidation collected between tlb_batch_begin()
+ * and tlb_batch_end(), empty if start >= end */
+static struct {
+    bool active;
+    uintptr_t start, end;
+} tlb_batch;
+
+static void
+tlb_flush_range(uintptr_t start, uintptr_t end) {
+    /* If we need to invalidate a lot of memory, just flush whole cache */
+    if (end - start > TLB_FLUSH_THRESHOLD)
+        lcr3(rcr3());
+    else {
+        while (start < end) {
+            invlpg((void *)start);
+            start += PAGE_SIZE;
+        }
+    }
+}
+
 static void
 tlb_invalidate_range(struct AddressSpace *spc, uintptr_t start, uintptr_t end) {
     if (current_space == spc || !current_space) {
-        /* If we need to invalidate a lot of memory, just flush whole cache */
-        if (start - end > 512 * GB)
-            lcr3(rcr3());
-        else {
-            while (start < end) {
-                invlpg((void *)start);
-                start += PAGE_SIZE;
-            }
+        if (!tlb_batch.active)
+            return tlb_flush_range(start, end);
+
+        if (tlb_batch.start >= tlb_batch.end) {
+            tlb_batch.start = start;
+            tlb_batch.end = end;
+        } else {
+            tlb_batch.start = MIN(tlb_batch.start, start);
+            tlb_batch.end = MAX(tlb_batch.end, end);
         }
     }
 }
 
+/* Defer TLB invalidation of the current address space
+ * until tlb_batch_end(), so that a series of map_region()/unmap_region()
+ * calls costs a single flush.  Nothing may access the affected
+ * user memory until the batch is finished. */
+void
+tlb_batch_begin(void) {
+    assert(!tlb_batch.active);
+    tlb_batch.active = 1;
+    tlb_batch.start = tlb_batch.end = 0;
+}
+
+void
+tlb_batch_end(void) {
+    assert(tlb_batch.active);
+    tlb_batch.active = 0;
+    if (tlb_batch.start < tlb_batch.end)
+        tlb_flush_range(tlb_batch.start, tlb_batch.end);
+}
+
 static void
 unmap_page(struct AddressSpace *spc, uintptr_t addr, int class) {
     if (trace_memory) cprintf("<%p> Unmapping [%08lX, %08lX]\n",
@@ -940,6 +1023,9 @@ unmap_page(struct AddressSpace *spc, uintptr_t addr, int class) {
     int res;
     assert(!(addr & CLASS_MASK(class)));
 
+    /* Drop cached user_mem_check() result */
+    spc->checked_start = spc->checked_end = 0;
+
     struct Page *node = page_lookup_virtual(spc->root, addr, class, LOOKUP_ALLOC);
     if (node) unmap_page_remove(node);
     /* Disallow root node deallocation */
@@ -1229,19 +1315,34 @@ alloc_page(int class, int flags) {
 
     if (flags & ALLOC_POOL) flags |= ALLOC_BOOTMEM;
 #ifndef SANITIZE_SHADOW_BASE
-    if (current_space) flags &= ~ALLOC_BOOTMEM;
+    /* Pools always stay within BOOT_MEM_SIZE for desc_ref() */
+    if (current_space && !(flags & ALLOC_POOL)) flags &= ~ALLOC_BOOTMEM;
 #endif
 
     /* Find page that is not smaller than requested
-     * (Pool memory should also be within BOOT_MEM_SIZE) */
-    for (int pclass = class; pclass < MAX_CLASS; pclass++, li = NULL) {
-        for (li = free_classes[pclass].next; li != &free_classes[pclass]; li = li->next) {
-            peer = (struct Page *)li;
-            assert(peer->state == ALLOCATABLE_NODE);
-            assert_physical(peer);
-            if (!(flags & ALLOC_BOOTMEM) || page2pa(peer) + CLASS_SIZE(class) < BOOT_MEM_SIZE) goto found;
+     * (Pool memory should also be within BOOT_MEM_SIZE).
+     * Other pages are taken above BOOT_MEM_SIZE first,
+     * so low memory is left for pools for as long as possible */
+    for (int pass = !!(flags & ALLOC_BOOTMEM); pass < 2; pass++) {
+        for (int pclass = class; pclass < MAX_CLASS; pclass++, li = NULL) {
+            for (li = free_classes[pclass].next; li != &free_classes[pclass]; li = li->next) {
+                peer = (struct Page *)li;
+                assert(peer->state == ALLOCATABLE_NODE);
+                assert_physical(peer);
+                if (flags & ALLOC_BOOTMEM) {
+                    if (page2pa(peer) + CLASS_SIZE(class) < BOOT_MEM_SIZE) goto found;
+                } else if (pass || page2pa(peer) >= BOOT_MEM_SIZE) {
+                    goto found;
+                }
+            }
         }
     }
+
+    /* Memory of dead environments might still be pending.
+     * Pool allocations are skipped since page_lookup()
+     * may hold free physical nodes that would get merged */
+    if (!(flags & ALLOC_POOL) && reclaim_address_spaces(RECLAIM_ALL))
+        return alloc_page(class, flags);
     return NULL;
 
 found:
@@ -1259,11 +1360,7 @@ found:
         if (current_space) platform_asan_unpoison(newpool, CLASS_SIZE(class));
 #endif
         ndesc = POOL_ENTRIES_FOR_SIZE(CLASS_SIZE(class));
-        for (size_t i = 0; i < ndesc; i++)
-            list_append(&free_descriptors, (struct List *)&newpool->data[i]);
-        newpool->next = first_pool;
-        first_pool = newpool;
-        free_desc_count += ndesc;
+        init_pool(newpool, ndesc);
         if (trace_memory_more) cprintf("Allocated pool of size %zu at [%08lX, %08lX]\n",
                                        ndesc, page2pa(peer), page2pa(peer) + (long)CLASS_MASK(class));
     }
@@ -1273,9 +1370,6 @@ found:
 
     if (flags & ALLOC_POOL) {
         assert(KADDR(page2pa(new)) == first_pool);
-#ifdef SANITIZE_SHADOW_BASE
-        assert(page2pa(new) + CLASS_SIZE(new->class) <= BOOT_MEM_SIZE);
-#endif
         page_ref(new);
         first_pool->peer = new;
         allocating_pool = 0;
@@ -1435,7 +1529,10 @@ fault:
     if (res == -E_NO_MEM) {
         if (spc != &kspace) {
             struct Env *env = (void *)((uint8_t *)spc - offsetof(struct Env, address_space));
-            env_destroy(env);
+            /* Let user-level caches shrink before killing anybody.
+             * Only a user mode fault can be restarted later */
+            if (!in_page_fault || !in_user_page_fault || env != curenv || !mem_pressure_wait(env))
+                env_destroy(env);
         } else
             panic("Out of memory\n");
     } else
@@ -1524,11 +1621,11 @@ do_map_subtree(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *
         assert(vpage->state == INTERMEDIATE_NODE);
 
         if (vpage->left && (res = do_map_subtree(dspace, dst,
-                                                 sspace, src, vpage->left, class - 1, flags)) < 0) break;
+                                                 sspace, src, page_left(vpage), class - 1, flags)) < 0) break;
 
         dst += CLASS_SIZE(class - 1);
         src += CLASS_SIZE(class - 1);
-        vpage = vpage->right;
+        vpage = page_right(vpage);
         class --;
     }
     return res;
@@ -1625,25 +1722,216 @@ map_region(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspa
     return 0;
 }
 
+/* Map mappings of virtual subtree vpage of class at dst
+ * with their own physical pages and protection narrowed by flags */
+static int
+move_subtree(struct AddressSpace *dspace, uintptr_t dst, struct Page *vpage, int class, int flags) {
+    int res = 0;
+    while (!res && vpage) {
+        assert(class >= 0);
+        if (vpage->phy) {
+            assert((vpage->state & NODE_TYPE_MASK) == MAPPING_NODE);
+            int oldflags = vpage->state & PROT_ALL;
+            /* Rights can only be taken away */
+            if (~oldflags & PROT_RWX & flags) return -E_INVAL;
+            return map_page(dspace, dst, vpage->phy, oldflags & ~(PROT_RWX & ~flags));
+        }
+        assert(vpage->state == INTERMEDIATE_NODE);
+
+        if (vpage->left && (res = move_subtree(dspace, dst, page_left(vpage), class - 1, flags)) < 0) break;
+
+        dst += CLASS_SIZE(class - 1);
+        vpage = page_right(vpage);
+        class --;
+    }
+    return res;
+}
+
+static int
+move_region_one_page(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, int class, int flags) {
+    struct Page *vpage = page_lookup_virtual(sspace->root, src, class, LOOKUP_ALLOC);
+    if (!vpage) return -E_NO_MEM;
+    check_virtual_class(vpage, class);
+    return move_subtree(dspace, dst, vpage, class, flags);
+}
+
+/* Move pages of [src, src + size) in sspace to dst in dspace.
+ * Every source mapping node is replaced by a node at dst referring
+ * to the same physical page with the same protection, only narrowed
+ * by flags.  So nothing is copied, reference counts end up as they
+ * were, private pages stay private and copy-on-write or shared pages
+ * stay such.
+ *
+ * Pages are mapped at dst first and their source nodes are removed
+ * after the whole region is mapped, which only frees memory.  If
+ * mapping fails (flags adding rights or memory shortage) the part
+ * mapped so far is removed from dst and the source is left intact. */
+int
+move_region(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, uintptr_t size, int flags) {
+    if (!sspace || sspace == dspace || !dspace) return -E_INVAL;
+    if ((src | dst | size) & CLASS_MASK(0) || !size) return -E_INVAL;
+
+    uintptr_t dstart = dst, sstart = src, end = dst + size;
+    int max_class = addr_common_class(src, dst), class = 0, res = 0;
+    for (; !res && class < max_class && dst + CLASS_SIZE(class) <= end; class ++) {
+        if (dst & CLASS_SIZE(class)) {
+            res = move_region_one_page(dspace, dst, sspace, src, class, flags);
+            dst += CLASS_SIZE(class);
+            src += CLASS_SIZE(class);
+        }
+    }
+
+    for (; !res && class >= 0 && dst < end; class --) {
+        while (!res && dst + CLASS_SIZE(class) <= end) {
+            res = move_region_one_page(dspace, dst, sspace, src, class, flags);
+            dst += CLASS_SIZE(class);
+            src += CLASS_SIZE(class);
+        }
+    }
+
+    if (res < 0) {
+        unmap_region(dspace, dstart, size);
+        return res;
+    }
+
+    unmap_region(sspace, sstart, size);
+    return 0;
+}
+
+/* Address spaces of freed environments waiting to be torn down.
+ * Teardown is done incrementally from the timer tick and the idle
+ * loop, so env_free() does not need to walk the whole virtual tree
+ * and the Env slot can be reused right away.
+ * reclaim_head and reclaim_tail only grow, queue length is their difference. */
+static struct AddressSpace reclaim_queue[RECLAIM_QUEUE_SIZE];
+static size_t reclaim_head, reclaim_tail;
+static bool reclaiming;
+
+struct ReclaimStats reclaim_stats;
+
+/* Remove up to budget leaf nodes from the virtual tree of space
+ * returning mapped memory back to the physical allocator.
+ * Returns number of nodes removed. */
+static size_t
+reclaim_virtual_tree(struct AddressSpace *space, size_t budget) {
+    struct Page *vroot = space->root;
+    size_t done = 0;
+
+    assert(!vroot->phy);
+    while (done < budget && (vroot->left || vroot->right)) {
+        /* Descend to the leftmost leaf, it has no children
+         * so unmap_page_remove() does constant amount of tree work */
+        struct Page *node = vroot;
+        int class = MAX_CLASS;
+        while (node->left || node->right) {
+            node = node->left ? page_left(node) : page_right(node);
+            class--;
+        }
+
+        if (node->phy) reclaim_stats.pages += CLASS_SIZE(class) / PAGE_SIZE;
+        unmap_page_remove(node);
+        done++;
+    }
+
+    reclaim_stats.nodes += done;
+    return done;
+}
+
+/* Free what is left of space after its virtual tree is empty:
+ * user page tables, tree root and PML4 itself */
+static void
+reclaim_finish(struct AddressSpace *space) {
+    assert(!space->root->left && !space->root->right);
+    free_descriptor(space->root);
+
+    /* Hardware page tables of the user part are owned by the space */
+    remove_pt(space->pml4, 0, 512 * GB, 0, NUSERPML4);
+
+    /* Also unmap PML4 itself since it is never deallocated by page_unref */
+    page_unref(page_lookup(NULL, space->cr3, 0, PARTIAL_NODE, 0));
+
+    memset(space, 0, sizeof *space);
+    reclaim_stats.released++;
+}
+
+/* Perform up to budget units of deferred address space teardown.
+ * Returns number of units done */
+size_t
+reclaim_address_spaces(size_t budget) {
+    if (reclaiming || reclaim_head == reclaim_tail) return 0;
+    reclaiming = 1;
+
+    uint64_t start = read_tsc();
+    size_t done = 0;
+
+    while (done < budget && reclaim_head != reclaim_tail) {
+        struct AddressSpace *space = &reclaim_queue[reclaim_head % RECLAIM_QUEUE_SIZE];
+        done += reclaim_virtual_tree(space, budget - done);
+        if (!space->root->left && !space->root->right) {
+            reclaim_finish(space);
+            reclaim_head++;
+        }
+    }
+
+    reclaim_stats.cycles += read_tsc() - start;
+    reclaiming = 0;
+    return done;
+}
+
+/* Number of free 4K pages */
+size_t
+free_memory_pages(void) {
+    size_t res = 0;
+    for (int c = 0; c < MAX_CLASS; c++)
+        for (struct List *li = free_classes[c].next; li != &free_classes[c]; li = li->next)
+            res += CLASS_SIZE(c) / PAGE_SIZE;
+    return res;
+}
+
+size_t
+reclaim_queue_length(void) {
+    return reclaim_tail - reclaim_head;
+}
+
+void
+dump_reclaim_stats(void) {
+    uint64_t khz = tsc_calibrate() / 1000;
+    cprintf("Address space reclaim queue: %zu pending, %zu queued total, %zu released\n",
+            reclaim_queue_length(), reclaim_stats.queued, reclaim_stats.released);
+    cprintf("  %zu pages, %zu nodes in %lu cycles", reclaim_stats.pages,
+            reclaim_stats.nodes, (unsigned long)reclaim_stats.cycles);
+    if (reclaim_stats.cycles)
+        cprintf(" (%lu pages/ms)", (unsigned long)(reclaim_stats.pages * khz / reclaim_stats.cycles));
+    cprintf("\n");
+}
+
+/* Detach address space from its owner and queue it for
+ * deferred teardown with reclaim_address_spaces().
+ * space is zeroed on return and can be reinitialized immediately. */
 void
 release_address_space(struct AddressSpace *space) {
     /* NOTE: This function should not be called for kspace */
+    assert(space != &kspace && space != current_space);
 
-    /* Manually unref level 3 kernel page tables */
+    /* Manually unref level 3 kernel page tables.
+     * This is done right away since kernel part of PML4
+     * is only kept in sync for live address spaces */
     for (size_t i = NUSERPML4; i < PML4_ENTRY_COUNT; i++) {
         if (kspace.pml4[i] & PTE_P && i != UVPT_INDEX)
             page_unref(page_lookup(NULL, PTE_ADDR(kspace.pml4[i]), 0, PARTIAL_NODE, 0));
     }
 
-    /* Unmap all memory from the space
+    /* Make room by finishing oldest teardown synchronously */
+    while (reclaim_queue_length() == RECLAIM_QUEUE_SIZE)
+        reclaim_address_spaces(RECLAIM_ALL);
+
+    /* Unmap all user memory from the space later
      * (kernel is cheating and does not store
      *  metadata for upper part of address space (privileged)
      *  in tree and only in page tables for user address spaces,
      *  so unmapping is safe) */
-    unmap_page(space, 0, MAX_CLASS);
-
-    /* Also unmap PML4 itself since it is never deallocated by page_uname*/
-    page_unref(page_lookup(NULL, space->cr3, 0, PARTIAL_NODE, 0));
+    reclaim_queue[reclaim_tail++ % RECLAIM_QUEUE_SIZE] = *space;
+    reclaim_stats.queued++;
 
     /* Zero-out metadata */
     memset(space, 0, sizeof *space);
@@ -1802,7 +2090,7 @@ detect_memory(void) {
 
 static void
 init_allocator(void) {
-    static struct Page initial_buffer[INIT_DESCR];
+    static uint8_t initial_pools[INIT_POOLS][CLASS_SIZE(POOL_CLASS)] __attribute__((aligned(CLASS_SIZE(POOL_CLASS))));
 
     metaheaptop = KERN_HEAP_START + ROUNDUP(uefi_lp->FrameBufferSize, PAGE_SIZE);
 
@@ -1812,13 +2100,13 @@ init_allocator(void) {
 
     /* Initialize first pool */
 
-    if (trace_memory_more) cprintf("First pool at [%08lX, %08lX]\n", PADDR(initial_buffer),
-                                   PADDR(initial_buffer) + INIT_DESCR * sizeof(struct Page));
+    if (trace_memory_more) cprintf("First pool at [%08lX, %08lX]\n", PADDR(initial_pools),
+                                   PADDR(initial_pools) + sizeof initial_pools);
 
-    list_init(&free_descriptors);
-    free_desc_count = INIT_DESCR;
-    for (size_t i = 0; i < INIT_DESCR; i++)
-        list_append(&free_descriptors, (struct List *)&initial_buffer[i]);
+    list_init(&free_pools);
+    free_desc_count = 0;
+    for (size_t i = 0; i < INIT_POOLS; i++)
+        init_pool((struct PagePool *)initial_pools[i], POOL_ENTRIES_FOR_SIZE(CLASS_SIZE(POOL_CLASS)));
 
     list_init(&root.head);
     root.class = MAX_CLASS;
@@ -1910,8 +2198,8 @@ unpoison_meta(struct Page *node) {
             return;
         }
 
-        if (node->left) unpoison_meta(node->left);
-        node = node->right;
+        if (node->left) unpoison_meta(page_left(node));
+        node = page_right(node);
     }
 }
 
@@ -2053,9 +2341,11 @@ init_memory(void) {
     lcr4(CR4_PSE | CR4_PAE | CR4_PCE);
 
     /* Enable NX bit (execution protection) */
-    uint64_t efer = rdmsr(EFER_MSR);
-    efer |= EFER_NXE;
-    wrmsr(EFER_MSR, efer);
+    if (nx_supported) {
+        uint64_t efer = rdmsr(EFER_MSR);
+        efer |= EFER_NXE;
+        wrmsr(EFER_MSR, efer);
+    }
 
     for (size_t i = 0; i < CLASS_SIZE(MAX_ALLOCATION_CLASS); i++)
         assert(!zero_page_raw[i]);
@@ -2153,16 +2443,44 @@ init_memory(void) {
 
 static uintptr_t user_mem_check_addr;
 
+/*
+ * Walk hardware page tables of spc checking that every leaf
+ * entry covering [start, end) has all of need bits and none of
+ * forbid bits set. Huge leaves are checked in one step.
+ * Returns first address failing the check or end.
+ */
+static uintptr_t
+pt_check_range(struct AddressSpace *spc, uintptr_t start, uintptr_t end, pte_t need, pte_t forbid) {
+    uintptr_t addr = start;
+
+    while (addr < end) {
+        pte_t *pt = spc->pml4, ent;
+        int shift = PML4_SHIFT;
+        for (;;) {
+            ent = pt[(addr >> shift) & (PT_ENTRY_COUNT - 1)];
+            if (!(ent & PTE_P) || (ent & PTE_PS) || shift == PT_SHIFT) break;
+            pt = KADDR(PTE_ADDR(ent));
+            shift -= PT_ENTRY_SHIFT;
+        }
+
+        if ((ent & need) != need || (ent & forbid)) return addr;
+        addr = ROUNDDOWN(addr, 1ULL << shift) + (1ULL << shift);
+    }
+
+    return end;
+}
+
 /*
  * This function checks whether given memory range
  * has specified permissions and sets user_mem_check_addr
  * to first non-applicable address
  *
- * HINT: Use page_lookup_virtual with class==0 alloc==0 to
- * lookup the smallest existing page at the given address.
- *
- * Returned page should have associated physical page
- * and permissions set as bits in state field.
+ * Most of the range is checked with pt_check_range()
+ * and only pages it cannot decide on (copy-on-write pages
+ * are read-only in page tables and addresses above
+ * MAX_USER_ADDRESS are not backed by per-env page tables)
+ * are looked up in the virtual tree.
+ * Successfully checked range is cached in address space.
  *
  * Return 0 if check is passed or -E_FAULT if region
  * does not have enough permissions.
@@ -2186,8 +2504,24 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm) {
 
     int req_perm = perm | PROT_USER_;
     const uintptr_t page_size = CLASS_SIZE(0);
+    struct AddressSpace *spc = &env->address_space;
+
+    if (start >= spc->checked_start && end <= spc->checked_end &&
+        !(req_perm & ~spc->checked_perm))
+        return 0;
+
+    /* PROT_R is implied by presence and PROT_X can only
+     * be checked in page tables when NX bit is in use */
+    bool use_pt = !(req_perm & PROT_X) || nx_supported;
+    pte_t need = PTE_P | PTE_U | (req_perm & PROT_W ? PTE_W : 0);
+    pte_t forbid = req_perm & PROT_X ? PTE_NX : 0;
 
     for (uintptr_t addr = start; addr < end; ) {
+        if (use_pt && addr < MAX_USER_ADDRESS) {
+            addr = pt_check_range(spc, addr, MIN(end, MAX_USER_ADDRESS), need, forbid);
+            if (addr >= end) break;
+        }
+
         if (addr >= MAX_USER_READABLE) {
             user_mem_check_addr = addr;
             return -E_FAULT;
@@ -2196,7 +2530,7 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm) {
         uintptr_t page = addr & ~CLASS_MASK(0);
 
         struct Page *node =
-            page_lookup_virtual(env->address_space.root, page, 0, LOOKUP_PRESERVE);
+            page_lookup_virtual(spc->root, page, 0, LOOKUP_PRESERVE);
 
         if (!node || !node->phy) {
             user_mem_check_addr = addr;
@@ -2215,6 +2549,10 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm) {
             next = addr + 1;
         addr = next;
     }
+
+    spc->checked_start = start;
+    spc->checked_end = end;
+    spc->checked_perm = req_perm;
     return 0;
 }
 
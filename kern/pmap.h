@@ -66,6 +66,11 @@ void __nosan_memmove(void *, void *, size_t);
 /* (mapped directly to page table unused flags) */
 #define PROT_ALL 0xFFF
 
+/* Deferred address space teardown */
+#define RECLAIM_QUEUE_SIZE  NENV
+#define RECLAIM_TICK_BUDGET 512 /* Virtual tree nodes freed per timer tick */
+#define RECLAIM_ALL         ((size_t)-1)
+
 /* Maximal size of page allocated on pagefault */
 #define MAX_ALLOCATION_CLASS 9
 
@@ -81,9 +86,16 @@ enum PageState {
 extern __attribute__((aligned(HUGE_PAGE_SIZE))) uint8_t zero_page_raw[HUGE_PAGE_SIZE];
 extern __attribute__((aligned(HUGE_PAGE_SIZE))) uint8_t one_page_raw[HUGE_PAGE_SIZE];
 
+/* Descriptors refer to each other with 32-bit offsets from KERN_BASE_ADDR
+ * (alloc_page() places descriptor pools within BOOT_MEM_SIZE),
+ * 0 stands for NULL. Use desc_ptr()/desc_ref() to convert. */
+typedef uint32_t desc_ref_t;
+
+static_assert(BOOT_MEM_SIZE <= (1ULL << 32), "Descriptor pools must be reachable with 32-bit offsets");
+
 struct Page {
     struct List head; /* This should be first member */
-    struct Page *left, *right, *parent;
+    desc_ref_t left, right, parent;
     enum PageState state;
     union {
         struct /* physical page */ {
@@ -99,7 +111,18 @@ struct Page {
     };
 };
 
+struct ReclaimStats {
+    size_t queued;   /* Address spaces queued for teardown */
+    size_t released; /* Address spaces completely torn down */
+    size_t pages;    /* Mapped 4K pages returned */
+    size_t nodes;    /* Virtual tree nodes freed */
+    uint64_t cycles; /* TSC cycles spent in teardown */
+};
+
 struct PagePool {
+    struct List link;      /* Link in list of pools with free descriptors */
+    struct List free;      /* Free descriptors of this pool */
+    size_t nfree;          /* Length of free list */
     struct Page *peer;     /* Page from which memory is taken */
     struct PagePool *next; /* Next pool link */
     struct Page data[];    /* Page descriptors storage */
@@ -108,8 +131,15 @@ struct PagePool {
 int map_region(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, uintptr_t size, int flags);
 int map_physical_region(struct AddressSpace *dst, uintptr_t dstart, uintptr_t pstart, size_t size, int flags);
 void unmap_region(struct AddressSpace *dspace, uintptr_t dst, uintptr_t size);
+int move_region(struct AddressSpace *dspace, uintptr_t dst, struct AddressSpace *sspace, uintptr_t src, uintptr_t size, int flags);
+void tlb_batch_begin(void);
+void tlb_batch_end(void);
 void init_memory(void);
 void release_address_space(struct AddressSpace *space);
+size_t reclaim_address_spaces(size_t budget);
+size_t reclaim_queue_length(void);
+size_t free_memory_pages(void);
+void dump_reclaim_stats(void);
 struct AddressSpace *switch_address_space(struct AddressSpace *space);
 int init_address_space(struct AddressSpace *space);
 void user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
@@ -128,6 +158,7 @@ void *mmio_remap_last_region(physaddr_t addr, void *oldva, size_t oldsz, size_t
 extern struct AddressSpace kspace;
 extern struct AddressSpace *current_space;
 extern struct Page root;
+extern struct ReclaimStats reclaim_stats;
 extern char bootstacktop[], bootstack[];
 extern size_t max_memory_map_addr;
 
@@ -166,6 +197,23 @@ _kaddr(const char *file, int line, physaddr_t pa) {
 /* Number of PML4 entries taken by userspace */
 #define NUSERPML4 1
 
+inline static struct Page *__attribute__((always_inline))
+desc_ptr(desc_ref_t ref) {
+    return ref ? (struct Page *)(KERN_BASE_ADDR + (uintptr_t)ref) : NULL;
+}
+
+inline static desc_ref_t __attribute__((always_inline))
+desc_ref(struct Page *page) {
+    if (!page) return 0;
+    uintptr_t off = (uintptr_t)page - KERN_BASE_ADDR;
+    assert(off && off == (desc_ref_t)off);
+    return (desc_ref_t)off;
+}
+
+#define page_left(p)   desc_ptr((p)->left)
+#define page_right(p)  desc_ptr((p)->right)
+#define page_parent(p) desc_ptr((p)->parent)
+
 inline static physaddr_t __attribute__((always_inline))
 page2pa(struct Page *page) {
     return page->addr << CLASS_BASE;
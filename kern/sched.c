@@ -2,6 +2,8 @@
 #include <inc/x86.h>
 #include <kern/env.h>
 #include <kern/monitor.h>
+#include <kern/pmap.h>
+#include <kern/lathist.h>
 
 
 struct Taskstate cpu_ts;
@@ -47,6 +49,12 @@ sched_yield(void) {
 _Noreturn void
 sched_halt(void) {
 
+    lathist_trap_cancel();
+
+    /* Nothing else to do, so finish tearing down
+     * address spaces of exited environments */
+    reclaim_address_spaces(RECLAIM_ALL);
+
     /* For debugging and testing purposes, if there are no runnable
      * environments in the system, then drop into the kernel monitor */
     int i;
@@ -4,6 +4,8 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/sysring.h>
+#include <inc/mapvec.h>
 
 #include <kern/console.h>
 #include <kern/env.h>
@@ -12,6 +14,9 @@
 #include <kern/sched.h>
 #include <kern/syscall.h>
 #include <kern/trap.h>
+#include <kern/timekeep.h>
+#include <kern/ipc.h>
+#include <kern/lathist.h>
 #include <kern/traceopt.h>
 
 /* Print a string to the system console.
@@ -274,6 +279,92 @@ sys_unmap_region(envid_t envid, uintptr_t va, size_t size) {
     return 0;
 }
 
+/* Copy n descriptors from user memory at va and check them
+ * the same way sys_map_region() does; with unmap set only
+ * mv_dstva and mv_size are checked.
+ * Returns 0 on success, < 0 on error. */
+static int
+mapvec_fetch(struct MapVec *vec, uintptr_t va, size_t n, bool unmap) {
+    if (n > MAPVEC_MAX) return -E_INVAL;
+    if (user_mem_check(curenv, (void *)va, n * sizeof(*vec), PROT_R | PROT_USER_))
+        return -E_FAULT;
+    nosan_memcpy(vec, (void *)va, n * sizeof(*vec));
+
+    for (size_t i = 0; i < n; i++) {
+        struct MapVec *mv = &vec[i];
+        if (PAGE_OFFSET(mv->mv_dstva) || PAGE_OFFSET(mv->mv_size) ||
+            mv->mv_dstva >= MAX_USER_ADDRESS || mv->mv_size > MAX_USER_ADDRESS - mv->mv_dstva)
+            return -E_INVAL;
+        if (unmap) continue;
+        if (!mv->mv_size || PAGE_OFFSET(mv->mv_srcva) ||
+            mv->mv_srcva >= MAX_USER_ADDRESS || mv->mv_size > MAX_USER_ADDRESS - mv->mv_srcva ||
+            mv->mv_perm & (ALLOC_ZERO | ALLOC_ONE) || mv->mv_perm & ~PROT_ALL)
+            return -E_INVAL;
+    }
+
+    return 0;
+}
+
+/* Vectored sys_map_region(): map n regions described by
+ * struct MapVec array at 'vec' from srcenvid to dstenvid.
+ * All descriptors are checked before anything is mapped
+ * and TLB is invalidated once for the whole batch.
+ * If mapping of some region fails, regions before it stay mapped.
+ *
+ * Return 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
+ *      or the caller doesn't have permission to change one of them.
+ *  -E_INVAL if n > MAPVEC_MAX or any descriptor is invalid
+ *      (see sys_map_region).
+ *  -E_FAULT if descriptors are not readable.
+ *  -E_NO_MEM if there's no memory to map some of the regions. */
+static int
+sys_map_regionv(envid_t srcenvid, envid_t dstenvid, uintptr_t vec, size_t n) {
+    struct Env *srcenv, *dstenv;
+    struct MapVec mv[MAPVEC_MAX];
+
+    if (envid2env(srcenvid, &srcenv, 1) || envid2env(dstenvid, &dstenv, 1))
+        return -E_BAD_ENV;
+    int res = mapvec_fetch(mv, vec, n, 0);
+    if (res < 0) return res;
+
+    tlb_batch_begin();
+    for (size_t i = 0; i < n && !res; i++)
+        res = map_region(&dstenv->address_space, mv[i].mv_dstva, &srcenv->address_space,
+                         mv[i].mv_srcva, mv[i].mv_size, mv[i].mv_perm | PROT_USER_);
+    tlb_batch_end();
+
+    return res ? -E_NO_MEM : 0;
+}
+
+/* Vectored sys_unmap_region(): unmap n regions [mv_dstva, mv_dstva + mv_size)
+ * described by struct MapVec array at 'vec' from envid
+ * with a single TLB invalidation.
+ *
+ * Return 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid.
+ *  -E_INVAL if n > MAPVEC_MAX or any region is not page-aligned
+ *      or not a part of user space.
+ *  -E_FAULT if descriptors are not readable. */
+static int
+sys_unmap_regionv(envid_t envid, uintptr_t vec, size_t n) {
+    struct Env *env;
+    struct MapVec mv[MAPVEC_MAX];
+
+    if (envid2env(envid, &env, 1))
+        return -E_BAD_ENV;
+    int res = mapvec_fetch(mv, vec, n, 1);
+    if (res < 0) return res;
+
+    tlb_batch_begin();
+    for (size_t i = 0; i < n; i++)
+        if (mv[i].mv_size) unmap_region(&env->address_space, mv[i].mv_dstva, mv[i].mv_size);
+    tlb_batch_end();
+
+    return 0;
+}
+
 /* Map region of physical memory to the userspace address.
  * This is meant to be used by the userspace drivers, of which
  * the only one currently is the filesystem server.
@@ -326,6 +417,8 @@ sys_map_physical_region(uintptr_t pa, envid_t envid, uintptr_t va, size_t size,
  *
  * If the sender wants to send a page but the receiver isn't asking for one,
  * then no page mapping is transferred, but no error occurs.
+ * If perm has IPC_DONATE, transferred pages are moved from the sender
+ * to the receiver (see move_region()) instead of being shared.
  * The ipc only happens when no errors occur.
  * Send region size is the minimum of sized specified in sys_ipc_try_send() and sys_ipc_recv()
  *
@@ -367,7 +460,11 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
     {
         size_t min_size = MIN(targetenv->env_ipc_maxsz, size);
 
-        res = map_region(&targetenv->address_space, targetenv->env_ipc_dstva, &thisenv->address_space, srcva, min_size, perm | PROT_USER_);
+        /* Donated pages are moved instead of shared */
+        if (perm & IPC_DONATE)
+            res = move_region(&targetenv->address_space, targetenv->env_ipc_dstva, &thisenv->address_space, srcva, min_size, (perm & ~IPC_DONATE) | PROT_USER_);
+        else
+            res = map_region(&targetenv->address_space, targetenv->env_ipc_dstva, &thisenv->address_space, srcva, min_size, perm | PROT_USER_);
         // res = sys_map_region(envid, targetenv->env_ipc_dstva, curenv->env_id, srcva, min_size, perm);
         if (res < 0) 
             return res;
@@ -380,6 +477,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
 
     targetenv->env_ipc_recving = false;
     targetenv->env_ipc_value = value;
+    memset(targetenv->env_ipc_words, 0, sizeof(targetenv->env_ipc_words));
     targetenv->env_ipc_from = thisenv->env_id;
 
     targetenv->env_status = ENV_RUNNABLE;
@@ -387,6 +485,31 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
     return 0;
 }
 
+/* Send value and IPC_NWORDS words w0..w3 to envid the same way
+ * sys_ipc_try_send() sends a value without a page.  Receiver finds
+ * the words in its env_ipc_words.  No page tables are touched,
+ * which makes this a cheap path for small fixed-size messages.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *  -E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
+ *      or another environment managed to send first. */
+static int
+sys_ipc_send_words(envid_t envid, uint32_t value, uint64_t w0,
+                   uint64_t w1, uint64_t w2, uint64_t w3) {
+    struct Env *env;
+    if (envid2env(envid, &env, 0) < 0) return -E_BAD_ENV;
+
+    int res = sys_ipc_try_send(envid, value, MAX_USER_ADDRESS, 0, 0);
+    if (res < 0) return res;
+
+    env->env_ipc_words[0] = w0;
+    env->env_ipc_words[1] = w1;
+    env->env_ipc_words[2] = w2;
+    env->env_ipc_words[3] = w3;
+    return 0;
+}
+
 /* Block until a value is ready.  Record that you want to receive
  * using the env_ipc_recving, env_ipc_maxsz and env_ipc_dstva fields of struct Env,
  * mark yourself not runnable, and then give up the CPU.
@@ -399,7 +522,9 @@ sys_ipc_try_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, in
  * Return < 0 on error.  Errors are:
  *  -E_INVAL if dstva < MAX_USER_ADDRESS but dstva is not page-aligned;
  *  -E_INVAL if dstva is valid and maxsize is 0,
- *  -E_INVAL if maxsize is not page aligned. */
+ *  -E_INVAL if maxsize is not page aligned,
+ *  -E_IPC_NOTIFIED if IPC endpoint of the environment has
+ *      (or gets while waiting) notification bits, see sys_ipc_notify(). */
 static int
 sys_ipc_recv(uintptr_t dstva, uintptr_t maxsize) {
     // LAB 9: Your code here
@@ -414,6 +539,11 @@ sys_ipc_recv(uintptr_t dstva, uintptr_t maxsize) {
     }
     env->env_ipc_dstva = dstva;
     env->env_ipc_maxsz = maxsize;
+
+    /* Kernel messages are delivered without blocking */
+    if (mem_pressure_recv(env)) return 0;
+    if (ipc_notify_pending(env)) return -E_IPC_NOTIFIED;
+
     env->env_status = ENV_NOT_RUNNABLE;
     env->env_ipc_from = 0;
     env->env_ipc_recving = 1;
@@ -421,6 +551,82 @@ sys_ipc_recv(uintptr_t dstva, uintptr_t maxsize) {
     return 0;
 }
 
+/* Turn on queued IPC for the current environment (see inc/ipc.h).
+ * Regions sent along with messages are mapped into IPC_QUEUE_LEN
+ * slots of maxsz bytes starting at slots, if slots < MAX_USER_ADDRESS.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_INVAL if slots or maxsz are not page-aligned,
+ *      or slot area does not fit into user space. */
+static int
+sys_ipc_endpoint(uintptr_t slots, size_t maxsz) {
+    return ipc_endpoint(curenv, slots, maxsz);
+}
+
+/* Queue a message to envid's endpoint without blocking.
+ * If srcva < MAX_USER_ADDRESS region at srcva is mapped (or moved,
+ * with IPC_DONATE) into receiver's page slot with perm,
+ * like sys_ipc_try_send() does.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *  -E_IPC_NOT_RECV if envid has no endpoint,
+ *  -E_IPC_QUEUE_FULL if envid's queue is full,
+ *  -E_INVAL if srcva is not page-aligned,
+ *  -E_NO_MEM if there's not enough memory to map the region. */
+static int
+sys_ipc_queue_send(envid_t envid, uint32_t value, uintptr_t srcva, size_t size, int perm) {
+    struct Env *env;
+    if (envid2env(envid, &env, 0) < 0) return -E_BAD_ENV;
+
+    return ipc_queue_send(curenv, env, value, srcva, size, perm);
+}
+
+/* Receive up to n queued messages into msgs.
+ * If notify is not NULL pending notification bits are stored
+ * there and cleared.  If there's nothing to receive and block is set,
+ * sleeps until a message or notification arrives and returns 0.
+ *
+ * Returns number of received messages, < 0 on error.  Errors are:
+ *  -E_INVAL if current environment has no endpoint and n
+ *      is not 0 or notify is NULL,
+ *  -E_FAULT if msgs or notify are not writable. */
+static int
+sys_ipc_queue_recv(struct IpcMsg *msgs, size_t n, uint64_t *notify, bool block) {
+    n = MIN(n, IPC_QUEUE_LEN);
+    if (n && user_mem_check(curenv, msgs, n * sizeof(*msgs), PROT_W | PROT_USER_))
+        return -E_FAULT;
+    if (notify && user_mem_check(curenv, notify, sizeof(*notify), PROT_W | PROT_USER_))
+        return -E_FAULT;
+
+    return ipc_queue_recv(curenv, msgs, n, notify, block);
+}
+
+/* OR bits into notification mask of envid
+ * and wake it up if it sleeps in sys_ipc_queue_recv() or sys_ipc_recv().
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist. */
+static int
+sys_ipc_notify(envid_t envid, uint64_t bits) {
+    struct Env *env;
+    if (envid2env(envid, &env, 0) < 0) return -E_BAD_ENV;
+
+    return ipc_notify(env, bits);
+}
+
+/* Notify caller's endpoint with bits every period_ms milliseconds,
+ * period_ms == 0 stops notifications.
+ *
+ * Returns 0 on success, < 0 on error.  Errors are:
+ *  -E_IPC_NOT_RECV if caller has no endpoint,
+ *  -E_NO_MEM if all IPC_NTIMERS timers are in use,
+ *  -E_INVAL if period_ms is above IPC_TIMER_MAX_MS. */
+static int
+sys_ipc_timer(uint64_t bits, uint64_t period_ms) {
+    return ipc_timer(curenv, bits, period_ms);
+}
+
 /*
  * This function sets trapframe and is unsafe
  * so you need:
@@ -456,7 +662,127 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf) {
 static int
 sys_gettime(void) {
     // LAB 12: Your code here
-    return gettime();
+    return timekeep_realtime() / NSEC_PER_SEC;
+}
+
+/* Register envid as a reclaimable cache (or unregister it).
+ * Reclaimable environments receive IPC from envid 0 with
+ * number of pages to give back when memory runs low.
+ *
+ * Returns 0 on success, < 0 on error. Errors are:
+ *  -E_BAD_ENV if environment envid doesn't currently exist,
+ *      or the caller doesn't have permission to change envid. */
+static int
+sys_env_set_reclaimable(envid_t envid, bool on) {
+    struct Env *env;
+    if (envid2env(envid, &env, 1) < 0)
+        return -E_BAD_ENV;
+
+    env->env_mem_reclaimable = on;
+    return 0;
+}
+
+/* Register page at va as the system call ring of current environment.
+ * va >= MAX_USER_ADDRESS unregisters the ring.
+ *
+ * Returns 0 on success, < 0 on error. Errors are:
+ *  -E_INVAL if va is not page-aligned,
+ *  -E_FAULT if the page is not mapped writable. */
+static int
+sys_ring_setup(uintptr_t va) {
+    if (va >= MAX_USER_ADDRESS) {
+        curenv->env_ring = 0;
+        return 0;
+    }
+
+    if (PAGE_OFFSET(va)) return -E_INVAL;
+    if (user_mem_check(curenv, (void *)va, PAGE_SIZE, PROT_R | PROT_W | PROT_USER_))
+        return -E_FAULT;
+
+    curenv->env_ring = va;
+    return 0;
+}
+
+static uintptr_t syscall_dispatch(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3,
+                                  uintptr_t a4, uintptr_t a5, uintptr_t a6);
+
+/* Calls that can be queued into the system call ring:
+ * memory management and non-blocking IPC */
+static bool
+ring_op_allowed(uint32_t op) {
+    switch (op) {
+    case SYS_getenvid:
+    case SYS_alloc_region:
+    case SYS_map_region:
+    case SYS_map_physical_region:
+    case SYS_unmap_region:
+    case SYS_map_regionv:
+    case SYS_unmap_regionv:
+    case SYS_region_refs:
+    case SYS_ipc_try_send:
+    case SYS_ipc_send_words:
+    case SYS_ipc_queue_send:
+    case SYS_ipc_notify:
+        return 1;
+    }
+    return 0;
+}
+
+/* Execute up to to_submit entries queued in the system call ring
+ * in order, stopping early when the ring is empty or there is no
+ * space for completions.  If an entry with SQE_LINK fails,
+ * the following entry completes with -E_CANCELED.
+ *
+ * The ring is re-checked before each entry since queued calls
+ * are free to unmap it.
+ *
+ * Returns the number of consumed entries, < 0 on error. Errors are:
+ *  -E_INVAL if no ring is registered,
+ *  -E_FAULT if the ring is not accessible. */
+static int
+sys_ring_enter(size_t to_submit) {
+    struct SysRing *ring = (struct SysRing *)curenv->env_ring;
+    if (!ring) return -E_INVAL;
+
+    size_t done = 0;
+    bool cancel = 0;
+    for (; done < to_submit && done < SYSRING_SIZE; done++) {
+        if (user_mem_check(curenv, ring, sizeof(*ring), PROT_R | PROT_W | PROT_USER_))
+            return done ? (int)done : -E_FAULT;
+
+        uint32_t sq_head, sq_tail, cq_head, cq_tail;
+        nosan_memcpy(&sq_head, (void *)&ring->sq_head, sizeof(sq_head));
+        nosan_memcpy(&sq_tail, (void *)&ring->sq_tail, sizeof(sq_tail));
+        nosan_memcpy(&cq_head, (void *)&ring->cq_head, sizeof(cq_head));
+        nosan_memcpy(&cq_tail, (void *)&ring->cq_tail, sizeof(cq_tail));
+        if (sq_head == sq_tail || cq_tail - cq_head >= SYSRING_SIZE) break;
+
+        struct SysRingSqe sqe;
+        nosan_memcpy(&sqe, &ring->sq[sq_head % SYSRING_SIZE], sizeof(sqe));
+
+        struct SysRingCqe cqe = {.cqe_data = sqe.sqe_data};
+        if (cancel) {
+            cqe.cqe_res = -E_CANCELED;
+        } else if (!ring_op_allowed(sqe.sqe_op)) {
+            cqe.cqe_res = -E_NO_SYS;
+        } else {
+            /* Latency is accounted to the whole SYS_ring_enter */
+            cqe.cqe_res = (int64_t)syscall_dispatch(sqe.sqe_op, sqe.sqe_args[0], sqe.sqe_args[1], sqe.sqe_args[2],
+                                                    sqe.sqe_args[3], sqe.sqe_args[4], sqe.sqe_args[5]);
+        }
+        cancel = (sqe.sqe_flags & SQE_LINK) && cqe.cqe_res < 0;
+
+        /* Calls above could have unmapped the ring */
+        if (user_mem_check(curenv, ring, sizeof(*ring), PROT_R | PROT_W | PROT_USER_))
+            return (int)done + 1;
+
+        nosan_memcpy(&ring->cq[cq_tail % SYSRING_SIZE], &cqe, sizeof(cqe));
+        cq_tail++, sq_head++;
+        nosan_memcpy((void *)&ring->cq_tail, &cq_tail, sizeof(cq_tail));
+        nosan_memcpy((void *)&ring->sq_head, &sq_head, sizeof(sq_head));
+    }
+
+    return (int)done;
 }
 
 /*
@@ -477,9 +803,16 @@ sys_region_refs(uintptr_t addr, size_t size, uintptr_t addr2, uintptr_t size2) {
     }
 }
 
+/* Zero kernel latency histograms (see inc/lathist.h) */
+static int
+sys_lathist_reset(void) {
+    lathist_reset();
+    return 0;
+}
+
 /* Dispatches to the correct kernel function, passing the arguments. */
-uintptr_t
-syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
+static uintptr_t
+syscall_dispatch(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
     /* Call the function corresponding to the 'syscallno' parameter.
      * Return any appropriate return value. */
 
@@ -524,7 +857,43 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
             return sys_env_set_trapframe((envid_t) a1, (struct Trapframe *) a2);
         case SYS_gettime:
             return sys_gettime();
+        case SYS_env_set_reclaimable:
+            return sys_env_set_reclaimable((envid_t)a1, (bool)a2);
+        case SYS_ring_setup:
+            return sys_ring_setup(a1);
+        case SYS_ring_enter:
+            return sys_ring_enter((size_t)a1);
+        case SYS_ipc_endpoint:
+            return sys_ipc_endpoint(a1, (size_t)a2);
+        case SYS_ipc_queue_send:
+            return sys_ipc_queue_send((envid_t)a1, (uint32_t)a2, a3, (size_t)a4, (int)a5);
+        case SYS_ipc_queue_recv:
+            return sys_ipc_queue_recv((struct IpcMsg *)a1, (size_t)a2, (uint64_t *)a3, (bool)a4);
+        case SYS_ipc_notify:
+            return sys_ipc_notify((envid_t)a1, a2);
+        case SYS_ipc_send_words:
+            return sys_ipc_send_words((envid_t)a1, (uint32_t)a2, a3, a4, a5, a6);
+        case SYS_lathist_reset:
+            return sys_lathist_reset();
+        case SYS_map_regionv:
+            return sys_map_regionv((envid_t)a1, (envid_t)a2, a3, (size_t)a4);
+        case SYS_unmap_regionv:
+            return sys_unmap_regionv((envid_t)a1, a2, (size_t)a3);
+        case SYS_ipc_timer:
+            return sys_ipc_timer(a1, a2);
     }
 
     return -E_NO_SYS;
+}
+
+/* System call entry for both SYSCALL and int T_SYSCALL paths,
+ * accounting latency of each call.  Calls queued into the system
+ * call ring are not accounted separately, they are part of
+ * their SYS_ring_enter. */
+uintptr_t
+syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6) {
+    uint64_t start = read_tsc();
+    uintptr_t res = syscall_dispatch(syscallno, a1, a2, a3, a4, a5, a6);
+    lathist_syscall(syscallno, read_tsc() - start);
+    return res;
 }
\ No newline at end of file
@@ -0,0 +1,111 @@
+/*
+ * Kernel timekeeping.
+ *
+ * Wall clock is read from the CMOS RTC only once at boot (so it is
+ * accurate to a second).  Afterwards time is extrapolated from the TSC.
+ * TSC frequency measured at boot is only approximate, so every
+ * TIMEKEEP_CORRECT_TICKS timer ticks it is re-estimated against
+ * the HPET main counter which has exactly known period.
+ * Results are published to the UVSYS page for user-level clocks.
+ */
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/timekeep.h>
+#include <kern/vsyscall.h>
+#include <kern/kclock.h>
+#include <kern/timer.h>
+#include <kern/tsc.h>
+
+static uint64_t wall_offset; /* Unix time at boot in ns */
+static uint64_t hpet_freq;   /* HPET main counter frequency */
+static uint64_t hpet_boot;   /* HPET main counter at boot */
+
+/* Current extrapolation anchor */
+static uint64_t tsc_base;  /* TSC value at anchor */
+static uint64_t tsc_freq;  /* Estimated TSC frequency */
+static uint64_t mono_base; /* Nanoseconds since boot at anchor */
+static uint64_t hpet_base; /* HPET based time since boot at anchor, ns */
+
+static uint64_t ticks;
+
+struct TickStats tick_stats;
+
+static uint64_t
+hpet_ns(void) {
+    return (__uint128_t)(hpet_get_main_cnt() - hpet_boot) * NSEC_PER_SEC / hpet_freq;
+}
+
+static void
+timekeep_publish(void) {
+    vsys_publish(tsc_base, tsc_freq, mono_base, wall_offset, ticks);
+}
+
+void
+timekeep_init(void) {
+    hpet_freq = hpet_frequency();
+    assert(hpet_freq);
+    tsc_freq = tsc_calibrate();
+
+    wall_offset = (uint64_t)gettime() * NSEC_PER_SEC;
+    hpet_boot = hpet_get_main_cnt();
+    tsc_base = read_tsc();
+    mono_base = hpet_base = 0;
+
+    timekeep_publish();
+}
+
+/* Move the anchor to current moment and re-estimate TSC frequency
+ * from the interval since the previous one.  Time is never allowed
+ * to go backwards: if TSC was running ahead of HPET anchor is kept
+ * at TSC extrapolated value and the clock is slowed down a bit
+ * to absorb the difference during the next interval. */
+static void
+timekeep_correct(void) {
+    uint64_t tsc = read_tsc();
+    uint64_t hpet = hpet_ns();
+    uint64_t mono = mono_base + vsys_tsc2ns(tsc - tsc_base, tsc_freq);
+    uint64_t interval = hpet - hpet_base;
+
+    if (hpet > hpet_base) {
+        tsc_freq = (__uint128_t)(tsc - tsc_base) * NSEC_PER_SEC / interval;
+        if (mono > hpet && mono - hpet < interval / 2)
+            tsc_freq = (__uint128_t)tsc_freq * interval / (interval - (mono - hpet));
+    }
+
+    tsc_base = tsc;
+    hpet_base = hpet;
+    mono_base = MAX(mono, hpet);
+}
+
+/* Timer interrupt part of timekeeping: no device access
+ * except for HPET counter read on correction ticks */
+void
+timekeep_tick(void) {
+    uint64_t start = read_tsc();
+
+    ticks++;
+    if (!(ticks % TIMEKEEP_CORRECT_TICKS)) timekeep_correct();
+    timekeep_publish();
+
+    uint64_t cycles = read_tsc() - start;
+    tick_stats.count++;
+    tick_stats.cycles += cycles;
+    tick_stats.max = MAX(tick_stats.max, cycles);
+}
+
+uint64_t
+timekeep_monotonic(void) {
+    return mono_base + vsys_tsc2ns(read_tsc() - tsc_base, tsc_freq);
+}
+
+uint64_t
+timekeep_realtime(void) {
+    return wall_offset + timekeep_monotonic();
+}
+
+uint64_t
+timekeep_tsc_freq(void) {
+    return tsc_freq;
+}
@@ -0,0 +1,26 @@
+#ifndef JOS_KERN_TIMEKEEP_H
+#define JOS_KERN_TIMEKEEP_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+/* TSC frequency is re-estimated against HPET every this many ticks */
+#define TIMEKEEP_CORRECT_TICKS 4
+
+struct TickStats {
+    uint64_t count;  /* Timer ticks handled */
+    uint64_t cycles; /* Total TSC cycles spent in timekeep_tick() */
+    uint64_t max;    /* Longest timekeep_tick() */
+};
+
+extern struct TickStats tick_stats;
+
+void timekeep_init(void);
+void timekeep_tick(void);
+uint64_t timekeep_monotonic(void);
+uint64_t timekeep_realtime(void);
+uint64_t timekeep_tsc_freq(void);
+
+#endif /* !JOS_KERN_TIMEKEEP_H */
@@ -357,6 +357,12 @@ hpet_get_main_cnt(void) {
 }
 
 
+/* HPET main counter frequency in Hz */
+uint64_t
+hpet_frequency(void) {
+    return hpetFreq;
+}
+
 static inline uint64_t hpet_ticks_fs128(__uint128_t fs){
     return (uint64_t)(fs / (__uint128_t)hpetFemto);
 }
@@ -198,6 +198,8 @@ void hpet_print_reg(void);
 void hpet_enable_interrupts_tim0(void);
 void hpet_enable_interrupts_tim1(void);
 uint64_t hpet_cpu_frequency(void);
+uint64_t hpet_get_main_cnt(void);
+uint64_t hpet_frequency(void);
 void hpet_handle_interrupts_tim0(void);
 void hpet_handle_interrupts_tim1(void);
 
@@ -16,6 +16,9 @@
 #include <kern/picirq.h>
 #include <kern/timer.h>
 #include <kern/vsyscall.h>
+#include <kern/timekeep.h>
+#include <kern/lathist.h>
+#include <kern/ipc.h>
 #include <kern/traceopt.h>
 
 static struct Taskstate ts;
@@ -44,7 +47,7 @@ struct Pseudodesc idt_pd = {sizeof(idt) - 1, (uint64_t)idt};
  * In particular, the last argument to the SEG macro used in the
  * definition of gdt specifies the Descriptor Privilege Level (DPL)
  * of that descriptor: 0 for kernel and 3 for user. */
-struct Segdesc32 gdt[2 * NCPU + 7] = {
+struct Segdesc32 gdt[2 * NCPU + 8] = {
         /* 0x0 - unused (always faults -- for trapping NULL far pointers) */
         SEG_NULL,
         /* 0x8 - kernel code segment */
@@ -59,6 +62,10 @@ struct Segdesc32 gdt[2 * NCPU + 7] = {
         [GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xFFFFFFFF, 3),
         /* 0x30 - user data segment */
         [GD_UD >> 3] = SEG64(STA_W, 0x0, 0xFFFFFFFF, 3),
+        /* 0x38 - user code segment for SYSRET, which always loads
+         * CS with the selector following user data. It is execute only
+         * so that it can't be loaded into data segment registers */
+        [GD_UTS >> 3] = SEG64(STA_X, 0x0, 0xFFFFFFFF, 3),
         /* Per-CPU TSS descriptors (starting from GD_TSS0) are initialized
          * in trap_init_percpu() */
         [GD_TSS0 >> 3] = SEG_NULL,
@@ -124,6 +131,7 @@ trapname(int trapno) {
     extern void th_simderr(void);
     extern void th_syscall(void);
     extern void trap_syscall(void);
+    extern void syscall_entry(void);
     extern void trap_irq_timer(void);
     extern void trap_irq_clock(void);
     extern void trap_irq_spurious(void);
@@ -232,6 +240,16 @@ trap_init_percpu(void) {
 
     /* Load the IDT */
     lidt(&idt_pd);
+
+#ifndef CONFIG_KSPACE
+    /* Enable SYSCALL/SYSRET fast system call path.
+     * SYSCALL loads CS from STAR[47:32] and SS from the next descriptor,
+     * SYSRET loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16 */
+    wrmsr(EFER_MSR, rdmsr(EFER_MSR) | EFER_SCE);
+    wrmsr(STAR_MSR, (uint64_t)GD_UT << 48 | (uint64_t)GD_KT << 32);
+    wrmsr(LSTAR_MSR, (uintptr_t)syscall_entry);
+    wrmsr(FMASK_MSR, FL_IF | FL_DF | FL_TF | FL_AC | FL_NT);
+#endif
 }
 
 void
@@ -325,7 +343,10 @@ trap_dispatch(struct Trapframe *tf) {
         // LAB 5: Your code here
         // LAB 12: Your code here
         timer_for_schedule->handle_interrupts();
-        vsys[VSYS_gettime] = gettime();
+        timekeep_tick();
+        reclaim_address_spaces(RECLAIM_TICK_BUDGET);
+        mem_pressure_tick();
+        ipc_timer_tick();
         sched_yield();
         // LAB 12: Your code here
         return;
@@ -352,6 +373,8 @@ trap_dispatch(struct Trapframe *tf) {
 
 /* We do not support recursive page faults in-kernel */
 bool in_page_fault;
+/* Fault being handled came from user mode */
+bool in_user_page_fault;
 
 _Noreturn void
 trap(struct Trapframe *tf) {
@@ -372,11 +395,14 @@ trap(struct Trapframe *tf) {
     if (trace_traps) cprintf("Incoming TRAP[%ld] frame at %p\n", tf->tf_trapno, tf);
     if (trace_traps_more) print_trapframe(tf);
 
+    if (tf->tf_cs & 3) lathist_trap_enter(tf->tf_trapno);
+
     /* #PF should be handled separately */
     if (tf->tf_trapno == T_PGFLT) {
         assert(current_space);
         assert(!in_page_fault);
         in_page_fault = 1;
+        in_user_page_fault = tf->tf_cs & 3;
 
         uintptr_t va = rcr2();
 
@@ -411,8 +437,17 @@ trap(struct Trapframe *tf) {
         }
         if (!res) {
             in_page_fault = 0;
+            if (curenv) curenv->env_mem_retried = 0;
             env_pop_tf(tf);
         }
+
+        /* Out of memory: sleep until user-level caches
+         * give memory back and then retry the access */
+        if ((tf->tf_cs & 3) && curenv && curenv->env_mem_waiting) {
+            in_page_fault = 0;
+            curenv->env_tf = *tf;
+            sched_yield();
+        }
     }
 
     assert(curenv);
@@ -440,6 +475,41 @@ trap(struct Trapframe *tf) {
         sched_yield();
 }
 
+#ifndef CONFIG_KSPACE
+/* Handler for SYSCALL instruction.
+ * syscall_entry has already saved registers to curenv->env_tf,
+ * arguments are taken from there (second one from R10 instead of RCX) */
+_Noreturn void
+syscall_fast(void) {
+    static_assert(sizeof(struct Trapframe) == 192, "syscall_entry depends on trapframe size");
+    static_assert(!__builtin_offsetof(struct Env, env_tf), "syscall_entry depends on env_tf offset");
+
+    struct Trapframe *tf = &curenv->env_tf;
+
+    if (trace_traps) cprintf("Incoming SYSCALL[%ld] frame at %p\n", tf->tf_regs.reg_rax, tf);
+    last_tf = tf;
+
+    tf->tf_regs.reg_rax = syscall(
+            tf->tf_regs.reg_rax,
+            tf->tf_regs.reg_rdx,
+            tf->tf_regs.reg_r10,
+            tf->tf_regs.reg_rbx,
+            tf->tf_regs.reg_rdi,
+            tf->tf_regs.reg_rsi,
+            tf->tf_regs.reg_r8);
+
+    /* SYSRET can only return to an unmodified frame with canonical RIP,
+     * anything else (e.g. after sys_env_set_trapframe) goes through IRET */
+    if (curenv->env_status == ENV_RUNNING) {
+        if (tf->tf_cs == (GD_UT | 3) && tf->tf_ss == (GD_UD | 3) &&
+            tf->tf_rip < MAX_USER_ADDRESS)
+            env_sysret_tf(tf);
+        env_run(curenv);
+    }
+    sched_yield();
+}
+#endif
+
 static _Noreturn void
 page_fault_handler(struct Trapframe *tf) {
     uintptr_t cr2 = rcr2();
@@ -527,6 +597,11 @@ page_fault_handler(struct Trapframe *tf) {
     user_mem_assert(curenv, (void *)utf_addr, sizeof(struct UTrapframe), PROT_W | PROT_USER_);
     force_alloc_page(current_space, utf_addr, MAX_ALLOCATION_CLASS);
     force_alloc_page(current_space, utf_addr + sizeof(struct UTrapframe) - 1, MAX_ALLOCATION_CLASS);
+    if (curenv->env_mem_waiting) {
+        /* tf is still intact, fault will be retried after reclaim */
+        in_page_fault = 0;
+        sched_yield();
+    }
 
     struct UTrapframe utf;
     utf.utf_fault_va = fault_va;
@@ -14,10 +14,12 @@ extern struct Gatedesc idt[];
 extern struct Pseudodesc idt_pd;
 
 extern bool in_page_fault;
+extern bool in_user_page_fault;
 
 void clock_idt_init(void);
 void trap_init(void);
 void trap_init_percpu(void);
+_Noreturn void syscall_fast(void);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 
@@ -0,0 +1,24 @@
+/* Kernel side of the UVSYS data page */
+
+#include <kern/vsyscall.h>
+
+volatile struct VsysPage *vsys;
+
+/* Update clock parameters in the page under sequence lock.
+ * Values are computed by kern/timekeep.c */
+void
+vsys_publish(uint64_t tsc_base, uint64_t tsc_freq, uint64_t mono_base,
+             uint64_t wall_offset, uint64_t ticks) {
+    vsys->vs_seq++;
+    asm volatile("" ::: "memory");
+
+    vsys->vs_version = VSYS_VERSION;
+    vsys->vs_tsc_base = tsc_base;
+    vsys->vs_tsc_freq = tsc_freq;
+    vsys->vs_mono_base = mono_base;
+    vsys->vs_wall_offset = wall_offset;
+    vsys->vs_ticks = ticks;
+
+    asm volatile("" ::: "memory");
+    vsys->vs_seq++;
+}
@@ -1,6 +1,11 @@
 #ifndef JOS_KERN_VSYSCALL_H
 #define JOS_KERN_VSYSCALL_H
 
-extern volatile int *vsys;
+#include <inc/vsyscall.h>
+
+extern volatile struct VsysPage *vsys;
+
+void vsys_publish(uint64_t tsc_base, uint64_t tsc_freq, uint64_t mono_base,
+                  uint64_t wall_offset, uint64_t ticks);
 
 #endif
@@ -1,9 +1,5 @@
 #include <inc/lib.h>
 
-/* Maximum number of file descriptors a program may hold open concurrently */
-#define MAXFD 32
-/* Bottom of file descriptor area */
-#define FDTABLE 0xD0000000LL
 /* Bottom of file data area.  We reserve one data page for each FD,
  * which devices can use if they choose. */
 #define FILEDATA (FDTABLE + MAXFD * PAGE_SIZE)
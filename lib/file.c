@@ -4,17 +4,25 @@
 
 union Fsipc fsipcbuf __attribute__((aligned(PAGE_SIZE)));
 
+static envid_t
+fsipc_env(void) {
+    static envid_t fsenv;
+
+    if (!fsenv) fsenv = ipc_find_env(ENV_TYPE_FS);
+    return fsenv;
+}
+
 /* Send an inter-environment request to the file server, and wait for
  * a reply.  The request body should be in fsipcbuf, and parts of the
  * response may be written back to fsipcbuf.
  * type: request code, passed as the simple integer IPC value.
  * dstva: virtual address at which to receive reply page, 0 if none.
+ * Without reply page fsipcbuf is donated to the server, which
+ * donates it back with the reply, so neither side has to unmap it.
  * Returns result from the file server. */
 static int
 fsipc(unsigned type, void *dstva) {
-    static envid_t fsenv;
-
-    if (!fsenv) fsenv = ipc_find_env(ENV_TYPE_FS);
+    envid_t fsenv = fsipc_env();
 
     static_assert(sizeof(fsipcbuf) == PAGE_SIZE, "Invalid fsipcbuf size");
 
@@ -23,11 +31,170 @@ fsipc(unsigned type, void *dstva) {
                 thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
     }
 
-    ipc_send(fsenv, type, &fsipcbuf, PAGE_SIZE, PROT_RW);
     size_t maxsz = PAGE_SIZE;
+    if (!dstva) {
+        ipc_send(fsenv, type, &fsipcbuf, PAGE_SIZE, PROT_RW | IPC_DONATE);
+        return ipc_recv(NULL, &fsipcbuf, &maxsz, NULL);
+    }
+
+    ipc_send(fsenv, type, &fsipcbuf, PAGE_SIZE, PROT_RW);
     return ipc_recv(NULL, dstva, &maxsz, NULL);
 }
 
+/* Request ring shared with the file server, see struct FsRing */
+#define FSRING_VA ((struct FsRing *)0xCF000000)
+
+static envid_t fsring_owner;  /* Env that requested the ring at FSRING_VA */
+static struct FsRing *fsring; /* NULL if server gave us no ring */
+
+/* Returns request ring of this environment, setting it up
+ * at first call, or NULL if the old protocol has to be used. */
+static struct FsRing *
+fsring_get(void) {
+    if (fsring_owner == thisenv->env_id) return fsring;
+
+    /* Ring inherited with fork() or spawn() belongs to the parent */
+    sys_unmap_region(0, FSRING_VA, sizeof(struct FsRing));
+    fsring_owner = thisenv->env_id;
+    fsring = NULL;
+
+    uint64_t words[IPC_NWORDS] = {0};
+    ipc_send_words(fsipc_env(), FSREQ_RING_SETUP, words);
+
+    int perm = 0;
+    size_t maxsz = sizeof(struct FsRing);
+    if (ipc_recv(NULL, FSRING_VA, &maxsz, &perm) >= 0 && perm &&
+        maxsz == sizeof(struct FsRing))
+        fsring = FSRING_VA;
+
+    return fsring;
+}
+
+/* Fill entry idx (slot idx % FSRING_SIZE) of the next batch */
+static struct FsRingEntry *
+fsring_prepare(struct FsRing *ring, uint32_t idx, unsigned type,
+               int fileid, uint64_t arg, int flags) {
+    struct FsRingEntry *ent = &ring->fr_ent[idx % FSRING_SIZE];
+    ent->re_type = type;
+    ent->re_flags = flags;
+    ent->re_fileid = fileid;
+    ent->re_arg = arg;
+    return ent;
+}
+
+/* Submit n prepared entries and sleep until the server executes them */
+static void
+fsring_run(struct FsRing *ring, uint32_t n) {
+    uint32_t tail = ring->fr_tail + n;
+
+    __atomic_store_n(&ring->fr_tail, tail, __ATOMIC_RELEASE);
+    /* Pairs with the fence in server after setting fr_sleeping */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ring->fr_sleeping) sys_ipc_notify(fsipc_env(), 1);
+
+    uint64_t other = 0;
+    for (;;) {
+        __atomic_store_n(&ring->fr_waiting, 1, __ATOMIC_SEQ_CST);
+        /* If the server took the flag, its notification
+         * is on the way and has to be collected first */
+        if (__atomic_load_n(&ring->fr_head, __ATOMIC_ACQUIRE) == tail &&
+            __atomic_exchange_n(&ring->fr_waiting, 0, __ATOMIC_SEQ_CST)) break;
+
+        uint64_t bits;
+        while (ipc_queue_recv(NULL, 0, &bits) >= 0 && !(bits & FSRING_NOTIFY))
+            other |= bits;
+        other |= bits & ~FSRING_NOTIFY;
+    }
+
+    /* Give back notifications meant for the program */
+    if (other) sys_ipc_notify(thisenv->env_id, other);
+}
+
+/* Read through the ring, up to FSRING_SIZE linked slots per batch */
+static ssize_t
+fsring_read(struct FsRing *ring, struct Fd *fd, void *buf, size_t n) {
+    size_t size = 0;
+
+    while (n > 0) {
+        uint32_t base = ring->fr_tail, count = 0;
+        for (size_t left = n; left && count < FSRING_SIZE; count++) {
+            size_t chunk = MIN(left, PAGE_SIZE);
+            fsring_prepare(ring, base + count, FSREQ_READ, fd->fd_file.id,
+                           chunk, count ? FSRING_LINK : 0);
+            left -= chunk;
+        }
+        fsring_run(ring, count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            struct FsRingEntry *ent = &ring->fr_ent[(base + i) % FSRING_SIZE];
+            if (ent->re_res <= 0) return size ? (ssize_t)size : ent->re_res;
+
+            memcpy((char *)buf + size, ring->fr_data[(base + i) % FSRING_SIZE], ent->re_res);
+            size += ent->re_res;
+            n -= ent->re_res;
+            if ((uint64_t)ent->re_res < ent->re_arg) return size;
+        }
+    }
+
+    return size;
+}
+
+/* Write through the ring, up to FSRING_SIZE linked slots per batch */
+static ssize_t
+fsring_write(struct FsRing *ring, struct Fd *fd, const void *buf, size_t n) {
+    size_t size = 0;
+
+    while (n > 0) {
+        uint32_t base = ring->fr_tail, count = 0;
+        for (size_t off = 0; off < n && count < FSRING_SIZE; count++) {
+            size_t chunk = MIN(n - off, PAGE_SIZE);
+            memcpy(ring->fr_data[(base + count) % FSRING_SIZE], (const char *)buf + size + off, chunk);
+            fsring_prepare(ring, base + count, FSREQ_WRITE, fd->fd_file.id,
+                           chunk, count ? FSRING_LINK : 0);
+            off += chunk;
+        }
+        fsring_run(ring, count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            struct FsRingEntry *ent = &ring->fr_ent[(base + i) % FSRING_SIZE];
+            if (ent->re_res <= 0) return size ? (ssize_t)size : ent->re_res;
+
+            size += ent->re_res;
+            n -= ent->re_res;
+            if ((uint64_t)ent->re_res < ent->re_arg) return size;
+        }
+    }
+
+    return size;
+}
+
+/* Send a fixed-size request with IPC_NWORDS argument words to the
+ * file server and wait for a reply, which is stored back to words.
+ * Unlike fsipc() nothing gets mapped on either side.
+ * Returns result from the file server. */
+static int
+fsipc_words(unsigned type, uint64_t *words) {
+    if (debug) {
+        cprintf("[%08x] fsipc_words %d %08lx\n",
+                thisenv->env_id, type, (unsigned long)words[0]);
+    }
+
+    struct FsRing *ring = fsring_get();
+    if (ring) {
+        struct FsRingEntry *ent = fsring_prepare(ring, ring->fr_tail, type, words[0], words[1], 0);
+        fsring_run(ring, 1);
+        for (size_t i = 0; i < sizeof(ent->re_words) / sizeof(*ent->re_words); i++)
+            words[i] = ent->re_words[i];
+        return ent->re_res;
+    }
+
+    ipc_send_words(fsipc_env(), type, words);
+    int res = ipc_recv(NULL, NULL, NULL, NULL);
+    for (size_t i = 0; i < IPC_NWORDS; i++)
+        words[i] = thisenv->env_ipc_words[i];
+    return res;
+}
+
 static int devfile_flush(struct Fd *fd);
 static ssize_t devfile_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devfile_write(struct Fd *fd, const void *buf, size_t n);
@@ -96,8 +263,48 @@ open(const char *path, int mode) {
  * to disk. */
 static int
 devfile_flush(struct Fd *fd) {
-    fsipcbuf.flush.req_fileid = fd->fd_file.id;
-    return fsipc(FSREQ_FLUSH, NULL);
+    uint64_t words[IPC_NWORDS] = {fd->fd_file.id};
+    return fsipc_words(FSREQ_FLUSH, words);
+}
+
+/* Reads of at least this many bytes into page-aligned buffers
+ * at block-aligned offsets map file blocks instead of copying them */
+#define READ_MAP_MIN (4 * BLKSIZE)
+
+/* Mapping replaces the pages under buf, which only goes unnoticed
+ * for private writable memory.  Shared, device, read-only and
+ * copy-on-write pages are left to the copying path. */
+static bool
+read_map_private(void *buf, size_t n) {
+    for (size_t i = 0; i < n; i += PAGE_SIZE) {
+        pte_t pte = get_uvpt_entry((char *)buf + i);
+        if ((pte & (PTE_P | PTE_W | PTE_SHARE | PTE_PCD | PTE_PWT)) != (PTE_P | PTE_W)) return 0;
+    }
+    return 1;
+}
+
+/* Map whole file blocks at the current position over buf, which
+ * is page aligned, with FSREQ_READ_MAP requests.  Pages are
+ * copy-on-write, so buf stays private and writable.
+ * Returns the number of bytes mapped (maybe less than n). */
+static ssize_t
+devfile_read_map(struct Fd *fd, void *buf, size_t n) {
+    size_t size = 0;
+
+    while (n >= BLKSIZE) {
+        uint64_t words[IPC_NWORDS] = {fd->fd_file.id, n / BLKSIZE};
+        ipc_send_words(fsipc_env(), FSREQ_READ_MAP, words);
+
+        size_t maxsz = ROUNDDOWN(n, BLKSIZE);
+        int perm = 0;
+        int res = ipc_recv(NULL, (char *)buf + size, &maxsz, &perm);
+        if (res <= 0 || !perm) break;
+
+        size += res;
+        n -= res;
+    }
+
+    return size;
 }
 
 /* Read at most 'n' bytes from 'fd' at the current position into 'buf'.
@@ -112,9 +319,24 @@ devfile_read(struct Fd *fd, void *buf, size_t n) {
      * bytes read will be written back to fsipcbuf by the file
      * system server. */
 
+    size_t mapped = 0;
+    if (n >= READ_MAP_MIN && !((uintptr_t)buf % PAGE_SIZE) && !(fd->fd_offset % BLKSIZE) &&
+        read_map_private(buf, ROUNDDOWN(n, BLKSIZE))) {
+        mapped = devfile_read_map(fd, buf, n);
+        if (mapped == n) return n;
+        buf = (char *)buf + mapped;
+        n -= mapped;
+    }
+
+    struct FsRing *ring = fsring_get();
+    if (ring) {
+        ssize_t res = fsring_read(ring, fd, buf, n);
+        return mapped ? (ssize_t)mapped + MAX(res, 0) : res;
+    }
+
     // LAB 10: Your code here:
     int res = 0;
-    int size = 0;
+    int size = mapped;
     while (n > 0) {
         fsipcbuf.read.req_fileid = fd->fd_file.id;
         fsipcbuf.read.req_n = MIN(n, sizeof(fsipcbuf.readRet.ret_buf));
@@ -145,6 +367,9 @@ devfile_write(struct Fd *fd, const void *buf, size_t n) {
      * bytes than requested, so that multiple IPC requests are
      * potentially required. */
 
+    struct FsRing *ring = fsring_get();
+    if (ring) return fsring_write(ring, fd, buf, n);
+
     // LAB 10: Your code here:
     int res = 0;
     int size = 0;
@@ -167,13 +392,13 @@ devfile_write(struct Fd *fd, const void *buf, size_t n) {
 /* Get file information */
 static int
 devfile_stat(struct Fd *fd, struct Stat *st) {
-    fsipcbuf.stat.req_fileid = fd->fd_file.id;
-    int res = fsipc(FSREQ_STAT, NULL);
+    uint64_t words[IPC_NWORDS] = {fd->fd_file.id};
+    int res = fsipc_words(FSREQ_STAT, words);
     if (res < 0) return res;
 
-    strcpy(st->st_name, fsipcbuf.statRet.ret_name);
-    st->st_size = fsipcbuf.statRet.ret_size;
-    st->st_isdir = fsipcbuf.statRet.ret_isdir;
+    strcpy(st->st_name, fd->fd_file.name);
+    st->st_size = words[0];
+    st->st_isdir = words[1];
 
     return 0;
 }
@@ -181,10 +406,8 @@ devfile_stat(struct Fd *fd, struct Stat *st) {
 /* Truncate or extend an open file to 'size' bytes */
 static int
 devfile_trunc(struct Fd *fd, off_t newsize) {
-    fsipcbuf.set_size.req_fileid = fd->fd_file.id;
-    fsipcbuf.set_size.req_size = newsize;
-
-    return fsipc(FSREQ_SET_SIZE, NULL);
+    uint64_t words[IPC_NWORDS] = {fd->fd_file.id, newsize};
+    return fsipc_words(FSREQ_SET_SIZE, words);
 }
 
 /* Synchronize disk with buffer cache */
@@ -193,5 +416,59 @@ sync(void) {
     /* Ask the file server to update the disk
      * by writing any dirty blocks in the buffer cache. */
 
-    return fsipc(FSREQ_SYNC, NULL);
-}
\ No newline at end of file
+    uint64_t words[IPC_NWORDS] = {0};
+    return fsipc_words(FSREQ_SYNC, words);
+}
+
+/* Get file server block cache counters */
+int
+fs_cache_stat(struct FsCacheStat *stat) {
+    uint64_t words[IPC_NWORDS] = {0};
+    int res = fsipc_words(FSREQ_CACHE_STAT, words);
+    if (res < 0) return res;
+
+    stat->cs_hits = words[0];
+    stat->cs_misses = words[1];
+    stat->cs_evictions = words[2];
+    stat->cs_resident = words[3];
+    stat->cs_budget = res;
+    return 0;
+}
+
+/* Replace file server block cache budget (in blocks).
+ * Returns the new budget, fails with -E_BAD_ENV
+ * unless the caller was started by the kernel. */
+int
+fs_cache_budget(size_t budget) {
+    uint64_t words[IPC_NWORDS] = {budget};
+    return fsipc_words(FSREQ_CACHE_BUDGET, words);
+}
+
+/* Get file server dentry cache counters */
+int
+fs_dentry_stat(struct FsDentryStat *stat) {
+    uint64_t words[IPC_NWORDS] = {0};
+    int res = fsipc_words(FSREQ_DENTRY_STAT, words);
+    if (res < 0) return res;
+
+    stat->ds_hits = words[0];
+    stat->ds_neg_hits = words[1];
+    stat->ds_misses = words[2];
+    stat->ds_flushes = words[3];
+    return 0;
+}
+
+/* Run NVMe throughput benchmark in the file server,
+ * see FSREQ_NVME_BENCH */
+int
+fs_nvme_bench(struct FsBench *bench) {
+    uint64_t words[IPC_NWORDS] = {bench->fb_depth | (bench->fb_write ? FSBENCH_WRITE : 0),
+                                  bench->fb_iosize};
+    int res = fsipc_words(FSREQ_NVME_BENCH, words);
+    if (res < 0) return res;
+
+    bench->fb_nsec = words[0];
+    bench->fb_bytes = words[1];
+    bench->fb_doorbells = words[2];
+    return 0;
+}
@@ -67,6 +67,22 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, size_t size, int perm) {
     }
 }
 
+/* Like ipc_send() without a page, but also passes IPC_NWORDS
+ * words which receiver finds in thisenv->env_ipc_words */
+void
+ipc_send_words(envid_t to_env, uint32_t val, const uint64_t *words) {
+    for (;;) {
+        int r = sys_ipc_send_words(to_env, val, words);
+        if (r == 0)
+            return;
+        if (r == -E_IPC_NOT_RECV) {
+            sys_yield();
+            continue;
+        }
+        panic("ipc_send_words: %i", r);
+    }
+}
+
 /* Find the first environment of the given type.  We'll use this to
  * find special environments.
  * Returns 0 if no such environment exists. */
@@ -76,4 +92,19 @@ ipc_find_env(enum EnvType type) {
         if (envs[i].env_type == type)
             return envs[i].env_id;
     return 0;
-}
\ No newline at end of file
+}
+
+/* Receive up to n messages from the IPC endpoint of this environment
+ * (see sys_ipc_endpoint()), sleeping until at least one message
+ * or, if notify is not NULL, a notification arrives.
+ * Returns number of received messages or < 0 on error. */
+int
+ipc_queue_recv(struct IpcMsg *msgs, size_t n, uint64_t *notify) {
+    int res;
+
+    if (notify) *notify = 0;
+    while (!(res = sys_ipc_queue_recv(msgs, n, notify, 1)))
+        if (notify && *notify) break;
+
+    return res;
+}
@@ -0,0 +1,55 @@
+/* Batching of memory mapping calls into vectored system calls.
+ * Adjacent regions with the same protection are merged,
+ * the batch is flushed when it runs out of descriptors. */
+
+#include <inc/lib.h>
+
+void
+mapvec_init(struct MapVecBatch *batch, envid_t src_env, envid_t dst_env, bool unmap) {
+    batch->mb_srcenv = src_env;
+    batch->mb_dstenv = dst_env;
+    batch->mb_unmap = unmap;
+    batch->mb_count = 0;
+}
+
+/* Queue mapping of [src_pg, src_pg + size) at dst_pg with perm
+ * (src_pg and perm are ignored for unmap batches).
+ * Returns result of the flush if the batch had to be flushed. */
+int
+mapvec_add(struct MapVecBatch *batch, void *src_pg, void *dst_pg, size_t size, int perm) {
+    if (batch->mb_unmap) src_pg = dst_pg, perm = 0;
+
+    if (batch->mb_count) {
+        struct MapVec *last = &batch->mb_vec[batch->mb_count - 1];
+        if (last->mv_perm == perm &&
+            last->mv_srcva + last->mv_size == (uintptr_t)src_pg &&
+            last->mv_dstva + last->mv_size == (uintptr_t)dst_pg) {
+            last->mv_size += size;
+            return 0;
+        }
+    }
+
+    int res = 0;
+    if (batch->mb_count == MAPVEC_MAX && (res = mapvec_flush(batch)) < 0)
+        return res;
+
+    batch->mb_vec[batch->mb_count++] = (struct MapVec){
+            .mv_srcva = (uintptr_t)src_pg,
+            .mv_dstva = (uintptr_t)dst_pg,
+            .mv_size = size,
+            .mv_perm = perm,
+    };
+    return 0;
+}
+
+/* Apply all queued descriptors with a single system call */
+int
+mapvec_flush(struct MapVecBatch *batch) {
+    if (!batch->mb_count) return 0;
+
+    size_t n = batch->mb_count;
+    batch->mb_count = 0;
+    if (batch->mb_unmap)
+        return sys_unmap_regionv(batch->mb_dstenv, batch->mb_vec, n);
+    return sys_map_regionv(batch->mb_srcenv, batch->mb_dstenv, batch->mb_vec, n);
+}
@@ -38,6 +38,9 @@ static const char *const error_string[MAXERROR] = {
         [E_FILE_EXISTS] = "file already exists",
         [E_NOT_EXEC] = "file is not a valid executable",
         [E_NOT_SUPP] = "operation not supported",
+        [E_CANCELED] = "operation canceled",
+        [E_IPC_QUEUE_FULL] = "env's IPC queue is full",
+        [E_IPC_NOTIFIED] = "interrupted by IPC notification",
 };
 
 /*
@@ -128,7 +128,10 @@ spawn(const char *prog, const char **argv) {
     close(fd);
 
     /* Copy shared library state. */
-    if ((res = foreach_shared_region(copy_shared_region, &child)) < 0)
+    struct MapVecBatch shared;
+    mapvec_init(&shared, 0, child, 0);
+    if ((res = foreach_shared_region(copy_shared_region, &shared)) < 0 ||
+        (res = mapvec_flush(&shared)) < 0)
         panic("copy_shared_region: %i", res);
 
     if ((res = sys_env_set_trapframe(child, &child_tf)) < 0)
@@ -256,8 +259,7 @@ error:
 
 static int
 copy_shared_region(void *start, void *end, void *arg) {
-    envid_t child = *(envid_t *)arg;
-    return sys_map_region(0, start, child, start, end - start, get_prot(start));
+    return mapvec_add(arg, start, start, end - start, get_prot(start));
 }
 
 
@@ -286,27 +288,33 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
     /* read filesz to UTEMP */
     /* Map read section conents to child */
     /* Unmap it from parent */
+    /* Memory management calls are batched through the system call ring:
+     * moving a page to child, unmapping it and allocating UTEMP
+     * for the next one takes a single kernel entry */
+    if (filesz && (res = sys_alloc_region(0, UTEMP, PAGE_SIZE, PTE_SYSCALL)) < 0)
+        return res;
+
     for (unsigned pt = 0; pt < memsz; pt += PAGE_SIZE) {
-		if (pt >= filesz) {
-            if ((res = sys_alloc_region(child, (void*) (va + pt), PAGE_SIZE, perm)) < 0) 
+        if (pt >= filesz) {
+            if ((res = sysring_alloc_region(child, (void *)(va + pt), PAGE_SIZE, perm, 0)) < 0)
                 return res;
         } else {
-            if ((res = sys_alloc_region(0, UTEMP, PAGE_SIZE, PTE_SYSCALL)) < 0) 
+            if ((res = seek(fd, fileoffset + pt)) < 0)
                 return res;
 
-            if ((res = seek(fd, fileoffset + pt)) < 0) 
+            if ((res = readn(fd, UTEMP, MIN(PAGE_SIZE, filesz - pt))) < 0)
                 return res;
 
-            if ((res = readn(fd, UTEMP, MIN(PAGE_SIZE, filesz - pt))) < 0) 
-                return res;
-            
-            if ((res = sys_map_region(0, UTEMP, child, (void*) va + pt, PAGE_SIZE, perm)) < 0) 
+            bool more = pt + PAGE_SIZE < filesz;
+            if ((res = sysring_map_region(0, UTEMP, child, (void *)va + pt, PAGE_SIZE, perm, SQE_LINK)) < 0 ||
+                (res = sysring_unmap_region(0, UTEMP, PAGE_SIZE, more ? SQE_LINK : 0)) < 0 ||
+                (more && (res = sysring_alloc_region(0, UTEMP, PAGE_SIZE, PTE_SYSCALL, 0)) < 0))
                 return res;
 
-            if ((res = sys_unmap_region(0, UTEMP, PAGE_SIZE)) < 0) 
+            if ((res = sysring_run()) < 0)
                 return res;
-		}
-	}
+        }
+    }
 
-    return 0;
+    return sysring_run();
 }
\ No newline at end of file
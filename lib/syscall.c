@@ -9,17 +9,19 @@ syscall(uintptr_t num, bool check, uintptr_t a1, uintptr_t a2, uintptr_t a3, uin
 
     /* Generic system call.
      * Pass system call number in RAX,
-     * Up to six parameters in RDX, RCX, RBX, RDI, RSI and R8.
+     * Up to six parameters in RDX, R10, RBX, RDI, RSI and R8.
+     * (Kernel entered with "int T_SYSCALL" takes second parameter
+     * from RCX instead, but SYSCALL instruction overwrites it with RIP)
      *
      * Registers are assigned using GCC externsion
      */
 
     register uintptr_t _a0 asm("rax") = num,
-                           _a1 asm("rdx") = a1, _a2 asm("rcx") = a2,
+                           _a1 asm("rdx") = a1, _a2 asm("r10") = a2,
                            _a3 asm("rbx") = a3, _a4 asm("rdi") = a4,
                            _a5 asm("rsi") = a5, _a6 asm("r8") = a6;
 
-    /* Interrupt kernel with T_SYSCALL.
+    /* Enter kernel with SYSCALL instruction.
      *
      * The "volatile" tells the assembler not to optimize
      * this instruction away just because we don't use the
@@ -27,12 +29,13 @@ syscall(uintptr_t num, bool check, uintptr_t a1, uintptr_t a2, uintptr_t a3, uin
      *
      * The last clause tells the assembler that this can
      * potentially change the condition codes and arbitrary
-     * memory locations. */
+     * memory locations.  RCX and R11 are used by the CPU
+     * to hold return address and flags. */
 
-    asm volatile("int %1\n"
+    asm volatile("syscall\n"
                  : "=a"(ret)
-                 : "i"(T_SYSCALL), "r"(_a0), "r"(_a1), "r"(_a2), "r"(_a3), "r"(_a4), "r"(_a5), "r"(_a6)
-                 : "cc", "memory");
+                 : "r"(_a0), "r"(_a1), "r"(_a2), "r"(_a3), "r"(_a4), "r"(_a5), "r"(_a6)
+                 : "rcx", "r11", "cc", "memory");
 
     if (check && ret > 0) {
         panic("syscall %zd returned %zd (> 0)", num, ret);
@@ -99,6 +102,17 @@ sys_map_region(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, size_t
     return res;
 }
 
+int
+sys_map_regionv(envid_t srcenv, envid_t dstenv, const struct MapVec *vec, size_t n) {
+    int res = syscall(SYS_map_regionv, 1, srcenv, dstenv, (uintptr_t)vec, n, 0, 0);
+#ifdef SANITIZE_USER_SHADOW_BASE
+    if (!res && dstenv == CURENVID)
+        for (size_t i = 0; i < n; i++)
+            platform_asan_unpoison((void *)vec[i].mv_dstva, vec[i].mv_size);
+#endif
+    return res;
+}
+
 int
 sys_map_physical_region(uintptr_t pa, envid_t dstenv, void *dstva, size_t size, int perm) {
     int res = syscall(SYS_map_physical_region, 1, pa, dstenv, (uintptr_t)dstva, size, perm, 0);
@@ -137,11 +151,35 @@ sys_env_set_pgfault_upcall(envid_t envid, void *upcall) {
     return syscall(SYS_env_set_pgfault_upcall, 1, envid, (uintptr_t)upcall, 0, 0, 0, 0);
 }
 
+int
+sys_env_set_reclaimable(envid_t envid, bool on) {
+    return syscall(SYS_env_set_reclaimable, 1, envid, on, 0, 0, 0, 0);
+}
+
+int
+sys_unmap_regionv(envid_t envid, const struct MapVec *vec, size_t n) {
+    int res = syscall(SYS_unmap_regionv, 1, envid, (uintptr_t)vec, n, 0, 0, 0);
+#ifdef SANITIZE_USER_SHADOW_BASE
+    for (size_t i = 0; !res && i < n; i++) {
+        uintptr_t va = vec[i].mv_dstva;
+        if (va < SANITIZE_USER_SHADOW_BASE || va >= SANITIZE_USER_SHADOW_SIZE + SANITIZE_USER_SHADOW_BASE)
+            platform_asan_poison((void *)va, vec[i].mv_size);
+    }
+#endif
+    return res;
+}
+
 int
 sys_ipc_try_send(envid_t envid, uintptr_t value, void *srcva, size_t size, int perm) {
     return syscall(SYS_ipc_try_send, 0, envid, value, (uintptr_t)srcva, size, perm, 0);
 }
 
+int
+sys_ipc_send_words(envid_t envid, uint32_t value, const uint64_t *words) {
+    return syscall(SYS_ipc_send_words, 0, envid, value,
+                   words[0], words[1], words[2], words[3]);
+}
+
 int
 sys_ipc_recv(void *dstva, size_t size) {
     int res = syscall(SYS_ipc_recv, 1, (uintptr_t)dstva, size, 0, 0, 0, 0);
@@ -151,7 +189,47 @@ sys_ipc_recv(void *dstva, size_t size) {
     return res;
 }
 
+int
+sys_lathist_reset(void) {
+    return syscall(SYS_lathist_reset, 0, 0, 0, 0, 0, 0, 0);
+}
+
 int
 sys_gettime(void) {
     return syscall(SYS_gettime, 0, 0, 0, 0, 0, 0, 0);
 }
+
+int
+sys_ring_setup(void *va) {
+    return syscall(SYS_ring_setup, 1, (uintptr_t)va, 0, 0, 0, 0, 0);
+}
+
+int
+sys_ring_enter(size_t to_submit) {
+    return syscall(SYS_ring_enter, 0, to_submit, 0, 0, 0, 0, 0);
+}
+
+int
+sys_ipc_endpoint(void *slots, size_t maxsz) {
+    return syscall(SYS_ipc_endpoint, 1, (uintptr_t)slots, maxsz, 0, 0, 0, 0);
+}
+
+int
+sys_ipc_queue_send(envid_t envid, uint32_t value, void *srcva, size_t size, int perm) {
+    return syscall(SYS_ipc_queue_send, 0, envid, value, (uintptr_t)srcva, size, perm, 0);
+}
+
+int
+sys_ipc_queue_recv(struct IpcMsg *msgs, size_t n, uint64_t *notify, bool block) {
+    return syscall(SYS_ipc_queue_recv, 0, (uintptr_t)msgs, n, (uintptr_t)notify, block, 0, 0);
+}
+
+int
+sys_ipc_notify(envid_t envid, uint64_t bits) {
+    return syscall(SYS_ipc_notify, 0, envid, bits, 0, 0, 0, 0);
+}
+
+int
+sys_ipc_timer(uint64_t bits, uint64_t period_ms) {
+    return syscall(SYS_ipc_timer, 0, bits, period_ms, 0, 0, 0, 0);
+}
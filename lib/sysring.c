@@ -0,0 +1,103 @@
+/* Batched system calls through the kernel system call ring. */
+
+#include <inc/lib.h>
+
+static struct SysRing ring __attribute__((aligned(PAGE_SIZE)));
+
+/* Ring is registered per environment, so forked child
+ * has to register its copy again */
+static envid_t ring_owner;
+
+/* Number of queued entries whose completions are not reaped yet */
+static uint32_t ring_inflight;
+
+static struct SysRingSqe *
+sysring_get_sqe(int *res) {
+    if (ring_owner != thisenv->env_id) {
+        if ((*res = sys_ring_setup(&ring)) < 0) return NULL;
+        ring.sq_head = ring.sq_tail = 0;
+        ring.cq_head = ring.cq_tail = 0;
+        ring_inflight = 0;
+        ring_owner = thisenv->env_id;
+    }
+
+    /* Flush the ring if there's no space left for a completion */
+    if (ring_inflight == SYSRING_SIZE && (*res = sysring_run()) < 0)
+        return NULL;
+
+    ring_inflight++;
+    return &ring.sq[ring.sq_tail % SYSRING_SIZE];
+}
+
+static int
+sysring_queue(uint32_t op, int flags, uint64_t a1, uint64_t a2,
+              uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    int res = 0;
+    struct SysRingSqe *sqe = sysring_get_sqe(&res);
+    if (!sqe) return res;
+
+    sqe->sqe_op = op;
+    sqe->sqe_flags = flags;
+    sqe->sqe_args[0] = a1;
+    sqe->sqe_args[1] = a2;
+    sqe->sqe_args[2] = a3;
+    sqe->sqe_args[3] = a4;
+    sqe->sqe_args[4] = a5;
+    sqe->sqe_args[5] = a6;
+    sqe->sqe_data = ring.sq_tail;
+    ring.sq_tail++;
+
+    return 0;
+}
+
+/* Queue sys_alloc_region() call.
+ * flags can contain SQE_LINK to cancel the next queued call
+ * in case this one fails. */
+int
+sysring_alloc_region(envid_t env, void *pg, size_t size, int perm, int flags) {
+    return sysring_queue(SYS_alloc_region, flags, env, (uintptr_t)pg, size, perm, 0, 0);
+}
+
+/* Queue sys_map_region() call */
+int
+sysring_map_region(envid_t src_env, void *src_pg, envid_t dst_env,
+                   void *dst_pg, size_t size, int perm, int flags) {
+    return sysring_queue(SYS_map_region, flags, src_env, (uintptr_t)src_pg,
+                         dst_env, (uintptr_t)dst_pg, size, perm);
+}
+
+/* Queue sys_unmap_region() call */
+int
+sysring_unmap_region(envid_t env, void *pg, size_t size, int flags) {
+    return sysring_queue(SYS_unmap_region, flags, env, (uintptr_t)pg, size, 0, 0, 0);
+}
+
+/* Queue sys_ipc_try_send() call */
+int
+sysring_ipc_try_send(envid_t to_env, uint64_t value, void *pg,
+                     size_t size, int perm, int flags) {
+    return sysring_queue(SYS_ipc_try_send, flags, to_env, value, (uintptr_t)pg, size, perm, 0);
+}
+
+/* Execute all queued calls with a single kernel entry
+ * (more if queue was not drained in one go).
+ * Returns result of the first failed call or 0 if all of them succeeded. */
+int
+sysring_run(void) {
+    int res = 0;
+
+    while (ring.sq_head != ring.sq_tail) {
+        int n = sys_ring_enter(ring.sq_tail - ring.sq_head);
+        if (n < 0) return n;
+        if (!n) break;
+    }
+
+    while (ring.cq_head != ring.cq_tail) {
+        struct SysRingCqe *cqe = &ring.cq[ring.cq_head % SYSRING_SIZE];
+        if (cqe->cqe_res < 0 && !res) res = cqe->cqe_res;
+        ring.cq_head++;
+        ring_inflight--;
+    }
+
+    return res;
+}
@@ -1,16 +1,53 @@
 #include <inc/vsyscall.h>
 #include <inc/lib.h>
+#include <inc/x86.h>
 
-static inline uint64_t
-vsyscall(int num) {
-    // LAB 12: Your code here
-    int res;
-    while ((res = vsys[num]) == 0)
-        sys_yield();
-    return res;
+/* Read clock from the UVSYS page without entering the kernel */
+int
+clock_gettime(int clock, struct timespec *ts) {
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC)
+        return -E_INVAL;
+
+    /* Kernel with different page layout */
+    if (vsys.vs_version != VSYS_VERSION) {
+        if (clock != CLOCK_REALTIME) return -E_NOT_SUPP;
+        ts->tv_sec = sys_gettime();
+        ts->tv_nsec = 0;
+        return 0;
+    }
+
+    uint64_t ns;
+    uint32_t seq;
+    do {
+        seq = vsys_read_begin(&vsys);
+        ns = vsys.vs_mono_base + vsys_tsc2ns(read_tsc() - vsys.vs_tsc_base, vsys.vs_tsc_freq);
+        if (clock == CLOCK_REALTIME) ns += vsys.vs_wall_offset;
+    } while (vsys_read_retry(&vsys, seq));
+
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+    return 0;
 }
 
 int
 vsys_gettime(void) {
-    return vsyscall(VSYS_gettime);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec;
+}
+
+envid_t
+vsys_getenvid(void) {
+    return vsys.vs_curenv;
+}
+
+uint64_t
+vsys_ticks(void) {
+    uint64_t ticks;
+    uint32_t seq;
+    do {
+        seq = vsys_read_begin(&vsys);
+        ticks = vsys.vs_ticks;
+    } while (vsys_read_retry(&vsys, seq));
+    return ticks;
 }
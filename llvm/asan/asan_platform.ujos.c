@@ -100,8 +100,8 @@ asan_shadow_allocator(struct UTrapframe *utf) {
 #endif
 
 
-/* envs and vsyscall page shadow */
-#define SANITIZE_USER_EXTRA_SHADOW_BASE (ROUNDDOWN(MIN(UENVS, UVSYS) >> 3, PAGE_SIZE) + SANITIZE_USER_SHADOW_OFF)
+/* envs, vsyscall and latency histogram pages shadow */
+#define SANITIZE_USER_EXTRA_SHADOW_BASE (ROUNDDOWN(MIN(UENVS, ULATHIST) >> 3, PAGE_SIZE) + SANITIZE_USER_SHADOW_OFF)
 #define SANITIZE_USER_EXTRA_SHADOW_SIZE (ROUNDUP(MAX(UVSYS + PAGE_SIZE, UENVS + NENV * sizeof(struct Env)) >> 3, PAGE_SIZE) + SANITIZE_USER_SHADOW_OFF - SANITIZE_USER_EXTRA_SHADOW_BASE)
 
 /* UVPT is located at another specific address space */
@@ -172,7 +172,8 @@ platform_asan_init(void) {
 
     // TODO NOTE: LAB 12 code may be here
 #if LAB >= 12
-    platform_asan_unpoison((void *)UVSYS, NVSYSCALLS * sizeof(int));
+    platform_asan_unpoison((void *)UVSYS, sizeof(struct VsysPage));
+    platform_asan_unpoison((void *)ULATHIST, sizeof(struct LatHistPage));
 #endif
 
     /* 4. Shared pages */
@@ -0,0 +1,81 @@
+/* Test file server block cache eviction: write and read back
+ * a file several times larger than a minimal cache budget */
+
+#include <inc/lib.h>
+
+#define NBLOCKS 64
+#define BUDGET  16
+
+static char buf[BLKSIZE];
+
+static void
+print_stat(const char *when, struct FsCacheStat *st) {
+    cprintf("%s: budget %lu resident %lu hits %lu misses %lu evictions %lu\n", when,
+            (unsigned long)st->cs_budget, (unsigned long)st->cs_resident,
+            (unsigned long)st->cs_hits, (unsigned long)st->cs_misses,
+            (unsigned long)st->cs_evictions);
+}
+
+void
+umain(int argc, char **argv) {
+    struct FsCacheStat before, after;
+    int fd, res;
+
+    if ((res = fs_cache_stat(&before)) < 0)
+        panic("fs_cache_stat: %i", res);
+    print_stat("before", &before);
+
+    /* Shrink the cache below the size of the file */
+    struct FsCacheStat small;
+    if ((res = fs_cache_budget(BUDGET)) < 0)
+        panic("fs_cache_budget: %i", res);
+    if ((res = fs_cache_stat(&small)) < 0)
+        panic("fs_cache_stat: %i", res);
+    if (small.cs_budget != BUDGET || small.cs_resident > BUDGET)
+        panic("budget %lu resident %lu", (unsigned long)small.cs_budget, (unsigned long)small.cs_resident);
+
+    if ((fd = open("/bccache", O_RDWR | O_CREAT | O_TRUNC)) < 0)
+        panic("open: %i", fd);
+    for (int i = 0; i < NBLOCKS; i++) {
+        memset(buf, 'a' + i % 26, sizeof(buf));
+        if ((res = write(fd, buf, sizeof(buf))) != sizeof(buf))
+            panic("write block %d: %i", i, res);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        if ((res = seek(fd, 0)) < 0) panic("seek: %i", res);
+        for (int i = 0; i < NBLOCKS; i++) {
+            if ((res = readn(fd, buf, sizeof(buf))) != sizeof(buf))
+                panic("read block %d: %i", i, res);
+            for (size_t j = 0; j < sizeof(buf); j++)
+                if (buf[j] != 'a' + i % 26) panic("block %d: bad byte at %zu", i, j);
+        }
+    }
+    if ((res = ftruncate(fd, 0)) < 0)
+        panic("ftruncate: %i", res);
+    close(fd);
+
+    if ((res = fs_cache_stat(&after)) < 0)
+        panic("fs_cache_stat: %i", res);
+    print_stat("after", &after);
+    if (after.cs_resident > BUDGET)
+        panic("cache grew over budget");
+    if (after.cs_evictions - small.cs_evictions < NBLOCKS)
+        panic("too few evictions");
+
+    if ((res = fs_cache_budget(before.cs_budget)) < 0)
+        panic("fs_cache_budget: %i", res);
+
+    /* Only programs started by the kernel may change the budget */
+    envid_t child;
+    if ((child = fork()) < 0)
+        panic("fork: %i", child);
+    if (!child) {
+        if ((res = fs_cache_budget(BUDGET)) != -E_BAD_ENV)
+            panic("child changed cache budget: %i", res);
+        return;
+    }
+    wait(child);
+
+    cprintf("bccache OK\n");
+}
@@ -0,0 +1,53 @@
+/* Test extent files: write and read back a file
+ * larger than block pointers can address */
+
+#include <inc/lib.h>
+
+#define FSIZE (MAXFILESIZE + 64 * BLKSIZE + 77)
+#define CHUNK (4 * BLKSIZE)
+
+static uint32_t buf[CHUNK / sizeof(uint32_t)];
+
+static void
+fill(off_t off, size_t n) {
+    for (size_t i = 0; i < n / sizeof(uint32_t); i++)
+        buf[i] = (off / sizeof(uint32_t) + i) * 2654435761U;
+}
+
+void
+umain(int argc, char **argv) {
+    struct Stat st;
+    int fd, res;
+
+    if ((fd = open("/bigfile", O_RDWR | O_CREAT | O_TRUNC)) < 0)
+        panic("open /bigfile: %i", fd);
+
+    for (off_t off = 0; off < FSIZE; off += CHUNK) {
+        size_t n = MIN(CHUNK, FSIZE - off);
+        fill(off, CHUNK);
+        if ((res = write(fd, buf, n)) != n)
+            panic("write at %d: %i", off, res);
+    }
+
+    if ((res = fstat(fd, &st)) < 0)
+        panic("fstat: %i", res);
+    if (st.st_size != FSIZE)
+        panic("size is %ld, expected %ld", (long)st.st_size, (long)FSIZE);
+
+    if ((res = seek(fd, 0)) < 0)
+        panic("seek: %i", res);
+    for (off_t off = 0; off < FSIZE; off += CHUNK) {
+        static uint32_t got[CHUNK / sizeof(uint32_t)];
+        size_t n = MIN(CHUNK, FSIZE - off);
+        fill(off, CHUNK);
+        if ((res = readn(fd, got, n)) != n)
+            panic("read at %d: %i", off, res);
+        if (memcmp(got, buf, n))
+            panic("bad data at %d", off);
+    }
+
+    if ((res = ftruncate(fd, 0)) < 0)
+        panic("ftruncate: %i", res);
+    close(fd);
+    cprintf("bigfile OK\n");
+}
@@ -0,0 +1,44 @@
+/* Test file server dentry cache: repeated lookups of the same
+ * names (existing and missing) are answered from the cache */
+
+#include <inc/lib.h>
+
+#define NLOOKUPS 20
+
+void
+umain(int argc, char **argv) {
+    struct FsDentryStat before, after;
+    int fd, res;
+
+    if ((res = fs_dentry_stat(&before)) < 0)
+        panic("fs_dentry_stat: %i", res);
+
+    for (int i = 0; i < NLOOKUPS; i++) {
+        if ((fd = open("/motd", O_RDONLY)) < 0)
+            panic("open /motd: %i", fd);
+        close(fd);
+        if ((fd = open("/dcache-missing", O_RDONLY)) != -E_NOT_FOUND)
+            panic("open /dcache-missing: %i", fd);
+    }
+
+    /* Creating a file replaces its negative entry */
+    if ((fd = open("/dcache-missing", O_RDWR | O_CREAT)) < 0)
+        panic("create /dcache-missing: %i", fd);
+    close(fd);
+    if ((fd = open("/dcache-missing", O_RDONLY)) < 0)
+        panic("open created /dcache-missing: %i", fd);
+    close(fd);
+
+    if ((res = fs_dentry_stat(&after)) < 0)
+        panic("fs_dentry_stat: %i", res);
+
+    uint64_t hits = after.ds_hits - before.ds_hits;
+    uint64_t neg_hits = after.ds_neg_hits - before.ds_neg_hits;
+    uint64_t misses = after.ds_misses - before.ds_misses;
+    cprintf("dcache: %lu hits (%lu negative), %lu misses\n",
+            (unsigned long)hits, (unsigned long)neg_hits, (unsigned long)misses);
+    if (hits < 2 * (NLOOKUPS - 1) || neg_hits < NLOOKUPS - 1)
+        panic("lookups are not cached");
+
+    cprintf("dcache OK\n");
+}
@@ -0,0 +1,42 @@
+/* Test directory index: create many files in one directory,
+ * then look all of them (and some missing ones) up */
+
+#include <inc/lib.h>
+
+#define NFILES 400
+
+void
+umain(int argc, char **argv) {
+    char path[MAXNAMELEN], buf[MAXNAMELEN];
+    int fd, res;
+
+    for (int i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof(path), "/dirhash%d", i);
+        if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL)) < 0)
+            panic("create %s: %i", path, fd);
+        if ((res = write(fd, path, strlen(path))) != strlen(path))
+            panic("write %s: %i", path, res);
+        close(fd);
+    }
+
+    /* Look up in a different order than created */
+    for (int i = NFILES - 1; i >= 0; i--) {
+        snprintf(path, sizeof(path), "/dirhash%d", i);
+        if ((fd = open(path, O_RDONLY)) < 0)
+            panic("open %s: %i", path, fd);
+        memset(buf, 0, sizeof(buf));
+        if ((res = readn(fd, buf, sizeof(buf))) != strlen(path) || strcmp(buf, path))
+            panic("%s contains '%s'", path, buf);
+        close(fd);
+
+        snprintf(path, sizeof(path), "/dirhash%d", i + NFILES);
+        if ((fd = open(path, O_RDONLY)) != -E_NOT_FOUND)
+            panic("open missing %s: %i", path, fd);
+    }
+
+    if ((fd = open("/motd", O_RDONLY)) < 0)
+        panic("open /motd: %i", fd);
+    close(fd);
+
+    cprintf("dirhash OK\n");
+}
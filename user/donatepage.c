@@ -0,0 +1,61 @@
+/* Test IPC page donation: a multi-page region moves
+ * from parent to child and back without being shared */
+
+#include <inc/lib.h>
+
+#define NPAGES     4
+#define REGION     ((char *)0xa00000)
+#define REGION_CHD ((char *)0xc00000)
+#define SIZE       (NPAGES * PAGE_SIZE)
+
+static void
+check_region(char *va, char pattern) {
+    for (size_t i = 0; i < SIZE; i += PAGE_SIZE)
+        if (va[i] != pattern + (char)(i / PAGE_SIZE))
+            panic("bad byte at %p", va + i);
+
+    /* Moved pages are mapped only here */
+    if (sys_region_refs(va, SIZE) != 1)
+        panic("region at %p is shared", va);
+}
+
+static void
+fill_region(char *va, char pattern) {
+    for (size_t i = 0; i < SIZE; i += PAGE_SIZE)
+        va[i] = pattern + (char)(i / PAGE_SIZE);
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t who;
+    size_t sz = SIZE;
+    int perm;
+
+    if ((who = fork()) == 0) {
+        ipc_recv(&who, REGION_CHD, &sz, &perm);
+        if (sz != SIZE || !(perm & IPC_DONATE))
+            panic("child got %zu bytes perm %x", sz, perm);
+        check_region(REGION_CHD, 'a');
+
+        fill_region(REGION_CHD, 'A');
+        ipc_send(who, 0, REGION_CHD, SIZE, PROT_RW | IPC_DONATE);
+        if (sys_region_refs(REGION_CHD, SIZE))
+            panic("child still maps donated region");
+        return;
+    }
+
+    if (sys_alloc_region(0, REGION, SIZE, PROT_RW) < 0)
+        panic("sys_alloc_region");
+    fill_region(REGION, 'a');
+
+    ipc_send(who, 0, REGION, SIZE, PROT_RW | IPC_DONATE);
+    if (sys_region_refs(REGION, SIZE))
+        panic("parent still maps donated region");
+
+    ipc_recv(&who, REGION, &sz, &perm);
+    if (sz != SIZE || !(perm & IPC_DONATE))
+        panic("parent got %zu bytes perm %x", sz, perm);
+    check_region(REGION, 'A');
+
+    cprintf("donatepage OK\n");
+}
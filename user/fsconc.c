@@ -0,0 +1,79 @@
+/* Test concurrent file server requests: several children read
+ * their own files through request rings while the block cache is
+ * too small to hold them, so misses of different clients overlap */
+
+#include <inc/lib.h>
+
+#define NCHILD  4
+#define NBLOCKS 24
+#define BUDGET  16
+#define CHUNK   (BLKSIZE + 100)
+
+static char buf[CHUNK + 1];
+
+static char
+pattern(int child, size_t off) {
+    return 'a' + (child * 7 + off / BLKSIZE + off) % 26;
+}
+
+static void
+reader(int child, const char *path) {
+    int fd, res;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        panic("open %s: %i", path, fd);
+
+    /* Odd buffer address and size keep reads on the ring */
+    for (size_t off = 0; off < NBLOCKS * BLKSIZE; off += res) {
+        if ((res = read(fd, buf + 1, CHUNK)) <= 0)
+            panic("read %s at %zu: %i", path, off, res);
+        for (size_t i = 0; i < res; i++)
+            if (buf[1 + i] != pattern(child, off + i))
+                panic("%s: bad byte at %zu", path, off + i);
+    }
+    close(fd);
+}
+
+void
+umain(int argc, char **argv) {
+    struct FsCacheStat before;
+    char path[MAXNAMELEN];
+    envid_t children[NCHILD];
+    int fd, res;
+
+    for (int c = 0; c < NCHILD; c++) {
+        snprintf(path, sizeof(path), "/fsconc%d", c);
+        if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC)) < 0)
+            panic("open %s: %i", path, fd);
+        for (size_t off = 0; off < NBLOCKS * BLKSIZE; off += BLKSIZE) {
+            for (size_t i = 0; i < BLKSIZE; i++)
+                buf[i] = pattern(c, off + i);
+            if ((res = write(fd, buf, BLKSIZE)) != BLKSIZE)
+                panic("write %s: %i", path, res);
+        }
+        close(fd);
+    }
+    sync();
+
+    /* Files don't fit, so children keep missing */
+    if ((res = fs_cache_stat(&before)) < 0)
+        panic("fs_cache_stat: %i", res);
+    if ((res = fs_cache_budget(BUDGET)) < 0)
+        panic("fs_cache_budget: %i", res);
+
+    for (int c = 0; c < NCHILD; c++) {
+        if ((children[c] = fork()) < 0)
+            panic("fork: %i", children[c]);
+        if (!children[c]) {
+            snprintf(path, sizeof(path), "/fsconc%d", c);
+            reader(c, path);
+            return;
+        }
+    }
+    for (int c = 0; c < NCHILD; c++)
+        wait(children[c]);
+
+    if ((res = fs_cache_budget(before.cs_budget)) < 0)
+        panic("fs_cache_budget: %i", res);
+    cprintf("fsconc OK\n");
+}
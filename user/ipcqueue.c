@@ -0,0 +1,74 @@
+/* Test queued IPC: child pipelines messages (some with pages)
+ * and a notification, parent receives them in batches. */
+
+#include <inc/lib.h>
+
+#define NMSG  40
+#define SLOTS ((char *)0x60000000)
+#define DONE  0x2
+
+static void
+sender(envid_t parent) {
+    char *page = (char *)UTEMP;
+    int res;
+
+    for (uint32_t i = 0; i < NMSG; i++) {
+        bool with_page = !(i % 4);
+        if (with_page) {
+            if ((res = sys_alloc_region(0, page, PAGE_SIZE, PROT_RW)) < 0)
+                panic("sys_alloc_region: %i", res);
+            snprintf(page, PAGE_SIZE, "message %u", i);
+        }
+
+        while ((res = sys_ipc_queue_send(parent, i, with_page ? page : (void *)MAX_USER_ADDRESS,
+                                         PAGE_SIZE, PROT_R)) == -E_IPC_QUEUE_FULL)
+            sys_yield();
+        if (res < 0) panic("sys_ipc_queue_send: %i", res);
+    }
+
+    if ((res = sys_ipc_notify(parent, DONE)) < 0)
+        panic("sys_ipc_notify: %i", res);
+}
+
+void
+umain(int argc, char **argv) {
+    struct IpcMsg msgs[8];
+    uint64_t notify = 0;
+    int res;
+
+    if ((res = sys_ipc_endpoint(SLOTS, PAGE_SIZE)) < 0)
+        panic("sys_ipc_endpoint: %i", res);
+
+    envid_t child = fork();
+    if (child < 0) panic("fork: %i", child);
+    if (!child) {
+        sender(thisenv->env_parent_id);
+        return;
+    }
+
+    uint32_t next = 0, batches = 0;
+    while (next < NMSG || !(notify & DONE)) {
+        uint64_t bits;
+        if ((res = ipc_queue_recv(msgs, 8, &bits)) < 0)
+            panic("ipc_queue_recv: %i", res);
+        notify |= bits;
+        if (res) batches++;
+
+        for (int i = 0; i < res; i++, next++) {
+            if (msgs[i].msg_from != child || msgs[i].msg_value != next)
+                panic("got %u from %08x, expected %u from %08x",
+                      msgs[i].msg_value, msgs[i].msg_from, next, child);
+            /* Slot could already be reused by a later message
+             * if we were preempted after receiving */
+            if (!(next % 4)) {
+                const char *page = (const char *)msgs[i].msg_va;
+                long n = strncmp(page, "message ", 8) ? -1 : strtol(page + 8, NULL, 10);
+                if (!msgs[i].msg_perm || n < next || (n - next) % IPC_QUEUE_LEN)
+                    panic("bad page in message %u", next);
+            }
+        }
+    }
+
+    cprintf("ipcqueue: %u messages in %u batches\n", next, batches);
+    cprintf("ipcqueue OK\n");
+}
@@ -0,0 +1,36 @@
+/* Test periodic IPC notifications: timer wakes up
+ * a blocked receiver several times and can be stopped */
+
+#include <inc/lib.h>
+
+#define TICK   0x4
+#define PERIOD 100
+#define NTICKS 3
+
+void
+umain(int argc, char **argv) {
+    int res;
+
+    if ((res = sys_ipc_timer(TICK, PERIOD)) != -E_IPC_NOT_RECV)
+        panic("timer without endpoint: %i", res);
+
+    if ((res = sys_ipc_endpoint((void *)MAX_USER_ADDRESS, 0)) < 0)
+        panic("sys_ipc_endpoint: %i", res);
+    if ((res = sys_ipc_timer(TICK, PERIOD)) < 0)
+        panic("sys_ipc_timer: %i", res);
+
+    int start = vsys_gettime();
+    for (int i = 0; i < NTICKS; i++) {
+        uint64_t bits;
+        if ((res = ipc_queue_recv(NULL, 0, &bits)) < 0)
+            panic("ipc_queue_recv: %i", res);
+        if (bits != TICK) panic("got bits %lx", (unsigned long)bits);
+    }
+    if (vsys_gettime() - start > 60)
+        panic("timer is too slow");
+
+    if ((res = sys_ipc_timer(0, 0)) < 0)
+        panic("stopping timer: %i", res);
+
+    cprintf("ipctimer OK\n");
+}
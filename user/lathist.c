@@ -0,0 +1,43 @@
+/* Reset kernel latency histograms, make some system calls
+ * and print what was recorded for them */
+
+#include <inc/lib.h>
+
+#define NITER 1000
+
+static uint64_t
+row_total(const volatile uint32_t *row) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < LATHIST_NBUCKETS; i++)
+        total += row[i];
+    return total;
+}
+
+static void
+print_row(const char *name, const volatile uint32_t *row) {
+    cprintf("%-10s %6lu |", name, (unsigned long)row_total(row));
+    for (size_t i = 0; i < LATHIST_NBUCKETS; i++)
+        if (row[i]) cprintf(" 2^%zu:%u", i, row[i]);
+    cprintf("\n");
+}
+
+void
+umain(int argc, char **argv) {
+    uint32_t resets = lathist.lh_resets;
+    if (sys_lathist_reset() < 0 || lathist.lh_resets != resets + 1)
+        panic("sys_lathist_reset failed");
+
+    for (int i = 0; i < NITER; i++)
+        sys_getenvid();
+    for (int i = 0; i < NITER / 10; i++)
+        sys_region_refs(&resets, sizeof(resets));
+
+    if (row_total(lathist.lh_syscall[SYS_getenvid]) < NITER)
+        panic("sys_getenvid calls were not counted");
+
+    print_row("getenvid", lathist.lh_syscall[SYS_getenvid]);
+    print_row("region_refs", lathist.lh_syscall[SYS_region_refs]);
+    print_row("timer", lathist.lh_trap[IRQ_OFFSET + IRQ_TIMER]);
+    print_row("clock", lathist.lh_trap[IRQ_OFFSET + IRQ_CLOCK]);
+    cprintf("lathist OK\n");
+}
@@ -0,0 +1,58 @@
+/* Test vectored sys_map_regionv()/sys_unmap_regionv():
+ * several scattered regions are mapped and unmapped
+ * with one call each, bad batches change nothing */
+
+#include <inc/lib.h>
+
+#define NREG 3
+#define SRC  ((char *)0xa00000)
+#define DST  ((char *)0xc00000)
+
+static struct MapVec vec[NREG + 1];
+
+void
+umain(int argc, char **argv) {
+    int res;
+
+    for (int i = 0; i < NREG; i++) {
+        char *src = SRC + 2 * i * PAGE_SIZE;
+        size_t size = (i + 1) * PAGE_SIZE;
+        if ((res = sys_alloc_region(0, src, size, PROT_RW)) < 0)
+            panic("sys_alloc_region: %i", res);
+        memset(src, 'a' + i, size);
+        vec[i] = (struct MapVec){(uintptr_t)src, (uintptr_t)DST + 4 * i * PAGE_SIZE, size, PROT_RW | PROT_SHARE};
+    }
+
+    /* Last descriptor is misaligned, nothing should be mapped */
+    vec[NREG] = (struct MapVec){(uintptr_t)SRC + 1, (uintptr_t)DST + 4 * NREG * PAGE_SIZE, PAGE_SIZE, PROT_R};
+    if ((res = sys_map_regionv(0, 0, vec, NREG + 1)) != -E_INVAL)
+        panic("bad batch: %i", res);
+    for (int i = 0; i < NREG; i++)
+        if (is_page_present((void *)vec[i].mv_dstva))
+            panic("region %d mapped by bad batch", i);
+
+    if ((res = sys_map_regionv(0, 0, vec, NREG)) < 0)
+        panic("sys_map_regionv: %i", res);
+    for (int i = 0; i < NREG; i++) {
+        char *dst = (char *)vec[i].mv_dstva;
+        for (size_t j = 0; j < vec[i].mv_size; j += PAGE_SIZE)
+            if (dst[j] != 'a' + i) panic("region %d: bad byte at %p", i, dst + j);
+        if (sys_region_refs(dst, vec[i].mv_size) != 2)
+            panic("region %d is not shared", i);
+        /* Writes go through to the source */
+        dst[0] = 'A' + i;
+        if (SRC[2 * i * PAGE_SIZE] != 'A' + i)
+            panic("region %d is a copy", i);
+    }
+
+    if ((res = sys_unmap_regionv(0, vec, NREG)) < 0)
+        panic("sys_unmap_regionv: %i", res);
+    for (int i = 0; i < NREG; i++) {
+        if (is_page_present((void *)vec[i].mv_dstva))
+            panic("region %d still mapped", i);
+        if (sys_region_refs(SRC + 2 * i * PAGE_SIZE, vec[i].mv_size) != 1)
+            panic("region %d source still shared", i);
+    }
+
+    cprintf("mapregionv OK\n");
+}
@@ -0,0 +1,41 @@
+/* NVMe throughput benchmark: ask the file server to keep more and
+ * more commands in flight and report bandwidth and doorbell writes */
+
+#include <inc/lib.h>
+
+static const uint32_t depths[] = {1, 2, 4, 8, 16, 32, 64, 128};
+static const uint32_t iosizes[] = {4096, 65536};
+
+static void
+run(uint32_t depth, uint32_t iosize, bool write) {
+    struct FsBench bench = {.fb_depth = depth, .fb_iosize = iosize, .fb_write = write};
+    int res;
+
+    /* Writes go over the log, which has to be idle */
+    if (write && (res = sync()) < 0) panic("sync: %i", res);
+
+    /* Image without a log can't be written, depth may be
+     * above what the controller gave us */
+    if ((res = fs_nvme_bench(&bench)) == -E_NOT_SUPP || res == -E_INVAL) {
+        cprintf("%-5s %6u %5u   not supported\n", write ? "write" : "read", iosize, depth);
+        return;
+    }
+    if (res < 0) panic("fs_nvme_bench: %i", res);
+
+    uint64_t usec = MAX(bench.fb_nsec / 1000, 1);
+    cprintf("%-5s %6u %5u %8lu %8lu %10lu\n", write ? "write" : "read",
+            iosize, depth, (unsigned long)(bench.fb_bytes / usec),
+            (unsigned long)(bench.fb_bytes / iosize * 1000000 / usec),
+            (unsigned long)bench.fb_doorbells);
+}
+
+void
+umain(int argc, char **argv) {
+    cprintf("%-5s %6s %5s %8s %8s %10s\n", "op", "size", "depth", "MB/s", "IOPS", "doorbells");
+    for (size_t i = 0; i < sizeof(iosizes) / sizeof(*iosizes); i++)
+        for (size_t j = 0; j < sizeof(depths) / sizeof(*depths); j++)
+            run(depths[j], iosizes[i], 0);
+    for (size_t j = 0; j < sizeof(depths) / sizeof(*depths); j++)
+        run(depths[j], 4096, 1);
+    cprintf("nvmebench OK\n");
+}
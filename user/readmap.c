@@ -0,0 +1,64 @@
+/* Test zero-copy reads: large aligned reads map file blocks
+ * copy-on-write, later writes on either side stay private */
+
+#include <inc/lib.h>
+
+#define NBLOCKS 16
+#define FSIZE   (NBLOCKS * BLKSIZE + 100)
+
+static char buf[NBLOCKS * BLKSIZE] __attribute__((aligned(PAGE_SIZE)));
+static char tail[BLKSIZE];
+
+static char
+pattern(size_t off) {
+    return 'a' + (off / BLKSIZE + off) % 26;
+}
+
+void
+umain(int argc, char **argv) {
+    int fd, res;
+
+    if ((fd = open("/readmap", O_RDWR | O_CREAT | O_TRUNC)) < 0)
+        panic("open /readmap: %i", fd);
+    for (size_t off = 0; off < FSIZE; off += sizeof(tail)) {
+        size_t n = MIN(sizeof(tail), FSIZE - off);
+        for (size_t i = 0; i < n; i++)
+            tail[i] = pattern(off + i);
+        if ((res = write(fd, tail, n)) != n)
+            panic("write: %i", res);
+    }
+
+    /* Whole blocks are mapped, the rest is copied */
+    if ((res = seek(fd, 0)) < 0)
+        panic("seek: %i", res);
+    if ((res = read(fd, buf, sizeof(buf))) != sizeof(buf))
+        panic("read: %i", res);
+    if ((res = read(fd, tail, sizeof(tail))) != FSIZE - sizeof(buf))
+        panic("read tail: %i", res);
+    for (size_t i = 0; i < sizeof(buf); i++)
+        if (buf[i] != pattern(i)) panic("bad byte at %zu", i);
+    for (size_t i = 0; i < FSIZE - sizeof(buf); i++)
+        if (tail[i] != pattern(sizeof(buf) + i)) panic("bad tail byte at %zu", i);
+
+    /* Buffer stays writable and private */
+    memset(buf, 'X', BLKSIZE);
+
+    /* File changes don't show up in the buffer */
+    if ((res = seek(fd, BLKSIZE)) < 0)
+        panic("seek: %i", res);
+    memset(tail, 'Y', BLKSIZE);
+    if ((res = write(fd, tail, BLKSIZE)) != BLKSIZE)
+        panic("write: %i", res);
+    for (size_t i = BLKSIZE; i < 2 * BLKSIZE; i++)
+        if (buf[i] != pattern(i)) panic("buffer changed at %zu", i);
+
+    if ((res = seek(fd, 0)) < 0)
+        panic("seek: %i", res);
+    if ((res = readn(fd, tail, BLKSIZE)) != BLKSIZE)
+        panic("read: %i", res);
+    for (size_t i = 0; i < BLKSIZE; i++)
+        if (tail[i] != pattern(i)) panic("file changed at %zu", i);
+
+    close(fd);
+    cprintf("readmap OK\n");
+}
@@ -0,0 +1,40 @@
+/* Test metadata log: create and grow many small files,
+ * with log commits and checkpoints in between */
+
+#include <inc/lib.h>
+
+#define NFILES 150
+
+void
+umain(int argc, char **argv) {
+    char path[MAXNAMELEN], buf[MAXNAMELEN];
+    int fd, res;
+
+    for (int i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof(path), "/small%d", i);
+        if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL)) < 0)
+            panic("create %s: %i", path, fd);
+        for (int j = 0; j <= i % 3; j++)
+            if ((res = write(fd, path, strlen(path))) != strlen(path))
+                panic("write %s: %i", path, res);
+        close(fd);
+        if (i % 50 == 49) sync();
+    }
+
+    for (int i = 0; i < NFILES; i++) {
+        struct Stat st;
+        snprintf(path, sizeof(path), "/small%d", i);
+        if ((fd = open(path, O_RDONLY)) < 0)
+            panic("open %s: %i", path, fd);
+        if ((res = fstat(fd, &st)) < 0)
+            panic("fstat %s: %i", path, res);
+        if (st.st_size != (i % 3 + 1) * strlen(path))
+            panic("%s has size %ld", path, (long)st.st_size);
+        memset(buf, 0, sizeof(buf));
+        if ((res = readn(fd, buf, strlen(path))) != strlen(path) || strcmp(buf, path))
+            panic("%s contains '%s'", path, buf);
+        close(fd);
+    }
+
+    cprintf("smallfiles OK\n");
+}
@@ -0,0 +1,36 @@
+/* Compare system call cost via SYSCALL and via int T_SYSCALL */
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER 100000
+
+/* sys_getenvid() through the legacy interrupt gate */
+static envid_t
+getenvid_int(void) {
+    register uintptr_t num asm("rax") = SYS_getenvid;
+    asm volatile("int %1\n"
+                 : "+r"(num)
+                 : "i"(T_SYSCALL)
+                 : "cc", "memory");
+    return (envid_t)num;
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t id = sys_getenvid();
+    assert(getenvid_int() == id);
+
+    uint64_t start = read_tsc();
+    for (int i = 0; i < NITER; i++)
+        if (sys_getenvid() != id) panic("syscall: bad envid");
+    uint64_t fast = read_tsc() - start;
+
+    start = read_tsc();
+    for (int i = 0; i < NITER; i++)
+        if (getenvid_int() != id) panic("int: bad envid");
+    uint64_t slow = read_tsc() - start;
+
+    cprintf("syscall: %lu cycles per call\n", (unsigned long)(fast / NITER));
+    cprintf("int %d: %lu cycles per call\n", T_SYSCALL, (unsigned long)(slow / NITER));
+}
@@ -0,0 +1,58 @@
+/* Test file server request ring: parent and forked child
+ * write and read back multi-page files concurrently */
+
+#include <inc/lib.h>
+
+#define FSIZE (5 * PAGE_SIZE + 123)
+
+static char buf[FSIZE];
+
+static void
+check(const char *path, char pattern) {
+    struct Stat st;
+    int fd, res;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC)) < 0)
+        panic("open %s: %i", path, fd);
+
+    memset(buf, pattern, sizeof(buf));
+    if ((res = write(fd, buf, sizeof(buf))) != sizeof(buf))
+        panic("write %s: %i", path, res);
+
+    if ((res = fstat(fd, &st)) < 0)
+        panic("fstat %s: %i", path, res);
+    if (st.st_size != FSIZE || st.st_isdir || strcmp(st.st_name, path + 1))
+        panic("fstat %s: got %s size %ld", path, st.st_name, (long)st.st_size);
+
+    if ((res = seek(fd, 0)) < 0)
+        panic("seek %s: %i", path, res);
+    memset(buf, 0, sizeof(buf));
+    if ((res = readn(fd, buf, sizeof(buf))) != sizeof(buf))
+        panic("read %s: %i", path, res);
+    for (size_t i = 0; i < sizeof(buf); i++)
+        if (buf[i] != pattern) panic("%s: bad byte at %zu", path, i);
+
+    /* Reading past the end stops at the end */
+    if ((res = read(fd, buf, sizeof(buf))) != 0)
+        panic("read %s at end: %i", path, res);
+
+    if ((res = ftruncate(fd, PAGE_SIZE)) < 0)
+        panic("ftruncate %s: %i", path, res);
+    if ((res = fstat(fd, &st)) < 0 || st.st_size != PAGE_SIZE)
+        panic("ftruncate %s did not change size", path);
+
+    close(fd);
+}
+
+void
+umain(int argc, char **argv) {
+    envid_t child = fork();
+    if (child < 0) panic("fork: %i", child);
+
+    for (int i = 0; i < 3; i++)
+        check(child ? "/ringparent" : "/ringchild", child ? 'p' : 'c');
+
+    if (!child) return;
+    wait(child);
+    cprintf("testfsring OK\n");
+}